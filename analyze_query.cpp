@@ -2,180 +2,508 @@
 #include <fstream>
 #include <algorithm>
 #include <random>
+#include <sstream>
 #include <unistd.h>
 #include <stdio.h>
 #include "util/file_handler.h"
 #include "util/read_file.h"
 #include "util/utils.h"
 #include "util/flat.h"
+#include "util/quantized_centroids.h"
+#include "util/hnsw.h"
+#include "util/centroid_tree.h"
+#include "util/io_trace.h"
+#include "util/locality.h"
+#include "util/reuse_distance.h"
+#include "util/refine.h"
+#include "util/numa.h"
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
-#include <unordered_set>
 using namespace std;
-void analyze_power_law()
+
+// Query analysis driver: the queries and centroids are loaded once, the
+// coarse search runs once with the largest nprobe and every nprobe setting
+// reads its prefix of the sorted result. Analyses:
+//   popularity  probes per centroid over the first count_window queries
+//   locality    share of the other queries in a window that probe a common centroid
+//   overlap     centroids a query shares with the previous query
+//   trace       binary probe trace for replay_trace
+//   stream      sliding-window working set, reuse gaps and popularity drift
+//   mrc         exact LRU miss-ratio curve of the cluster cache
+//   refine      two-stage search of the index: residual codes in memory, the
+//               refine_r best candidates re-ranked from the raw clusters
+// outputs under output_path: coarse_ids.bin (nq, max nprobe), centroids_count.bin
+// (settings, centroids), centroids_count.txt (largest nprobe), summary.tsv and
+// probe_trace-np<nprobe>.bin, locality_curve-np<nprobe>.txt, drift-np<nprobe>.txt
+// mrc-np<nprobe>.txt and refine_ids-np<nprobe>.bin (nq, topk).
+
+// u8bin queries, required (--query)
+string query_file;
+string centroid_file = "result/centroids_100M_1GB";
+string output_path = "output/";
+vector<int> nprobes = {34};
+int64_t window_size = 2500;
+int64_t count_window = 10000;
+int64_t epoch_size = 1000;
+string analyses = "popularity,locality,overlap";
+
+// run the coarse search on uint8 quantized centroids with a float re-rank
+bool use_quantized_centroids = false;
+// select nprobe with the centroid HNSW graph stored under this path
+string hnsw_index_path;
+// descend the multi-level centroid tree stored under this path instead (written by build_tree)
+string tree_index_path;
+int64_t tree_beam = 8;
+// dump the metrics registry here at exit (.json or Prometheus text)
+string metrics_file;
+// cluster sizes for the trace and stream analyses come from the metas under this path,
+// the refine analysis searches its clusters
+string index_path;
+// two-stage search: final neighbors and candidates re-ranked per query
+int64_t topk = 10;
+int64_t refine_r = 100;
+// pages of gap read rather than split when coalescing the re-rank reads
+int64_t refine_gap = 1;
+// comma separated replica directories of layout_clusters, the refine reads
+// are routed over them with the layout saved under index_path
+string layout_dirs;
+// brute-force coarse search: 1 = knn_1, 2 = knn_2, 3 = tiled knn_3
+KnnVariant knn_variant = KnnVariant::QUERY_SCAN;
+// page backing of the query and centroid matrices
+HugePageMode hugepages = HugePageMode::None;
+// run the brute-force coarse search and the compressed cluster scan on a
+// work-stealing pool (ws) or on OpenMP's static loops (omp)
+bool use_work_stealing = true;
+// run the brute-force coarse search on the persistent per-node workers,
+// every node scanning its own replica of the centroids
+bool use_numa = false;
+
+// false when the coarse index does not fit the centroids
+// qc holds the codes trained on centroids_data when --sq8 is given,
+// pool schedules the brute-force scans when it is not null, replicas (--numa)
+// moves them onto the node workers
+bool coarse_search(const uint8_t *query_data, const float *centroids_data,
+                   uint32_t number_query, uint32_t number_centroids, uint32_t dim,
+                   int nprobe, float *coarse_dis, uint32_t *idx,
+                   const QuantizedCentroids<uint8_t>* qc, WorkStealingPool* pool,
+                   const NumaReplicated<float>* replicas)
 {
-    const char *Query_Path = "/home/tianbin/dataset/query.public.10K.u8bin";
-    //const char *Centroids_Path = "/home/tianbin/smartann/HKmeans/result/centroids_100M_1GB";
-    uint32_t number_centroids = 90;
-    uint32_t temp;
-    uint32_t cdim = 128;
-    
-    IOReader data_reader("/home/tianbin/smartann/HKmeans/result/centroids_100M_2GB");
-    data_reader.read((char*)&temp, sizeof(uint32_t));
-    data_reader.read((char*)&temp, sizeof(uint32_t));
-    float* centroids_data = new float[number_centroids * cdim];
-    data_reader.read((char*)centroids_data, number_centroids * cdim * sizeof(float));
-    
-    uint32_t number_query,  qdim;
-    uint8_t *query_data = NULL;
-    //read query
-    get_bin_metadata(Query_Path, number_query, qdim);
-    read_bin_file(Query_Path, query_data, number_query, qdim);
-    //read centroids
-    //get_bin_metadata(Centroids_Path, number_centroids, cdim);
-    //read_bin_file(Centroids_Path, centroids_data, number_centroids, cdim);
-
-    int nprobe = 30;
-    std::unique_ptr<uint32_t[]> idx(new uint32_t[number_query * nprobe]);
-    std::unique_ptr<float[]> coarse_dis(new float[number_query * nprobe]);
-    knn_1<CMax<float, uint32_t>, uint8_t, float> (
-        query_data, 
-        centroids_data, 
-        number_query, 
-        number_centroids, 
-        qdim, nprobe, 
-        coarse_dis.get(), 
-        idx.get(), 
-        L2sqr<const uint8_t, const float, float>);
-    coarse_dis = nullptr;
-    
-    //record count of centroids
-    /*
-    int *count = new int[number_centroids]();
-    int win_size = 100;
-    for(int i=0; i < win_size*nprobe; i++)
-    {
-        count[idx[i]]++;
-    }
-    for(int j = 0; j < number_centroids; j++)
-    {
-        cout<<count[j]<<'\t';
-    }
-    */
-   
-    ofstream query_file("query_to_centroids.txt");
-    int temp1 = 0;
-    for(int i = 0; i < number_query * nprobe;i++)
-    {
-        query_file << idx[i] << "\t";
-        temp1++;
-        while(temp1 == nprobe)
-        {
-            query_file << "\n";
-            temp1 = 0;
+    if (qc != nullptr) {
+        knn_1_quantized<CMax<float, uint32_t>, uint8_t, uint8_t> (
+            query_data, *qc, centroids_data,
+            number_query, nprobe,
+            coarse_dis, idx, 2, pool);
+        return true;
+    }
+    if (!tree_index_path.empty()) {
+        CentroidTree tree;
+        // the leaves must be the centroids of the file, their ids index the clusters
+        if (!tree.load(tree_index_path) ||
+            tree.level_size(tree.num_levels() - 1) != number_centroids || tree.dimension() != dim) {
+            cerr << "centroid tree under " << tree_index_path << " does not match the " << number_centroids
+                 << " centroids of dim " << dim << ", rebuild it with build_tree" << endl;
+            return false;
         }
+        TreeSearchStats stats;
+        tree_knn<CMax<float, uint32_t>, uint8_t> (
+            query_data, tree, number_query, nprobe,
+            vector<int64_t>(1, tree_beam), coarse_dis, idx, &stats);
+        stats.print();
+        return true;
     }
-    query_file.close();
-    
-    int *count = new int[number_centroids]();
-    int win_size = 10000;
-    for(int i=0; i < win_size*nprobe; i++)
-    {
-        count[idx[i]]++;
-    }
-    ofstream OutFile("centroids_count.txt");
-    for(int i = 0; i < number_centroids; i++)
-    {
-        OutFile << count[i] <<"\n";
-    }
-    OutFile.close();
-    delete [] centroids_data;
-    delete [] query_data;
-    delete [] count;
+    if (!hnsw_index_path.empty()) {
+        CentroidHNSW index;
+        string index_file = hnsw_index_file(hnsw_index_path);
+        // a graph of another centroid file is rebuilt and overwritten
+        if (access(index_file.c_str(), F_OK) != 0 ||
+            !index.load(index_file, centroids_data, number_centroids, dim)) {
+            index.build(centroids_data, number_centroids, dim);
+            index.save(index_file);
+        }
+        hnsw_knn<CMax<float, uint32_t>, uint8_t> (
+            query_data, index, number_query, nprobe, 4 * nprobe,
+            coarse_dis, idx);
+        return true;
+    }
+    if (replicas != nullptr) {
+        numa_knn<CMax<float, uint32_t>, uint8_t, float> (
+            NumaExecutor::global(), query_data, *replicas,
+            number_query, number_centroids, dim, nprobe,
+            coarse_dis, idx,
+            L2sqr<const uint8_t, const float, float>, knn_variant);
+        return true;
+    }
+    knn<CMax<float, uint32_t>, uint8_t, float> (
+        knn_variant,
+        query_data,
+        centroids_data,
+        number_query,
+        number_centroids,
+        dim, nprobe,
+        coarse_dis,
+        idx,
+        L2sqr<const uint8_t, const float, float>,
+        pool);
+    return true;
 }
 
-bool hasDuplicate(int arr1[], int len1, int arr2[], int len2)
+// Centroid files written by older tools carry a (1, 1) header, the count is
+// then taken from the file size with the dimension of the queries.
+void load_centroids(const string& file_name, uint32_t dim_hint,
+                    HugeArray<float>& centroids, uint32_t& number_centroids, uint32_t& dim)
 {
-    unordered_set<int> set1(arr1, arr1 + len1);
-    for(int i = 0; i < len2; i++)
-    {
-        if(set1.find(arr2[i]) != set1.end())
-        {
-            return true;
+    IOReader reader(file_name);
+    uint64_t fsize = reader.get_file_size();
+    reader.read((char*)&number_centroids, sizeof(uint32_t));
+    reader.read((char*)&dim, sizeof(uint32_t));
+    if (2 * sizeof(uint32_t) + (uint64_t)number_centroids * dim * sizeof(float) != fsize) {
+        dim = dim_hint;
+        number_centroids = (fsize - 2 * sizeof(uint32_t)) / (dim * sizeof(float));
+        cout << "header of " << file_name << " does not match its size, use n = "
+             << number_centroids << ", dim = " << dim << endl;
+    }
+    centroids = HugeArray<float>((uint64_t)number_centroids * dim, hugepages);
+    reader.read((char*)centroids.data(), centroids.size() * sizeof(float));
+    cout << "centroids of " << file_name << " on pages: " << hugepage_mode_name(centroids.backing()) << endl;
+}
+
+// probed centroids of one query as a bitset, one row per query
+struct ProbeSets {
+    int64_t words;
+    vector<uint64_t> bits;
+
+    ProbeSets(const uint32_t *idx, int64_t nq, int max_nprobe, int nprobe, uint32_t number_centroids)
+        : words((number_centroids + 63) / 64), bits(nq * words, 0) {
+        for (int64_t q = 0; q < nq; q++) {
+            for (int j = 0; j < nprobe; j++) {
+                uint32_t c = idx[q * max_nprobe + j];
+                bits[q * words + c / 64] |= 1ULL << (c % 64);
+            }
         }
     }
-    return false;
+
+    const uint64_t* row(int64_t q) const { return bits.data() + q * words; }
+
+    bool intersect(int64_t a, int64_t b) const {
+        for (int64_t w = 0; w < words; w++) {
+            if (row(a)[w] & row(b)[w]) return true;
+        }
+        return false;
+    }
+
+    int64_t common(int64_t a, int64_t b) const {
+        int64_t cnt = 0;
+        for (int64_t w = 0; w < words; w++) cnt += __builtin_popcountll(row(a)[w] & row(b)[w]);
+        return cnt;
+    }
+};
+
+struct AnalysisSummary {
+    int nprobe;
+    uint32_t max_count = 0;
+    uint32_t min_count = 0;
+    // probes that go to the hottest 10% of the centroids
+    double top10_share = 0;
+    double locality = 0;
+    double overlap = 0;
+};
+
+void analyze_popularity(const uint32_t *idx, int64_t nq, int max_nprobe, int nprobe,
+                        uint32_t number_centroids, vector<uint32_t>& count, AnalysisSummary& summary)
+{
+    int64_t win = std::min(count_window, nq);
+    count.assign(number_centroids, 0);
+    for (int64_t q = 0; q < win; q++) {
+        for (int j = 0; j < nprobe; j++) count[idx[q * max_nprobe + j]]++;
+    }
+    vector<uint32_t> sorted(count);
+    sort(sorted.begin(), sorted.end(), greater<uint32_t>());
+    uint64_t total = win * nprobe, top = 0;
+    for (uint32_t c = 0; c < std::max<uint32_t>(1, number_centroids / 10); c++) top += sorted[c];
+    summary.max_count = sorted.front();
+    summary.min_count = sorted.back();
+    summary.top10_share = total ? (double)top / total : 0;
 }
-void analy_query_locality()
+
+// average over the queries of a window of the share of the other queries
+// that probe at least one common centroid
+void analyze_locality(const ProbeSets& sets, int64_t nq, AnalysisSummary& summary)
 {
-    uint32_t number_centroids = 174;
-    int nprobe = 34;
-    uint32_t temp;
-    uint32_t cdim = 128;
-    uint32_t number_query,  qdim;
-    uint8_t *query_data = NULL;
-    float* centroids_data = new float[number_centroids * cdim];
-    const char *Query_Path = "/home/tianbin/dataset/query.public.10K.u8bin";
-    get_bin_metadata(Query_Path, number_query, qdim);
-    read_bin_file(Query_Path, query_data, number_query, qdim);
-    IOReader data_reader("/home/tianbin/smartann/HKmeans/result/centroids_100M_1GB");
-    data_reader.read((char*)&temp, sizeof(uint32_t));
-    data_reader.read((char*)&temp, sizeof(uint32_t));
-    data_reader.read((char*)centroids_data, number_centroids * cdim * sizeof(float));
-
-    std::unique_ptr<uint32_t[]> idx(new uint32_t[number_query * nprobe]);
-    std::unique_ptr<float[]> coarse_dis(new float[number_query * nprobe]);
-    knn_1<CMax<float, uint32_t>, uint8_t, float> (
-        query_data, 
-        centroids_data, 
-        number_query, 
-        number_centroids, 
-        qdim, nprobe, 
-        coarse_dis.get(), 
-        idx.get(), 
-        L2sqr<const uint8_t, const float, float>);
-    coarse_dis = nullptr;
-
-    int windows = 2500;
-
-    //std::vector<std::vector<int>> query_to_centroids(windows,std::vector<int>(nprobe));
-    int query_to_centroids[windows][nprobe];
-    //get query_to_centroids within windows
-    for(int i = 0; i < windows; i++)
-    {
-        for(int j = 0; j < nprobe; j++)
-        {
-            query_to_centroids[i][j] = idx[i*nprobe + j];
+    int64_t win = std::min(window_size, nq);
+    double sum = 0;
+#pragma omp parallel for reduction(+:sum) schedule(dynamic)
+    for (int64_t i = 0; i < win; i++) {
+        int64_t cnt = 0;
+        for (int64_t j = 0; j < win; j++) {
+            if (i != j && sets.intersect(i, j)) cnt++;
         }
+        sum += cnt / (double)win;
+    }
+    summary.locality = sum / win;
+}
+
+// average share of its probes a query has in common with the previous query
+void analyze_overlap(const ProbeSets& sets, int64_t nq, int nprobe, AnalysisSummary& summary)
+{
+    double sum = 0;
+    for (int64_t q = 1; q < nq; q++) sum += sets.common(q, q - 1) / (double)nprobe;
+    summary.overlap = nq > 1 ? sum / (nq - 1) : 0;
+}
+
+// replays the queries in order through the sliding-window analyzer
+void analyze_stream(const uint32_t *idx, int64_t nq, int max_nprobe, int nprobe,
+                    const vector<vector<uint32_t>>& metas, uint32_t dim)
+{
+    vector<uint64_t> cluster_bytes(metas.size(), 0);
+    for (size_t c = 0; c < metas.size(); c++) {
+        for (auto rows : metas[c]) cluster_bytes[c] += (uint64_t)rows * dim * sizeof(uint8_t);
+    }
+    uint32_t number_centroids = *max_element(idx, idx + nq * max_nprobe) + 1;
+    number_centroids = std::max<uint32_t>(number_centroids, metas.size());
+    SlidingWindowLocality locality(window_size, number_centroids, cluster_bytes, epoch_size);
+    for (int64_t q = 0; q < nq; q++) locality.push(idx + q * max_nprobe, nprobe);
+    locality.print();
+    locality.write(output_path + "locality_curve-np" + to_string(nprobe) + TEXT,
+                   output_path + "drift-np" + to_string(nprobe) + TEXT);
+}
+
+void write_probe_trace(const uint32_t *idx, int64_t nq, int max_nprobe, int nprobe,
+                       const vector<vector<uint32_t>>& metas, uint32_t dim, uint64_t span_ns)
+{
+    // trace_probes takes a dense (nq, nprobe) result
+    ArenaScope scratch;
+    uint32_t* prefix = scratch.alloc<uint32_t>(nq * nprobe);
+    for (int64_t q = 0; q < nq; q++) {
+        memcpy(prefix + q * nprobe, idx + q * max_nprobe, nprobe * sizeof(uint32_t));
     }
-    int *count = new int[windows]();
-    int record = 0;
-    for(int i = 0; i < windows; i++)
-    {
-        for(int j = 0; j < windows; j++)
-        {
-            if(hasDuplicate(query_to_centroids[i], nprobe, query_to_centroids[j], nprobe) && (i != j))
-            {
-                count[i]++;
+    IOTraceWriter writer(output_path + "probe_trace-np" + to_string(nprobe) + BIN);
+    trace_probes(writer, prefix, nq, nprobe, span_ns, metas, dim * sizeof(uint8_t));
+}
+
+bool enabled(const string& analysis)
+{
+    return ("," + analyses + ",").find("," + analysis + ",") != string::npos;
+}
+
+void analyze_queries()
+{
+    uint32_t number_query, qdim;
+    HugeArray<uint8_t> query;
+    read_bin_file(query_file, query, number_query, qdim, hugepages);
+    const uint8_t* query_data = query.data();
+
+    HugeArray<float> centroids;
+    uint32_t number_centroids, cdim;
+    load_centroids(centroid_file, qdim, centroids, number_centroids, cdim);
+    assert(cdim == qdim);
+
+    sort(nprobes.begin(), nprobes.end());
+    nprobes.erase(unique(nprobes.begin(), nprobes.end()), nprobes.end());
+    nprobes.erase(remove_if(nprobes.begin(), nprobes.end(),
+                            [&](int p) { return p <= 0 || p > (int)number_centroids; }), nprobes.end());
+    if (nprobes.empty()) {
+        cerr << "no valid nprobe for " << number_centroids << " centroids" << endl;
+        return;
+    }
+    const int max_nprobe = nprobes.back();
+    const int64_t nq = number_query;
+
+    // search buffers live in the arena until the analyses are done
+    ArenaScope scratch;
+    uint32_t* idx = scratch.alloc<uint32_t>(nq * max_nprobe);
+    float* coarse_dis = scratch.alloc<float>(nq * max_nprobe);
+    auto search_start = std::chrono::steady_clock::now();
+    std::unique_ptr<WorkStealingPool> pool;
+    if (use_work_stealing) pool.reset(new WorkStealingPool(omp_get_max_threads()));
+    // the codes are trained once per centroid file
+    std::unique_ptr<QuantizedCentroids<uint8_t>> qc;
+    if (use_quantized_centroids) {
+        qc.reset(new QuantizedCentroids<uint8_t>());
+        // the queries are uint8, their whole range is kept in the codes
+        qc->train(centroids.data(), number_centroids, cdim, 0, 255);
+    }
+    // one copy of the centroids per node, first touched by the node's driver
+    std::unique_ptr<NumaReplicated<float>> replicas;
+    if (use_numa) {
+        NumaExecutor::global().topology().print();
+        replicas.reset(new NumaReplicated<float>(centroids.data(), (size_t)number_centroids * cdim));
+    }
+    if (!coarse_search(query_data, centroids.data(), number_query, number_centroids,
+                       qdim, max_nprobe, coarse_dis, idx, qc.get(), pool.get(), replicas.get())) {
+        return;
+    }
+    uint64_t search_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - search_start).count();
+    write_bin_file<uint32_t>(output_path + "coarse_ids" + BIN, idx, number_query, max_nprobe);
+
+    vector<vector<uint32_t>> metas;
+    if (!index_path.empty()) {
+        metas.resize(number_centroids);
+        load_meta_impl(index_path, metas, number_centroids);
+    }
+
+    // the residual codes (residual_encode) stay loaded across the nprobe settings
+    std::unique_ptr<TwoStageSearch<uint8_t>> two_stage;
+    if (enabled("refine") && !index_path.empty()) {
+        if (!TwoStageSearch<uint8_t>::fits(number_centroids, nq)) return;
+        two_stage.reset(new TwoStageSearch<uint8_t>(index_path, centroids.data(), number_centroids, qdim, refine_gap));
+    }
+    std::unique_ptr<DeviceLayout> layout;
+    // per-device disk counters, published when the analyses are done
+    vector<std::unique_ptr<DiskStat_Read_Counter>> disk_counters;
+    if (two_stage && !layout_dirs.empty()) {
+        vector<string> dirs;
+        stringstream ss(layout_dirs);
+        for (string dir; getline(ss, dir, ',');) dirs.push_back(dir);
+        layout.reset(new DeviceLayout(dirs));
+        if (!layout->load(index_path + GLOBAL + LAYOUT + BIN, number_centroids)) return;
+        layout->print();
+        two_stage->set_layout(layout.get());
+        disk_counters = layout->disk_counters();
+    }
+
+    vector<AnalysisSummary> summaries;
+    vector<uint32_t> all_counts, count;
+    for (int nprobe : nprobes) {
+        AnalysisSummary summary;
+        summary.nprobe = nprobe;
+        if (enabled("popularity")) {
+            analyze_popularity(idx, nq, max_nprobe, nprobe, number_centroids, count, summary);
+            all_counts.insert(all_counts.end(), count.begin(), count.end());
+        }
+        if (enabled("locality") || enabled("overlap")) {
+            ProbeSets sets(idx, nq, max_nprobe, nprobe, number_centroids);
+            if (enabled("locality")) analyze_locality(sets, nq, summary);
+            if (enabled("overlap")) analyze_overlap(sets, nq, nprobe, summary);
+        }
+        if (enabled("trace")) {
+            write_probe_trace(idx, nq, max_nprobe, nprobe, metas, qdim, search_ns);
+        }
+        if (enabled("stream")) {
+            analyze_stream(idx, nq, max_nprobe, nprobe, metas, qdim);
+        }
+        if (enabled("mrc")) {
+            ReuseDistanceAnalyzer analyzer(cluster_weights(metas, number_centroids, qdim * sizeof(uint8_t)));
+            analyzer.access_probes(idx, nq, max_nprobe, nprobe);
+            analyzer.print();
+            analyzer.write(output_path + "mrc-np" + to_string(nprobe) + TEXT);
+        }
+        if (two_stage) {
+            ArenaScope result;
+            float* dis = result.alloc<float>(nq * topk);
+            uint32_t* ids = result.alloc<uint32_t>(nq * topk);
+            refine_stat stat;
+            if (!two_stage->search(query_data, nq, idx, max_nprobe, nprobe, topk, refine_r, dis, ids, stat,
+                                   pool.get())) {
+                cerr << "refine of nprobe " << nprobe << " failed, index under " << index_path << " is incomplete" << endl;
+                return;
             }
+            print_refine_stat(stat);
+            write_bin_file<uint32_t>(output_path + "refine_ids-np" + to_string(nprobe) + BIN, ids, nq, topk);
         }
+        cout << "nprobe " << nprobe << ": locality " << summary.locality
+             << ", overlap " << summary.overlap << ", top10% share " << summary.top10_share << endl;
+        summaries.push_back(summary);
     }
-    double sum = 0;
-    for(int i = 0; i < windows; i++)
-    {
-        sum += count[i] / (double)windows;
+    if (layout) layout->print_routed();
+
+    if (enabled("popularity")) {
+        write_bin_file<uint32_t>(output_path + "centroids_count" + BIN, all_counts.data(),
+                                 nprobes.size(), number_centroids);
+        ofstream OutFile(output_path + "centroids_count" + TEXT);
+        for (uint32_t c = 0; c < number_centroids; c++) OutFile << count[c] << "\n";
+    }
+
+    ofstream summary_file(output_path + "summary.tsv");
+    summary_file << "nprobe\tmax_count\tmin_count\ttop10_share\tlocality\toverlap\n";
+    for (auto& s : summaries) {
+        summary_file << s.nprobe << "\t" << s.max_count << "\t" << s.min_count << "\t"
+                     << s.top10_share << "\t" << s.locality << "\t" << s.overlap << "\n";
     }
-    double avg = sum/windows;
-    cout<<"avgery value:"<<avg;
-    delete [] count;
-    delete [] centroids_data;
-    delete [] query_data;
+    cout << "write summary to " << output_path << "summary.tsv" << endl;
+}
 
+vector<int> parse_list(const string& s)
+{
+    vector<int> ret;
+    stringstream ss(s);
+    for (string item; getline(ss, item, ',');) ret.push_back(atoi(item.c_str()));
+    return ret;
 }
 
-int main()
+// usage: analyze_query --query f [--centroids f] [--nprobe 10,20,30] [--window n]
+//                      [--count-window n] [--epoch n] [--output dir/]
+//                      [--analyses popularity,locality,overlap,trace,stream,mrc,refine]
+//                      [--sq8] [--hnsw path] [--tree path] [--beam b] [--index path] [--metrics f]
+//                      [--topk k] [--refine r] [--refine-gap pages] [--hugepages none|thp|hugetlb]
+//                      [--knn 1|2|3] [--layout dir1,dir2,...] [--schedule ws|omp, default ws] [--numa]
+int main(int argc, char** argv)
 {
-    analy_query_locality();
+    for (int i = 1; i < argc; i++) {
+        string opt = argv[i];
+        bool has_val = i + 1 < argc;
+        if (opt == "--sq8") {
+            use_quantized_centroids = true;
+        } else if (opt == "--numa") {
+            use_numa = true;
+        } else if (opt == "--query" && has_val) {
+            query_file = argv[++i];
+        } else if (opt == "--centroids" && has_val) {
+            centroid_file = argv[++i];
+        } else if (opt == "--nprobe" && has_val) {
+            nprobes = parse_list(argv[++i]);
+        } else if (opt == "--window" && has_val) {
+            window_size = atoll(argv[++i]);
+        } else if (opt == "--count-window" && has_val) {
+            count_window = atoll(argv[++i]);
+        } else if (opt == "--epoch" && has_val) {
+            epoch_size = std::max<int64_t>(1, atoll(argv[++i]));
+        } else if (opt == "--output" && has_val) {
+            output_path = argv[++i];
+        } else if (opt == "--analyses" && has_val) {
+            analyses = argv[++i];
+        } else if (opt == "--hnsw" && has_val) {
+            hnsw_index_path = argv[++i];
+        } else if (opt == "--tree" && has_val) {
+            tree_index_path = argv[++i];
+        } else if (opt == "--beam" && has_val) {
+            tree_beam = atoll(argv[++i]);
+        } else if (opt == "--metrics" && has_val) {
+            metrics_file = argv[++i];
+        } else if (opt == "--index" && has_val) {
+            index_path = argv[++i];
+        } else if (opt == "--topk" && has_val) {
+            topk = atoll(argv[++i]);
+        } else if (opt == "--refine" && has_val) {
+            refine_r = atoll(argv[++i]);
+        } else if (opt == "--refine-gap" && has_val) {
+            refine_gap = atoll(argv[++i]);
+        } else if (opt == "--hugepages" && has_val) {
+            hugepages = get_hugepage_mode_by_name(argv[++i]);
+        } else if (opt == "--schedule" && has_val) {
+            string name = argv[++i];
+            if (name != "ws" && name != "omp") {
+                cerr << "unknown schedule " << name << endl;
+                return 1;
+            }
+            use_work_stealing = name == "ws";
+        } else if (opt == "--layout" && has_val) {
+            layout_dirs = argv[++i];
+        } else if (opt == "--knn" && has_val) {
+            knn_variant = (KnnVariant)std::min(3, std::max(1, atoi(argv[++i])));
+        } else {
+            cerr << "unknown option " << opt << endl;
+            return 1;
+        }
+    }
+    if (query_file.empty()) {
+        cerr << "usage: " << argv[0] << " --query <u8bin file> [--centroids f] [--nprobe 10,20,30] [options]" << endl;
+        return 1;
+    }
+    analyze_queries();
+    if (!metrics_file.empty()) {
+        MetricsRegistry::instance().dump_to_file(metrics_file);
+    }
     return 0;
-}
\ No newline at end of file
+}
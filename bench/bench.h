@@ -0,0 +1,161 @@
+#pragma once
+
+// Minimal google-benchmark style harness shared by the bench targets.
+// A benchmark is a body run for a given number of iterations; the runner
+// doubles the iteration count until one run takes min_time, then reports
+// ns per iteration plus item and byte throughput. The progress logging of
+// the library (std::cout) is muted while a body runs. Data TLB load misses
+// and last level cache misses of the measured run are counted with perf
+// events, for the calling thread and the threads created after the suite,
+// so construct the suite first in main; the columns read n/a when perf
+// events are not permitted.
+//
+// command line of a suite binary:
+//   --filter <substr>   only run benchmarks whose name contains substr
+//   --min-time <s>      minimum measured time per benchmark, default 0.2
+//   --csv <file>        also write the results as CSV
+//   --json <file>       also write the results as JSON
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "util/perf_counter.h"
+
+template <class T>
+inline void do_not_optimize(T const& v) {
+    asm volatile("" : : "r,m"(v) : "memory");
+}
+
+struct BenchResult {
+    std::string name;
+    int64_t iterations;
+    double ns_per_iter;
+    double items_per_s;
+    double bytes_per_s;
+    // -1 when not counted
+    double dtlb_misses_per_iter;
+    double llc_misses_per_iter;
+};
+
+class BenchSuite {
+ public:
+    using Body = std::function<void(int64_t iters)>;
+
+    // items and bytes are per iteration, 0 leaves the column empty
+    void add(const std::string& name, Body body, double items = 0, double bytes = 0) {
+        benches_.push_back({name, std::move(body), items, bytes});
+    }
+
+    int run(int argc, char** argv) {
+        std::string filter, csv_file, json_file;
+        double min_time = 0.2;
+        for (int i = 1; i + 1 < argc; i += 2) {
+            std::string opt = argv[i];
+            if (opt == "--filter") filter = argv[i + 1];
+            else if (opt == "--min-time") min_time = atof(argv[i + 1]);
+            else if (opt == "--csv") csv_file = argv[i + 1];
+            else if (opt == "--json") json_file = argv[i + 1];
+            else {
+                std::cerr << "unknown option " << opt << std::endl;
+                return 1;
+            }
+        }
+
+        std::vector<BenchResult> results;
+        std::cout << std::left << std::setw(48) << "benchmark" << std::right << std::setw(12) << "iters"
+                  << std::setw(14) << "ns/iter" << std::setw(14) << "items/s" << std::setw(14) << "MB/s" << std::setw(14) << "dTLB/iter" << std::setw(14) << "LLC/iter" << std::endl;
+        for (auto& b : benches_) {
+            if (!filter.empty() && b.name.find(filter) == std::string::npos) continue;
+            BenchResult r = measure(b, min_time);
+            results.push_back(r);
+            std::cout << std::left << std::setw(48) << r.name << std::right << std::setw(12) << r.iterations
+                      << std::setw(14) << std::fixed << std::setprecision(1) << r.ns_per_iter
+                      << std::setw(14) << std::scientific << std::setprecision(3) << r.items_per_s
+                      << std::setw(14) << std::fixed << std::setprecision(1) << r.bytes_per_s / (1 << 20)
+                      << std::setw(14) << counted(r.dtlb_misses_per_iter)
+                      << std::setw(14) << counted(r.llc_misses_per_iter) << std::defaultfloat << std::endl;
+        }
+        if (!csv_file.empty()) write_csv(csv_file, results);
+        if (!json_file.empty()) write_json(json_file, results);
+        return 0;
+    }
+
+ private:
+    struct Bench {
+        std::string name;
+        Body body;
+        double items;
+        double bytes;
+    };
+
+    BenchResult measure(Bench& b, double min_time) {
+        int64_t iters = 1;
+        double secs = 0;
+        auto* saved = std::cout.rdbuf(nullptr);
+        b.body(1);  // warm up caches and lazily built state
+        uint64_t dtlb_misses = 0, llc_misses = 0;
+        while (true) {
+            dtlb_.start();
+            llc_.start();
+            auto t0 = std::chrono::steady_clock::now();
+            b.body(iters);
+            secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            dtlb_misses = dtlb_.stop();
+            llc_misses = llc_.stop();
+            if (secs >= min_time || iters >= (1LL << 40)) break;
+            // aim a bit past min_time, at most 10x more per step
+            double scale = secs > 0 ? 1.4 * min_time / secs : 10;
+            iters = std::max(iters + 1, (int64_t)(iters * std::min(10.0, scale)));
+        }
+        std::cout.rdbuf(saved);
+        std::cout.clear();
+        return {b.name, iters, secs * 1e9 / iters,
+                b.items * iters / secs, b.bytes * iters / secs,
+                dtlb_.valid() ? (double)dtlb_misses / iters : -1,
+                llc_.valid() ? (double)llc_misses / iters : -1};
+    }
+
+    static std::string counted(double v) {
+        if (v < 0) return "n/a";
+        std::ostringstream os;
+        os << std::fixed << std::setprecision(1) << v;
+        return os.str();
+    }
+
+    static void write_csv(const std::string& file, const std::vector<BenchResult>& results) {
+        std::ofstream os(file);
+        os << "name,iterations,ns_per_iter,items_per_s,bytes_per_s,dtlb_misses_per_iter,llc_misses_per_iter\n";
+        for (auto& r : results) {
+            os << r.name << "," << r.iterations << "," << r.ns_per_iter << ","
+               << r.items_per_s << "," << r.bytes_per_s << "," << r.dtlb_misses_per_iter
+               << "," << r.llc_misses_per_iter << "\n";
+        }
+        std::cout << "write csv to " << file << std::endl;
+    }
+
+    static void write_json(const std::string& file, const std::vector<BenchResult>& results) {
+        std::ofstream os(file);
+        os << "{\n  \"benchmarks\": [";
+        for (size_t i = 0; i < results.size(); i++) {
+            const auto& r = results[i];
+            os << (i ? ",\n" : "\n") << "    {\"name\": \"" << r.name << "\", \"iterations\": " << r.iterations
+               << ", \"ns_per_iter\": " << r.ns_per_iter << ", \"items_per_s\": " << r.items_per_s
+               << ", \"bytes_per_s\": " << r.bytes_per_s
+               << ", \"dtlb_misses_per_iter\": " << r.dtlb_misses_per_iter
+               << ", \"llc_misses_per_iter\": " << r.llc_misses_per_iter << "}";
+        }
+        os << "\n  ]\n}" << std::endl;
+        std::cout << "write json to " << file << std::endl;
+    }
+
+    std::vector<Bench> benches_;
+    PerfCounter dtlb_ = PerfCounter::dtlb_load_misses();
+    PerfCounter llc_ = PerfCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+};
@@ -0,0 +1,74 @@
+// Recall of nprobe vs. latency of the centroid HNSW graph against the
+// brute-force knn_1 coarse search.
+// usage: bench_hnsw_coarse [ncentroids] [nquery] [nprobe] [M] [ef_construction]
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <unordered_set>
+#include "util/flat.h"
+#include "util/hnsw.h"
+
+using namespace std;
+
+constexpr int DIM = 128;
+
+int main(int argc, char** argv)
+{
+    int64_t ncentroids = argc > 1 ? atoll(argv[1]) : 100000;
+    int64_t nquery = argc > 2 ? atoll(argv[2]) : 1000;
+    int64_t nprobe = argc > 3 ? atoll(argv[3]) : 30;
+    uint32_t M = argc > 4 ? atoi(argv[4]) : 16;
+    uint32_t efc = argc > 5 ? atoi(argv[5]) : 200;
+
+    // centroids around a few blobs so the graph has structure to exploit
+    std::mt19937 gen(1234);
+    std::normal_distribution<float> noise(0, 12);
+    std::uniform_real_distribution<float> center(40, 215);
+    const int nblob = 64;
+    vector<float> blobs(nblob * DIM);
+    for (auto& b : blobs) b = center(gen);
+    vector<float> centroids(ncentroids * DIM);
+    std::uniform_int_distribution<int> pick(0, nblob - 1);
+    for (int64_t i = 0; i < ncentroids; i++) {
+        const float* b = blobs.data() + pick(gen) * DIM;
+        for (int d = 0; d < DIM; d++) centroids[i * DIM + d] = std::min(255.f, std::max(0.f, b[d] + noise(gen)));
+    }
+    vector<uint8_t> query(nquery * DIM);
+    for (int64_t i = 0; i < nquery; i++) {
+        const float* b = blobs.data() + pick(gen) * DIM;
+        for (int d = 0; d < DIM; d++) query[i * DIM + d] = (uint8_t)std::min(255.f, std::max(0.f, b[d] + noise(gen)));
+    }
+
+    vector<float> gt_dis(nquery * nprobe), dis(nquery * nprobe);
+    vector<uint32_t> gt_ids(nquery * nprobe), ids(nquery * nprobe);
+    auto t0 = chrono::steady_clock::now();
+    knn_1<CMax<float, uint32_t>, uint8_t, float>(query.data(), centroids.data(), nquery, ncentroids, DIM, nprobe,
+                                                 gt_dis.data(), gt_ids.data(), L2sqr<const uint8_t, const float, float>);
+    auto t1 = chrono::steady_clock::now();
+    double brute_us = chrono::duration<double, micro>(t1 - t0).count() / nquery;
+
+    CentroidHNSW index(M, efc);
+    index.build(centroids.data(), ncentroids, DIM);
+    auto t2 = chrono::steady_clock::now();
+    index.save(hnsw_index_file("/tmp/"));
+    CentroidHNSW loaded;
+    if (!loaded.load(hnsw_index_file("/tmp/"), centroids.data(), ncentroids, DIM)) return 1;
+
+    cout << "method,ncentroids,nprobe,ef,recall,us_per_query,build_s" << endl;
+    cout << "knn_1," << ncentroids << "," << nprobe << ",-,1," << brute_us << ",0" << endl;
+    for (int64_t ef : {nprobe, 2 * nprobe, 4 * nprobe, 8 * nprobe, 16 * nprobe}) {
+        auto s0 = chrono::steady_clock::now();
+        hnsw_knn<CMax<float, uint32_t>, uint8_t>(query.data(), loaded, nquery, nprobe, ef, dis.data(), ids.data());
+        auto s1 = chrono::steady_clock::now();
+        int64_t hit = 0;
+        for (int64_t i = 0; i < nquery; i++) {
+            unordered_set<uint32_t> gt(gt_ids.begin() + i * nprobe, gt_ids.begin() + (i + 1) * nprobe);
+            for (int64_t j = 0; j < nprobe; j++) hit += gt.count(ids[i * nprobe + j]);
+        }
+        cout << "hnsw," << ncentroids << "," << nprobe << "," << ef << "," << (double)hit / (nquery * nprobe) << ","
+             << chrono::duration<double, micro>(s1 - s0).count() / nquery << ","
+             << chrono::duration<double>(t2 - t1).count() << endl;
+    }
+    return 0;
+}
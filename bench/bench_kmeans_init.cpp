@@ -0,0 +1,70 @@
+// Iterations to convergence and cluster balance of k-means with random,
+// k-means++ and k-means|| seeding. Runs on a reservoir sample of a u8bin
+// file when one is given, on a synthetic Gaussian mixture otherwise.
+// usage: bench_kmeans_init [k] [sample_size] [u8bin_file]
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include "util/kmeans.h"
+
+using namespace std;
+
+int main(int argc, char** argv)
+{
+    int64_t k = argc > 1 ? atoll(argv[1]) : 256;
+    int64_t n = argc > 2 ? atoll(argv[2]) : 100000;
+    int64_t dim = 128;
+
+    vector<uint8_t> sample;
+    if (argc > 3) {
+        uint32_t nb, d;
+        get_bin_metadata(argv[3], nb, d);
+        dim = d;
+        n = std::min<int64_t>(n, nb);
+        sample.resize(n * dim);
+        reservoir_sampling<uint8_t>(argv[3], n, sample.data());
+    } else {
+        std::mt19937 gen(1234);
+        std::uniform_real_distribution<float> center(20, 235);
+        std::normal_distribution<float> noise(0, 10);
+        // uneven blob sizes, which is where random seeding hurts balance
+        int64_t nblob = k * 2;
+        vector<float> blobs(nblob * dim);
+        for (auto& b : blobs) b = center(gen);
+        std::discrete_distribution<int64_t> pick(nblob, 0, nblob, [](double x) { return 1.0 / (1 + x); });
+        sample.resize(n * dim);
+        for (int64_t i = 0; i < n; i++) {
+            const float* b = blobs.data() + pick(gen) * dim;
+            for (int64_t d = 0; d < dim; d++) {
+                sample[i * dim + d] = (uint8_t)std::min(255.f, std::max(0.f, b[d] + noise(gen)));
+            }
+        }
+    }
+
+    cout << "init,k,n,iterations,objective,init_s,iterate_s,total_s,max_cluster,min_cluster,cluster_size_std" << endl;
+    vector<float> centroids(k * dim);
+    vector<uint32_t> assign(n);
+    for (auto init : {KmeansInit::RANDOM, KmeansInit::KMEANS_PP, KmeansInit::KMEANS_PARALLEL}) {
+        auto t0 = chrono::steady_clock::now();
+        kmeans_init<uint8_t>(sample.data(), n, dim, k, centroids.data(), init, 1234);
+        auto t1 = chrono::steady_clock::now();
+        // start from the seeds timed above instead of seeding a second time
+        auto stats = kmeans<uint8_t>(sample.data(), n, dim, k, centroids.data(), assign.data(), 100, 1e-4, 1234,
+                                     KmeansInit::GIVEN);
+        auto t2 = chrono::steady_clock::now();
+
+        vector<int64_t> size(k, 0);
+        for (auto a : assign) size[a]++;
+        double mean = (double)n / k, var = 0;
+        for (auto s : size) var += (s - mean) * (s - mean);
+        const char* name = init == KmeansInit::RANDOM ? "random" : init == KmeansInit::KMEANS_PP ? "kmeans++" : "kmeans||";
+        cout << name << "," << k << "," << n << "," << stats.iterations << "," << stats.objective << ","
+             << chrono::duration<double>(t1 - t0).count() << "," << chrono::duration<double>(t2 - t1).count() << ","
+             << chrono::duration<double>(t2 - t0).count() << ","
+             << *max_element(size.begin(), size.end()) << "," << *min_element(size.begin(), size.end()) << ","
+             << sqrt(var / k) << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+// Compare the plain knn_2 scan, whose base matrix is first touched by the
+// main thread and so lives on one node, with numa_knn, which splits the
+// queries per node and scans a node-local replica on the node's pinned pool.
+// Remote loads (node-load-misses) show the cross-socket traffic removed;
+// they read n/a when perf events are not permitted.
+// usage: bench_numa [nx] [ny] [k] [repeats] [--nodes n]
+//   --nodes n  split the cpus into n nodes, to exercise the path on one socket
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <string>
+#include <omp.h>
+#include "util/numa.h"
+#include "util/perf_counter.h"
+
+using namespace std;
+
+constexpr int DIM = 128;
+
+int main(int argc, char** argv)
+{
+    vector<int64_t> args;
+    int fake_nodes = 0;
+    for (int i = 1; i < argc; i++) {
+        string opt = argv[i];
+        if (opt == "--nodes" && i + 1 < argc) fake_nodes = atoi(argv[++i]);
+        else args.push_back(atoll(argv[i]));
+    }
+    const int64_t nx = args.size() > 0 ? args[0] : 10000;
+    const int64_t ny = args.size() > 1 ? args[1] : 100000;
+    const int64_t k = args.size() > 2 ? args[2] : 10;
+    const int repeats = args.size() > 3 ? args[3] : 3;
+
+    // open before any thread exists, so every thread below is counted
+    auto remote_loads = PerfCounter::hw_cache(PERF_COUNT_HW_CACHE_NODE, PERF_COUNT_HW_CACHE_OP_READ,
+                                              PERF_COUNT_HW_CACHE_RESULT_MISS);
+
+    NumaTopology topo = NumaTopology::instance();
+    if (fake_nodes > 1) {
+        vector<int> cpus;
+        for (int n = 0; n < topo.num_nodes(); n++) {
+            cpus.insert(cpus.end(), topo.node(n).cpus.begin(), topo.node(n).cpus.end());
+        }
+        vector<NumaNode> nodes;
+        for (int n = 0; n < fake_nodes; n++) {
+            vector<int> part(cpus.begin() + cpus.size() * n / fake_nodes,
+                             cpus.begin() + cpus.size() * (n + 1) / fake_nodes);
+            if (!part.empty()) nodes.push_back({n, part, get_L3_Size(part[0])});
+        }
+        topo = NumaTopology(nodes);
+    }
+    topo.print();
+
+    vector<uint8_t> x(nx * DIM);
+    vector<float> y(ny * DIM);
+    std::mt19937 gen(1234);
+    std::uniform_int_distribution<int> byte(0, 255);
+    for (auto& v : x) v = byte(gen);
+    for (auto& v : y) v = byte(gen);
+    vector<float> dis(nx * k);
+    vector<uint32_t> ids(nx * k);
+
+    auto run = [&](const string& name, const function<void()>& body) {
+        body();  // warm up, builds the thread pools
+        remote_loads.start();
+        auto t0 = chrono::steady_clock::now();
+        auto* saved = cout.rdbuf(nullptr);
+        for (int r = 0; r < repeats; r++) body();
+        cout.rdbuf(saved);
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count() / repeats;
+        uint64_t loads = remote_loads.stop();
+        cout << left << setw(12) << name << right << setw(12) << fixed << setprecision(1) << ms << " ms"
+             << setw(16) << setprecision(3) << scientific << nx * ny / ms * 1e3 << " dis/s" << defaultfloat;
+        if (remote_loads.valid()) cout << setw(14) << loads / repeats << " remote loads";
+        else cout << setw(14) << "n/a" << " remote loads";
+        cout << endl;
+    };
+
+    cout << "nx = " << nx << ", ny = " << ny << ", k = " << k << ", " << topo.num_cpus() << " cpus" << endl;
+    run("knn_2", [&] {
+        omp_set_num_threads(topo.num_cpus());
+        knn_2<CMax<float, uint32_t>, uint8_t, float>(x.data(), y.data(), nx, ny, DIM, k, dis.data(), ids.data(),
+                                                    L2sqr<const uint8_t, const float, float>);
+    });
+    vector<uint32_t> plain_ids = ids;
+
+    NumaExecutor executor(topo);
+    NumaReplicated<float> replicas(y.data(), y.size(), executor);
+    run("numa_knn", [&] {
+        numa_knn<CMax<float, uint32_t>, uint8_t, float>(executor, x.data(), replicas, nx, ny, DIM, k,
+                                                       dis.data(), ids.data(),
+                                                       L2sqr<const uint8_t, const float, float>);
+    });
+    if (ids != plain_ids) cout << "numa_knn result differs from knn_2" << endl;
+    return 0;
+}
@@ -0,0 +1,376 @@
+// Micro and macro benchmarks of the search building blocks on synthetic
+// data: L2sqr and IP kernels per type (uint8, int8, float, float16) and
+// dim, the PQ lookup-table builders, heap_swap_top / heap_reorder,
+// knn_1 vs knn_2 vs knn_3 (with and without its 4 x 1 L2 micro-kernel) over
+// (nx, ny, k, threads), knn_1 over a centroid
+// matrix on 4 KB pages vs hugepages, knn_1 vs the tiled knn_3 over a
+// centroid matrix beyond L2, merge, the residual code
+// scans against the raw uint8 scan and the IOReader /
+// IOWriter throughput. See bench.h for the command line, e.g.
+//   bench_suite --filter knn --csv output/bench.csv --json output/bench.json
+#include <vector>
+#include <random>
+#include <string>
+#include <cstdio>
+#include <omp.h>
+#include "bench/bench.h"
+#include "util/distance.h"
+#include "util/heap.h"
+#include "util/flat.h"
+#include "util/quantized_centroids.h"
+#include "util/merge.h"
+#include "util/file_handler.h"
+#include "util/hugepage.h"
+#include "util/residual_codec.h"
+
+using namespace std;
+
+// vectors per distance benchmark iteration, enough to leave L1
+constexpr int64_t DIS_BATCH = 4096;
+
+template<typename T>
+static vector<T> random_data(int64_t n, uint32_t seed) {
+    std::mt19937 gen(seed);
+    vector<T> v(n);
+    std::uniform_int_distribution<int> dist(0, 127);
+    for (auto& x : v) x = (T)dist(gen);
+    return v;
+}
+
+template<typename T1, typename T2, typename R>
+static void add_distance(BenchSuite& suite, const string& type, int64_t dim) {
+    auto x = make_shared<vector<T1>>(random_data<T1>(dim, 1));
+    auto y = make_shared<vector<T2>>(random_data<T2>(DIS_BATCH * dim, 2));
+    suite.add("L2sqr/" + type + "/dim:" + to_string(dim), [=](int64_t iters) {
+        for (int64_t it = 0; it < iters; it++) {
+            const T2* yj = y->data();
+            for (int64_t j = 0; j < DIS_BATCH; j++, yj += dim) {
+                do_not_optimize(L2sqr<const T1, const T2, R>(x->data(), yj, dim));
+            }
+        }
+    }, DIS_BATCH, DIS_BATCH * dim * sizeof(T2));
+}
+
+template<typename T1, typename T2, typename R>
+static void add_ip(BenchSuite& suite, const string& type, int64_t dim) {
+    auto x = make_shared<vector<T1>>(random_data<T1>(dim, 1));
+    auto y = make_shared<vector<T2>>(random_data<T2>(DIS_BATCH * dim, 2));
+    suite.add("IP/" + type + "/dim:" + to_string(dim), [=](int64_t iters) {
+        for (int64_t it = 0; it < iters; it++) {
+            const T2* yj = y->data();
+            for (int64_t j = 0; j < DIS_BATCH; j++, yj += dim) {
+                do_not_optimize(IP<const T1, const T2, R>(x->data(), yj, dim));
+            }
+        }
+    }, DIS_BATCH, DIS_BATCH * dim * sizeof(T2));
+}
+
+// 256 codewords of one sub-space, transposed as the builders expect
+template<typename T>
+static void add_lookuptable(BenchSuite& suite, const string& type, int64_t sub_dim) {
+    const int64_t m = 256;
+    auto q = make_shared<vector<T>>(random_data<T>(sub_dim, 12));
+    auto codebook = make_shared<vector<float>>(random_data<float>(sub_dim * m, 13));
+    suite.add("lookuptable_IP/" + type + "/sub_dim:" + to_string(sub_dim), [=](int64_t iters) {
+        vector<float> table(m);
+        for (int64_t it = 0; it < iters; it++) {
+            compute_lookuptable_IP<const T>(q->data(), codebook->data(), table.data(), sub_dim, m);
+            do_not_optimize(table[0]);
+        }
+    }, m);
+    suite.add("lookuptable_L2/" + type + "/sub_dim:" + to_string(sub_dim), [=](int64_t iters) {
+        vector<float> table(m);
+        for (int64_t it = 0; it < iters; it++) {
+            compute_lookuptable_L2<const T>(q->data(), codebook->data(), table.data(), sub_dim, m);
+            do_not_optimize(table[0]);
+        }
+    }, m);
+}
+
+static void add_heap(BenchSuite& suite, int64_t k) {
+    using C = CMax<float, int64_t>;
+    const int64_t nval = 1 << 16;
+    auto vals = make_shared<vector<float>>(nval);
+    std::mt19937 gen(3);
+    std::uniform_real_distribution<float> dist(0, 1);
+    for (auto& v : *vals) v = dist(gen);
+
+    suite.add("heap_swap_top/k:" + to_string(k), [=](int64_t iters) {
+        vector<float> val(k);
+        vector<int64_t> ids(k);
+        for (int64_t it = 0; it < iters; it++) {
+            heap_heapify<C>(k, val.data(), ids.data());
+            for (int64_t i = 0; i < nval; i++) {
+                heap_swap_top<C>(k, val.data(), ids.data(), (*vals)[i], i);
+            }
+            do_not_optimize(val[0]);
+        }
+    }, nval);
+
+    suite.add("heap_reorder/k:" + to_string(k), [=](int64_t iters) {
+        vector<float> val(k);
+        vector<int64_t> ids(k);
+        for (int64_t it = 0; it < iters; it++) {
+            heap_heapify<C>(k, val.data(), ids.data());
+            for (int64_t i = 0; i < k; i++) {
+                heap_swap_top<C>(k, val.data(), ids.data(), (*vals)[(it * k + i) & (nval - 1)], i);
+            }
+            heap_reorder<C>(k, val.data(), ids.data());
+            do_not_optimize(val[0]);
+        }
+    }, 1);
+}
+
+static void add_knn(BenchSuite& suite, int64_t nx, int64_t ny, int64_t k, int threads) {
+    const int64_t dim = 128;
+    auto x = make_shared<vector<uint8_t>>(random_data<uint8_t>(nx * dim, 4));
+    auto y = make_shared<vector<float>>(random_data<float>(ny * dim, 5));
+    auto dis = make_shared<vector<float>>(nx * k);
+    auto ids = make_shared<vector<uint32_t>>(nx * k);
+    string shape = "/nx:" + to_string(nx) + "/ny:" + to_string(ny) + "/k:" + to_string(k) +
+                   "/threads:" + to_string(threads);
+
+    suite.add("knn_1" + shape, [=](int64_t iters) {
+        omp_set_num_threads(threads);
+        for (int64_t it = 0; it < iters; it++) {
+            knn_1<CMax<float, uint32_t>, uint8_t, float>(
+                x->data(), y->data(), nx, ny, dim, k, dis->data(), ids->data(),
+                L2sqr<const uint8_t, const float, float>);
+        }
+    }, nx * ny);
+    suite.add("knn_2" + shape, [=](int64_t iters) {
+        omp_set_num_threads(threads);
+        for (int64_t it = 0; it < iters; it++) {
+            knn_2<CMax<float, uint32_t>, uint8_t, float>(
+                x->data(), y->data(), nx, ny, dim, k, dis->data(), ids->data(),
+                L2sqr<const uint8_t, const float, float>);
+        }
+    }, nx * ny);
+    suite.add("knn_3" + shape, [=](int64_t iters) {
+        omp_set_num_threads(threads);
+        for (int64_t it = 0; it < iters; it++) {
+            knn_3<CMax<float, uint32_t>, uint8_t, float>(
+                x->data(), y->data(), nx, ny, dim, k, dis->data(), ids->data(),
+                L2sqr<const uint8_t, const float, float>);
+        }
+    }, nx * ny);
+    // the same tiles with one computer call per pair, a wrapped L2sqr is not blocked
+    suite.add("knn_3_unblocked" + shape, [=](int64_t iters) {
+        omp_set_num_threads(threads);
+        for (int64_t it = 0; it < iters; it++) {
+            knn_3<CMax<float, uint32_t>, uint8_t, float>(
+                x->data(), y->data(), nx, ny, dim, k, dis->data(), ids->data(),
+                [](const uint8_t* a, const float* b, int n) { return L2sqr<const uint8_t, const float, float>(a, b, n); });
+        }
+    }, nx * ny);
+}
+
+// knn_1 streams the centroid matrix once per query, knn_3 once per query
+// tile; the MB/s of these rows is that modeled traffic, not a measurement,
+// hence the modeled_traffic name, the LLC column is the measured one
+static void add_knn_tiled(BenchSuite& suite, int64_t nx, int64_t ny, int64_t k) {
+    const int64_t dim = 128;
+    auto x = make_shared<vector<uint8_t>>(random_data<uint8_t>(nx * dim, 10));
+    auto y = make_shared<vector<float>>(random_data<float>(ny * dim, 11));
+    auto dis = make_shared<vector<float>>(nx * k);
+    auto ids = make_shared<vector<uint32_t>>(nx * k);
+    const int64_t matrix_bytes = ny * dim * sizeof(float);
+    const KnnTiling tiling = knn_tiling(nx, ny, dim, dim * sizeof(float),
+                                        k * (sizeof(float) + sizeof(uint32_t)), omp_get_max_threads());
+    const int64_t tiles = (nx + tiling.query_tile - 1) / tiling.query_tile;
+    string shape = "/nx:" + to_string(nx) + "/ny:" + to_string(ny) + "/k:" + to_string(k);
+
+    suite.add("centroid_scan/modeled_traffic/knn_1" + shape, [=](int64_t iters) {
+        for (int64_t it = 0; it < iters; it++) {
+            knn_1<CMax<float, uint32_t>, uint8_t, float>(
+                x->data(), y->data(), nx, ny, dim, k, dis->data(), ids->data(),
+                L2sqr<const uint8_t, const float, float>);
+        }
+    }, nx, nx * matrix_bytes);
+    suite.add("centroid_scan/modeled_traffic/knn_3" + shape, [=](int64_t iters) {
+        for (int64_t it = 0; it < iters; it++) {
+            knn_3<CMax<float, uint32_t>, uint8_t, float>(
+                x->data(), y->data(), nx, ny, dim, k, dis->data(), ids->data(),
+                L2sqr<const uint8_t, const float, float>);
+        }
+    }, nx, tiles * matrix_bytes);
+}
+
+// the --sq8 coarse search: integer u8 x u8 scan of the quantized centroids
+// plus a float re-rank of 2k candidates, against the float scan of knn_1
+static void add_knn_quantized(BenchSuite& suite, int64_t nx, int64_t ny, int64_t k) {
+    const int64_t dim = 128;
+    auto x = make_shared<vector<uint8_t>>(random_data<uint8_t>(nx * dim, 12));
+    auto y = make_shared<vector<float>>(random_data<float>(ny * dim, 13));
+    auto dis = make_shared<vector<float>>(nx * k);
+    auto ids = make_shared<vector<uint32_t>>(nx * k);
+    auto qc = make_shared<QuantizedCentroids<uint8_t>>();
+    qc->train(y->data(), ny, dim, 0, 255);
+    string shape = "/nx:" + to_string(nx) + "/ny:" + to_string(ny) + "/k:" + to_string(k);
+
+    suite.add("coarse/knn_1" + shape, [=](int64_t iters) {
+        for (int64_t it = 0; it < iters; it++) {
+            knn_1<CMax<float, uint32_t>, uint8_t, float>(
+                x->data(), y->data(), nx, ny, dim, k, dis->data(), ids->data(),
+                L2sqr<const uint8_t, const float, float>);
+        }
+    }, nx * ny, nx * ny * dim * sizeof(float));
+    suite.add("coarse/knn_1_quantized" + shape, [=](int64_t iters) {
+        for (int64_t it = 0; it < iters; it++) {
+            knn_1_quantized<CMax<float, uint32_t>, uint8_t, uint8_t>(
+                x->data(), *qc, y->data(), nx, k, dis->data(), ids->data());
+        }
+    }, nx * ny, nx * ny * dim * sizeof(uint8_t));
+}
+
+// every query scans all ny centroids, the matrix far exceeds what the dTLB
+// covers with 4 KB pages; compare its ns and dTLB misses per backing
+static void add_knn_hugepage(BenchSuite& suite, int64_t nx, int64_t ny, int64_t k) {
+    const int64_t dim = 128;
+    auto x = make_shared<vector<uint8_t>>(random_data<uint8_t>(nx * dim, 8));
+    auto y_data = random_data<float>(ny * dim, 9);
+    for (auto mode : {HugePageMode::None, HugePageMode::THP, HugePageMode::HUGETLB}) {
+        auto y = make_shared<HugeArray<float>>(ny * dim, mode);
+        std::copy(y_data.begin(), y_data.end(), y->data());
+        auto dis = make_shared<vector<float>>(nx * k);
+        auto ids = make_shared<vector<uint32_t>>(nx * k);
+        // a hugetlb request without reserved pages ends up on thp
+        string name = "knn_1/pages:" + string(hugepage_mode_name(mode)) + "/got:" + hugepage_mode_name(y->backing()) +
+                      "/nx:" + to_string(nx) + "/ny:" + to_string(ny);
+        suite.add(name, [=](int64_t iters) {
+            for (int64_t it = 0; it < iters; it++) {
+                knn_1<CMax<float, uint32_t>, uint8_t, float>(
+                    x->data(), y->data(), nx, ny, dim, k, dis->data(), ids->data(),
+                    L2sqr<const uint8_t, const float, float>);
+            }
+        }, nx * ny, ny * dim * sizeof(float));
+    }
+}
+
+static void add_merge(BenchSuite& suite, int64_t nq, int64_t topk) {
+    using C = CMax<float, int64_t>;
+    // both inputs sorted ascending, as knn leaves them
+    auto sorted = [&](uint32_t seed) {
+        auto v = make_shared<vector<float>>(nq * topk);
+        std::mt19937 gen(seed);
+        std::uniform_real_distribution<float> dist(0, 1);
+        for (auto& d : *v) d = dist(gen);
+        for (int64_t q = 0; q < nq; q++) sort(v->begin() + q * topk, v->begin() + (q + 1) * topk);
+        return v;
+    };
+    auto d1 = sorted(6), d2 = sorted(7);
+    auto i1 = make_shared<vector<int64_t>>(nq * topk, 0), i2 = make_shared<vector<int64_t>>(nq * topk, 0);
+    suite.add("merge/nq:" + to_string(nq) + "/topk:" + to_string(topk), [=](int64_t iters) {
+        vector<float> work_d(nq * topk);
+        vector<int64_t> work_i(nq * topk);
+        for (int64_t it = 0; it < iters; it++) {
+            work_d = *d1;
+            work_i = *i1;
+            merge<C>(work_d.data(), work_i.data(), d2->data(), i2->data(), nq, topk, 0);
+        }
+    }, nq);
+}
+
+// one uint8 cluster scanned raw and from its residual codes
+static void add_residual_scan(BenchSuite& suite, int64_t dim) {
+    const int64_t n = DIS_BATCH;
+    auto data = make_shared<vector<uint8_t>>(random_data<uint8_t>(n * dim, 8));
+    auto query = make_shared<vector<uint8_t>>(random_data<uint8_t>(dim, 9));
+    auto centroid = make_shared<vector<float>>(dim, 63.5f);
+    auto ids = make_shared<vector<uint32_t>>(n);
+    for (int64_t i = 0; i < n; i++) (*ids)[i] = i;
+    using C = CMax<float, uint32_t>;
+    const int64_t k = 10;
+
+    suite.add("scan/raw_u8/dim:" + to_string(dim), [=](int64_t iters) {
+        vector<float> dis(k);
+        vector<uint32_t> lab(k);
+        vector<float> q(query->begin(), query->end());
+        for (int64_t it = 0; it < iters; it++) {
+            heap_heapify<C>(k, dis.data(), lab.data());
+            for (int64_t i = 0; i < n; i++) {
+                float d = L2sqr<const uint8_t, const float, float>(data->data() + i * dim, q.data(), dim);
+                if (C::cmp(dis[0], d)) heap_swap_top<C>(k, dis.data(), lab.data(), d, i);
+            }
+            do_not_optimize(dis[0]);
+        }
+    }, n, n * dim);
+
+    for (auto codec : {ResidualCodec::INT8, ResidualCodec::SQ4}) {
+        auto rc = make_shared<ResidualCluster>();
+        encode_residual<uint8_t>(data->data(), n, dim, centroid->data(), codec, *rc);
+        string name = codec == ResidualCodec::INT8 ? "int8" : "sq4";
+        suite.add("scan/residual_" + name + "/dim:" + to_string(dim), [=](int64_t iters) {
+            vector<float> dis(k);
+            vector<uint32_t> lab(k);
+            for (int64_t it = 0; it < iters; it++) {
+                heap_heapify<C>(k, dis.data(), lab.data());
+                residual_scan<C, uint8_t>(query->data(), centroid->data(), *rc, ids->data(), k, dis.data(), lab.data());
+                do_not_optimize(dis[0]);
+            }
+        }, n, rc->codes.size());
+    }
+}
+
+static void add_io(BenchSuite& suite, const string& file, uint64_t file_bytes, uint64_t chunk) {
+    auto buf = make_shared<vector<char>>(chunk, 1);
+    suite.add("IOWriter/chunk:" + to_string(chunk), [=](int64_t iters) {
+        for (int64_t it = 0; it < iters; it++) {
+            IOWriter writer(file, 64 * MEGABYTE);
+            for (uint64_t off = 0; off < file_bytes; off += chunk) writer.write(buf->data(), chunk);
+        }
+    }, 0, file_bytes);
+    suite.add("IOReader/chunk:" + to_string(chunk), [=](int64_t iters) {
+        for (int64_t it = 0; it < iters; it++) {
+            IOReader reader(file, 64 * MEGABYTE);
+            for (uint64_t off = 0; off + chunk <= file_bytes; off += chunk) reader.read(buf->data(), chunk);
+        }
+    }, 0, file_bytes);
+}
+
+int main(int argc, char** argv)
+{
+    BenchSuite suite;
+    for (int64_t dim : {64, 128, 200}) {
+        add_distance<uint8_t, uint8_t, uint32_t>(suite, "u8_u8", dim);
+        add_distance<int8_t, int8_t, int>(suite, "i8_i8", dim);
+        add_distance<uint8_t, float, float>(suite, "u8_f32", dim);
+        add_distance<int8_t, float, float>(suite, "i8_f32", dim);
+        add_distance<float, float, float>(suite, "f32_f32", dim);
+        add_distance<float16, float16, float>(suite, "f16_f16", dim);
+        add_distance<float, float16, float>(suite, "f32_f16", dim);
+        add_ip<uint8_t, uint8_t, uint32_t>(suite, "u8_u8", dim);
+        add_ip<int8_t, int8_t, int>(suite, "i8_i8", dim);
+        add_ip<uint8_t, float, float>(suite, "u8_f32", dim);
+        add_ip<float, float, float>(suite, "f32_f32", dim);
+        add_ip<float16, float16, float>(suite, "f16_f16", dim);
+        add_ip<float, float16, float>(suite, "f32_f16", dim);
+    }
+    for (int64_t sub_dim : {8, 16}) {
+        add_lookuptable<uint8_t>(suite, "u8", sub_dim);
+        add_lookuptable<float>(suite, "f32", sub_dim);
+        add_lookuptable<float16>(suite, "f16", sub_dim);
+    }
+    for (int64_t k : {10, 100}) add_heap(suite, k);
+
+    const int max_threads = omp_get_max_threads();
+    for (int threads : {1, max_threads}) {
+        for (int64_t k : {10, 100}) {
+            add_knn(suite, 100, 10000, k, threads);
+            add_knn(suite, 10000, 100, k, threads);
+        }
+        if (max_threads == 1) break;
+    }
+    add_knn_hugepage(suite, 16, 100000, 10);
+    add_knn_tiled(suite, 64, 100000, 10);
+    add_knn_quantized(suite, 1000, 10000, 64);
+    for (int64_t topk : {10, 100}) add_merge(suite, 10000, topk);
+    for (int64_t dim : {128, 200}) add_residual_scan(suite, dim);
+
+    const string io_file = "output/bench_io.tmp";
+    for (uint64_t chunk : {4 * KILOBYTE, MEGABYTE}) add_io(suite, io_file, 256 * MEGABYTE, chunk);
+
+    int ret = suite.run(argc, argv);
+    remove(io_file.c_str());
+    return ret;
+}
@@ -0,0 +1,98 @@
+// Compare batch completion time of the static OpenMP schedule and the
+// work-stealing pool on a cluster-scan workload with skewed cluster sizes.
+// usage: bench_ws_schedule [centroids_count.txt] [nbatch] [batch_size] [nprobe]
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <omp.h>
+#include "util/distance.h"
+#include "util/heap.h"
+#include "util/work_stealing.h"
+
+using namespace std;
+
+constexpr int DIM = 128;
+constexpr int TOPK = 10;
+
+static double percentile(vector<double> v, double p) {
+    sort(v.begin(), v.end());
+    size_t idx = std::min(v.size() - 1, (size_t)(p * (v.size() - 1) + 0.5));
+    return v[idx];
+}
+
+int main(int argc, char** argv)
+{
+    const char* count_file = argc > 1 ? argv[1] : "output/centroids_count.txt";
+    int nbatch = argc > 2 ? atoi(argv[2]) : 50;
+    int batch_size = argc > 3 ? atoi(argv[3]) : 64;
+    int nprobe = argc > 4 ? atoi(argv[4]) : 30;
+
+    // cluster sizes: taken from the popularity file when present, skewed 2000-4400 otherwise
+    vector<int> cluster_size;
+    ifstream in(count_file);
+    for (int c; in >> c;) cluster_size.push_back(std::max(c, 1));
+    std::mt19937 gen(1234);
+    if (cluster_size.empty()) {
+        std::uniform_int_distribution<int> dist(2000, 4400);
+        for (int i = 0; i < 90; i++) cluster_size.push_back(dist(gen));
+    }
+    int ncluster = cluster_size.size();
+    int max_size = *max_element(cluster_size.begin(), cluster_size.end());
+
+    // one shared block of base vectors, every cluster scans a prefix of it
+    vector<uint8_t> base((size_t)max_size * DIM);
+    vector<uint8_t> query((size_t)batch_size * DIM);
+    std::uniform_int_distribution<int> byte(0, 255);
+    for (auto& b : base) b = byte(gen);
+    for (auto& q : query) q = byte(gen);
+
+    std::uniform_int_distribution<int> pick(0, ncluster - 1);
+    vector<int> probes((size_t)batch_size * nprobe);
+    vector<uint32_t> dis((size_t)batch_size * TOPK);
+    vector<int64_t> ids((size_t)batch_size * TOPK);
+
+    auto scan_query = [&](int64_t q) {
+        uint32_t* val = dis.data() + q * TOPK;
+        int64_t* lab = ids.data() + q * TOPK;
+        heap_heapify<CMax<uint32_t, int64_t>>(TOPK, val, lab);
+        const uint8_t* xq = query.data() + q * DIM;
+        for (int p = 0; p < nprobe; p++) {
+            int cid = probes[q * nprobe + p];
+            const uint8_t* y = base.data();
+            for (int j = 0; j < cluster_size[cid]; j++, y += DIM) {
+                uint32_t d = L2sqr<const uint8_t, const uint8_t, uint32_t>(xq, y, DIM);
+                if (d < val[0]) {
+                    heap_swap_top<CMax<uint32_t, int64_t>>(TOPK, val, lab, d, ((int64_t)cid << 32) | j);
+                }
+            }
+        }
+    };
+
+    WorkStealingPool pool(omp_get_max_threads());
+    vector<double> omp_ms, ws_ms;
+    for (int b = 0; b < nbatch; b++) {
+        for (auto& p : probes) p = pick(gen);
+
+        auto t0 = chrono::steady_clock::now();
+#pragma omp parallel for schedule(static)
+        for (int64_t q = 0; q < batch_size; q++) {
+            scan_query(q);
+        }
+        auto t1 = chrono::steady_clock::now();
+        pool.parallel_for(batch_size, [&](int64_t q, int) { scan_query(q); });
+        auto t2 = chrono::steady_clock::now();
+
+        omp_ms.push_back(chrono::duration<double, milli>(t1 - t0).count());
+        ws_ms.push_back(chrono::duration<double, milli>(t2 - t1).count());
+    }
+
+    cout << "schedule,threads,batches,batch_size,nprobe,p50_ms,p99_ms" << endl;
+    cout << "omp_static," << omp_get_max_threads() << "," << nbatch << "," << batch_size << "," << nprobe
+         << "," << percentile(omp_ms, 0.5) << "," << percentile(omp_ms, 0.99) << endl;
+    cout << "work_stealing," << pool.num_threads() << "," << nbatch << "," << batch_size << "," << nprobe
+         << "," << percentile(ws_ms, 0.5) << "," << percentile(ws_ms, 0.99) << endl;
+    return 0;
+}
@@ -0,0 +1,54 @@
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include "util/file_handler.h"
+#include "util/centroid_tree.h"
+using namespace std;
+
+// write the multi-level centroid tree read by analyze_query --tree
+// usage: build_tree <index_path> <centroid_file> [--fanout f] [--dim d] [--niter n]
+//   centroid_file  float leaf centroids, one per cluster in cluster order; the
+//                  count is taken from the file size when the header is off
+//   --fanout f     children per node, default 32
+int main(int argc, char** argv)
+{
+    if (argc < 3) {
+        cerr << "usage: " << argv[0] << " <index_path> <centroid_file> [--fanout f] [--dim d] [--niter n]" << endl;
+        return 1;
+    }
+    string index_path = argv[1];
+    int64_t fanout = 32;
+    uint32_t dim = 128;
+    int niter = 10;
+    for (int i = 3; i < argc; i++) {
+        string opt = argv[i];
+        if (opt == "--fanout" && i + 1 < argc) fanout = atoll(argv[++i]);
+        else if (opt == "--dim" && i + 1 < argc) dim = atoi(argv[++i]);
+        else if (opt == "--niter" && i + 1 < argc) niter = atoi(argv[++i]);
+        else {
+            cerr << "unknown option " << opt << endl;
+            return 1;
+        }
+    }
+    if (fanout < 2) {
+        cerr << "fanout must be at least 2" << endl;
+        return 1;
+    }
+
+    IOReader reader(argv[2]);
+    uint64_t fsize = reader.get_file_size();
+    uint32_t K, cdim;
+    reader.read((char*)&K, sizeof(uint32_t));
+    reader.read((char*)&cdim, sizeof(uint32_t));
+    if (2 * sizeof(uint32_t) + (uint64_t)K * cdim * sizeof(float) != fsize) {
+        cdim = dim;
+        K = (fsize - 2 * sizeof(uint32_t)) / (cdim * sizeof(float));
+        cout << "header of " << argv[2] << " does not match its size, use n = " << K << ", dim = " << cdim << endl;
+    }
+    vector<float> centroids((uint64_t)K * cdim);
+    reader.read((char*)centroids.data(), centroids.size() * sizeof(float));
+
+    mkdir(index_path.c_str(), 0755);
+    build_centroid_tree(index_path, centroids.data(), K, cdim, fanout, niter);
+    return 0;
+}
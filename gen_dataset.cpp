@@ -0,0 +1,60 @@
+#include <iostream>
+#include <string>
+#include "util/dataset_gen.h"
+using namespace std;
+
+// usage: gen_dataset <base_file> <query_file> <gt_file> [--type uint8|int8|float|float16]
+//                    [--n n] [--nq n] [--dim d] [--clusters c] [--sigma s]
+//                    [--zipf s] [--k k] [--seed s]
+template<typename T>
+void gen_dataset(const string& base_file, const string& query_file, const string& gt_file,
+                 const DatasetConfig& cfg, int64_t nq, int64_t k)
+{
+    GaussianMixture mixture;
+    mixture.init<T>(cfg);
+    generate_bin_file<T>(base_file, mixture, cfg, cfg.n, 1, false);
+    generate_bin_file<T>(query_file, mixture, cfg, nq, 2, true);
+    if (k > 0) generate_ground_truth<T>(base_file, query_file, gt_file, k);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 4) {
+        cerr << "usage: " << argv[0] << " <base_file> <query_file> <gt_file> [--type uint8|int8|float|float16]"
+             << " [--n n] [--nq n] [--dim d] [--clusters c] [--sigma s] [--zipf s] [--k k] [--seed s]" << endl;
+        return 1;
+    }
+    DatasetConfig cfg;
+    string type = "uint8";
+    int64_t nq = 10000, k = 100;
+    for (int i = 4; i + 1 < argc; i += 2) {
+        string opt = argv[i], val = argv[i + 1];
+        if (opt == "--type") type = val;
+        else if (opt == "--n") cfg.n = atoll(val.c_str());
+        else if (opt == "--nq") nq = atoll(val.c_str());
+        else if (opt == "--dim") cfg.dim = atoll(val.c_str());
+        else if (opt == "--clusters") cfg.nclusters = atoll(val.c_str());
+        else if (opt == "--sigma") cfg.sigma = atof(val.c_str());
+        else if (opt == "--zipf") cfg.zipf = atof(val.c_str());
+        else if (opt == "--k") k = atoll(val.c_str());
+        else if (opt == "--seed") cfg.seed = strtoull(val.c_str(), nullptr, 10);
+        else {
+            cerr << "unknown option " << opt << endl;
+            return 1;
+        }
+    }
+
+    if (type == "uint8") {
+        gen_dataset<uint8_t>(argv[1], argv[2], argv[3], cfg, nq, k);
+    } else if (type == "int8") {
+        gen_dataset<int8_t>(argv[1], argv[2], argv[3], cfg, nq, k);
+    } else if (type == "float") {
+        gen_dataset<float>(argv[1], argv[2], argv[3], cfg, nq, k);
+    } else if (type == "float16") {
+        gen_dataset<float16>(argv[1], argv[2], argv[3], cfg, nq, k);
+    } else {
+        cerr << "unknown data type " << type << endl;
+        return 1;
+    }
+    return 0;
+}
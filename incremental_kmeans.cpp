@@ -0,0 +1,32 @@
+#include <iostream>
+#include <string>
+#include "util/incremental_kmeans.h"
+using namespace std;
+
+// usage: incremental_kmeans <index_path> <centroid_file> <new_data_file> <base_id> [uint8|int8|float] [batch_size]
+int main(int argc, char** argv)
+{
+    if (argc < 5) {
+        cerr << "usage: " << argv[0]
+             << " <index_path> <centroid_file> <new_data_file> <base_id> [uint8|int8|float] [batch_size]" << endl;
+        return 1;
+    }
+    string index_path = argv[1];
+    string centroid_file = argv[2];
+    string data_file = argv[3];
+    uint32_t base_id = strtoul(argv[4], nullptr, 10);
+    string data_type = argc > 5 ? argv[5] : "uint8";
+    int32_t batch_size = argc > 6 ? atoi(argv[6]) : 100000;
+
+    if (data_type == "uint8") {
+        incremental_kmeans<uint8_t>(index_path, centroid_file, data_file, base_id, batch_size);
+    } else if (data_type == "int8") {
+        incremental_kmeans<int8_t>(index_path, centroid_file, data_file, base_id, batch_size);
+    } else if (data_type == "float") {
+        incremental_kmeans<float>(index_path, centroid_file, data_file, base_id, batch_size);
+    } else {
+        cerr << "unknown data type " << data_type << endl;
+        return 1;
+    }
+    return 0;
+}
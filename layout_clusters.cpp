@@ -0,0 +1,59 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "util/multi_device.h"
+using namespace std;
+
+// stripe and replicate the clusters of an index over several SSDs
+// usage: layout_clusters <index_path> <centroids_count.txt> <dir1,dir2,...>
+//                        [--budget f] [--replicas r] [--dim d] [--dry-run]
+//   dirs end with '/', the layout is written to index_path + GLOBAL + LAYOUT + BIN
+int main(int argc, char** argv)
+{
+    if (argc < 4) {
+        cerr << "usage: " << argv[0] << " <index_path> <centroids_count.txt> <dir1,dir2,...>"
+             << " [--budget f] [--replicas r] [--dim d] [--dry-run]" << endl;
+        return 1;
+    }
+    string index_path = argv[1];
+    vector<string> dirs;
+    stringstream ss(argv[3]);
+    for (string dir; getline(ss, dir, ',');) dirs.push_back(dir);
+    double budget = 0.25;
+    int replicas = 2;
+    int64_t dim = 128;
+    bool dry_run = false;
+    for (int i = 4; i < argc; i++) {
+        string opt = argv[i];
+        if (opt == "--dry-run") dry_run = true;
+        else if (opt == "--budget" && i + 1 < argc) budget = atof(argv[++i]);
+        else if (opt == "--replicas" && i + 1 < argc) replicas = atoi(argv[++i]);
+        else if (opt == "--dim" && i + 1 < argc) dim = atoll(argv[++i]);
+        else {
+            cerr << "unknown option " << opt << endl;
+            return 1;
+        }
+    }
+
+    vector<uint64_t> popularity;
+    ifstream in(argv[2]);
+    for (uint64_t c; in >> c;) popularity.push_back(c);
+    const uint32_t K = popularity.size();
+
+    // cluster sizes from the raw data headers, 1 when the index is not there
+    vector<uint64_t> bytes(K, 1);
+    for (uint32_t c = 0; c < K; c++) {
+        ifstream reader(index_path + CLUSTER + to_string(c) + RAWDATA + BIN, ios::binary);
+        uint32_t n = 0;
+        if (reader.read((char*)&n, sizeof(uint32_t))) bytes[c] = (uint64_t)n * dim * sizeof(uint8_t);
+    }
+
+    DeviceLayout layout(dirs);
+    layout.plan(popularity, bytes, budget, replicas);
+    layout.print();
+    if (!dry_run) {
+        if (!layout.apply(index_path)) return 1;
+        layout.save(index_path + GLOBAL + LAYOUT + BIN);
+    }
+    return 0;
+}
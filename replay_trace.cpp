@@ -0,0 +1,46 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include "util/trace_replay.h"
+using namespace std;
+
+// usage: replay_trace <trace_file> [--cache-mb n] [--iops n] [--latency-us n]
+//                     [--qd n] [--bandwidth-mbps n] [--qps n] [--block-bytes n]
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        cerr << "usage: " << argv[0] << " <trace_file> [--cache-mb n] [--iops n] [--latency-us n]"
+             << " [--qd n] [--bandwidth-mbps n] [--qps n] [--block-bytes n]" << endl;
+        return 1;
+    }
+    ReplayConfig config;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        string opt = argv[i];
+        double v = atof(argv[i + 1]);
+        if (opt == "--cache-mb") {
+            config.cache_bytes = (uint64_t)(v * MEGABYTE);
+        } else if (opt == "--iops") {
+            config.device.iops = v;
+        } else if (opt == "--latency-us") {
+            config.device.latency_us = v;
+        } else if (opt == "--qd") {
+            config.device.queue_depth = max(1, (int)v);
+        } else if (opt == "--bandwidth-mbps") {
+            config.device.bandwidth_mbps = v;
+        } else if (opt == "--qps") {
+            config.qps = v;
+        } else if (opt == "--block-bytes") {
+            config.block_bytes = (uint32_t)v;
+        } else {
+            cerr << "unknown option " << opt << endl;
+            return 1;
+        }
+    }
+
+    vector<IOTraceRecord> records;
+    if (!read_io_trace(argv[1], records)) return 1;
+    ReplayStats stats;
+    replay_trace(records, config, stats);
+    stats.print();
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include <iostream>
+#include <string>
+#include "util/file_handler.h"
+#include "util/residual_codec.h"
+using namespace std;
+
+// encode the raw clusters of an index as quantized residuals
+// usage: residual_encode <index_path> <centroid_file> [--codec int8|sq4] [--dim d] [--float]
+//   centroid_file  float centroids, one per cluster in cluster order; the
+//                  count is taken from the file size when the header is off
+//   --float        the raw clusters hold float vectors, uint8 otherwise
+int main(int argc, char** argv)
+{
+    if (argc < 3) {
+        cerr << "usage: " << argv[0] << " <index_path> <centroid_file> [--codec int8|sq4] [--dim d] [--float]" << endl;
+        return 1;
+    }
+    string index_path = argv[1];
+    ResidualCodec codec = ResidualCodec::SQ4;
+    uint32_t dim = 128;
+    bool is_float = false;
+    for (int i = 3; i < argc; i++) {
+        string opt = argv[i];
+        if (opt == "--float") is_float = true;
+        else if (opt == "--dim" && i + 1 < argc) dim = atoi(argv[++i]);
+        else if (opt == "--codec" && i + 1 < argc) {
+            string name = argv[++i];
+            if (name == "int8") codec = ResidualCodec::INT8;
+            else if (name == "sq4") codec = ResidualCodec::SQ4;
+            else {
+                cerr << "unknown codec " << name << endl;
+                return 1;
+            }
+        } else {
+            cerr << "unknown option " << opt << endl;
+            return 1;
+        }
+    }
+
+    IOReader reader(argv[2]);
+    uint64_t fsize = reader.get_file_size();
+    uint32_t K, cdim;
+    reader.read((char*)&K, sizeof(uint32_t));
+    reader.read((char*)&cdim, sizeof(uint32_t));
+    if (2 * sizeof(uint32_t) + (uint64_t)K * cdim * sizeof(float) != fsize) {
+        cdim = dim;
+        K = (fsize - 2 * sizeof(uint32_t)) / (cdim * sizeof(float));
+        cout << "header of " << argv[2] << " does not match its size, use n = " << K << ", dim = " << cdim << endl;
+    }
+    vector<float> centroids((uint64_t)K * cdim);
+    reader.read((char*)centroids.data(), centroids.size() * sizeof(float));
+
+    auto bytes = is_float ? encode_index_residual<float>(index_path, centroids.data(), K, cdim, codec)
+                          : encode_index_residual<uint8_t>(index_path, centroids.data(), K, cdim, codec);
+    if (bytes.second > 0) cout << "compression ratio " << (double)bytes.first / bytes.second << endl;
+    return 0;
+}
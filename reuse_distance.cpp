@@ -0,0 +1,48 @@
+#include <iostream>
+#include <string>
+#include "util/utils.h"
+#include "util/reuse_distance.h"
+using namespace std;
+
+// miss-ratio curve of the cluster cache over a coarse search result
+// usage: reuse_distance <coarse_ids.bin> <output_file> [--nprobe p] [--index path] [--dim d]
+//   coarse_ids.bin  (nq, nprobe) uint32 centroid ids, as written by analyze_query
+//   --index         cluster sizes come from the metas under this path, the
+//                   cache is counted in clusters without it
+int main(int argc, char** argv)
+{
+    if (argc < 3) {
+        cerr << "usage: " << argv[0] << " <coarse_ids.bin> <output_file> [--nprobe p] [--index path] [--dim d]" << endl;
+        return 1;
+    }
+    int64_t nprobe = 0, dim = 128;
+    string index_path;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        string opt = argv[i];
+        if (opt == "--nprobe") nprobe = atoll(argv[i + 1]);
+        else if (opt == "--index") index_path = argv[i + 1];
+        else if (opt == "--dim") dim = atoll(argv[i + 1]);
+        else {
+            cerr << "unknown option " << opt << endl;
+            return 1;
+        }
+    }
+
+    uint32_t nq, stride;
+    uint32_t* idx = nullptr;
+    read_bin_file<uint32_t>(argv[1], idx, nq, stride);
+    std::unique_ptr<uint32_t[]> idx_guard(idx);
+    if (nprobe <= 0 || nprobe > stride) nprobe = stride;
+    uint32_t number_centroids = *max_element(idx, idx + (uint64_t)nq * stride) + 1;
+
+    vector<vector<uint32_t>> metas;
+    if (!index_path.empty()) {
+        metas.resize(number_centroids);
+        load_meta_impl(index_path, metas, number_centroids);
+    }
+    ReuseDistanceAnalyzer analyzer(cluster_weights(metas, number_centroids, dim * sizeof(uint8_t)));
+    analyzer.access_probes(idx, nq, stride, nprobe);
+    analyzer.print();
+    analyzer.write(argv[2]);
+    return 0;
+}
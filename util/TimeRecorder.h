@@ -1,12 +1,141 @@
 #pragma once
+#include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <x86intrin.h>
+
+// Lock-free accumulation of named timing sections. Every section name owns
+// a slot of a fixed open-addressing table, claimed once with a CAS; after
+// that a record is two relaxed atomic adds, so hot loops can be timed
+// without locks or per-call printing. dump() prints the totals.
+class TimeAggregate {
+ public:
+    static constexpr int SLOTS = 1024;
+    static constexpr int NAME_LEN = 96;
+
+    static TimeAggregate& global() {
+        static TimeAggregate agg;
+        return agg;
+    }
+
+    void record(const char* name, uint64_t ticks) {
+        Slot* s = find(name);
+        if (s == nullptr) return;
+        s->count.fetch_add(1, std::memory_order_relaxed);
+        s->ticks.fetch_add(ticks, std::memory_order_relaxed);
+    }
+
+    void record_us(const char* name, double us) {
+        record(name, (uint64_t)(us * ticks_per_us()));
+    }
+
+    void dump(std::ostream& os = std::cout) const {
+        os << "section\tcount\ttotal_ms\tavg_us" << std::endl;
+        for (const auto& s : slots_) {
+            if (s.state.load(std::memory_order_acquire) != 2) continue;
+            uint64_t cnt = s.count.load(std::memory_order_relaxed);
+            double us = s.ticks.load(std::memory_order_relaxed) / ticks_per_us();
+            os << s.name << "\t" << cnt << "\t" << us / 1000 << "\t" << (cnt ? us / cnt : 0) << std::endl;
+        }
+    }
+
+    void reset() {
+        for (auto& s : slots_) {
+            s.count = 0;
+            s.ticks = 0;
+        }
+    }
+
+    // rdtsc ticks per microsecond, calibrated once against steady_clock
+    static double ticks_per_us() {
+        static const double tpu = [] {
+            auto t0 = std::chrono::steady_clock::now();
+            uint64_t c0 = __rdtsc();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            uint64_t c1 = __rdtsc();
+            auto t1 = std::chrono::steady_clock::now();
+            double us = std::chrono::duration<double, std::micro>(t1 - t0).count();
+            return (c1 - c0) / us;
+        }();
+        return tpu;
+    }
+
+ private:
+    struct alignas(64) Slot {
+        std::atomic<int> state{0};  // 0 empty, 1 claiming, 2 ready
+        uint64_t hash = 0;
+        char name[NAME_LEN] = {0};
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> ticks{0};
+    };
+
+    static uint64_t fnv1a(const char* s) {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (; *s; s++) h = (h ^ (uint8_t)*s) * 0x100000001b3ULL;
+        return h;
+    }
+
+    Slot* find(const char* name) {
+        const uint64_t h = fnv1a(name);
+        for (int probe = 0; probe < SLOTS; probe++) {
+            Slot& s = slots_[(h + probe) & (SLOTS - 1)];
+            int st = s.state.load(std::memory_order_acquire);
+            if (st == 0) {
+                int expected = 0;
+                if (s.state.compare_exchange_strong(expected, 1, std::memory_order_acq_rel)) {
+                    s.hash = h;
+                    strncpy(s.name, name, NAME_LEN - 1);
+                    s.state.store(2, std::memory_order_release);
+                    return &s;
+                }
+                st = expected;
+            }
+            while (st == 1) st = s.state.load(std::memory_order_acquire);
+            if (s.hash == h && strncmp(s.name, name, NAME_LEN - 1) == 0) return &s;
+        }
+        return nullptr;
+    }
+
+    Slot slots_[SLOTS];
+};
+
+// RAII rdtsc timer of a nested section. Sections opened inside another one
+// on the same thread are recorded as "outer/inner".
+class TimeSection {
+ public:
+    explicit TimeSection(const char* name) : parent_len_(path().size()) {
+        if (parent_len_ > 0) path() += '/';
+        path() += name;
+        start_ = __rdtsc();
+    }
+
+    ~TimeSection() {
+        uint64_t ticks = __rdtsc() - start_;
+        TimeAggregate::global().record(path().c_str(), ticks);
+        path().resize(parent_len_);
+    }
+
+ private:
+    static std::string& path() {
+        thread_local std::string p;
+        return p;
+    }
+
+    size_t parent_len_;
+    uint64_t start_;
+};
 
 class TimeRecorder {
-    using stdclock = std::chrono::high_resolution_clock;
+    using stdclock = std::chrono::steady_clock;
 
  public:
-    explicit TimeRecorder(const std::string& header);
+    explicit TimeRecorder(const std::string& header, bool print = false);
 
     ~TimeRecorder();  // trace = 0, debug = 1, info = 2, warn = 3, error = 4, critical = 5
 
@@ -25,6 +154,51 @@ class TimeRecorder {
 
  private:
     std::string header_;
+    bool print_;
     stdclock::time_point start_;
     stdclock::time_point last_;
 };
+
+// spans are in microseconds, every section is added to TimeAggregate::global()
+// under "header:msg" and only printed when the recorder was asked to
+
+inline TimeRecorder::TimeRecorder(const std::string& header, bool print)
+    : header_(header), print_(print) {
+    start_ = last_ = stdclock::now();
+}
+
+inline TimeRecorder::~TimeRecorder() {
+    double span = std::chrono::duration<double, std::micro>(stdclock::now() - start_).count();
+    TimeAggregate::global().record_us(header_.c_str(), span);
+}
+
+inline double
+TimeRecorder::RecordSection(const std::string& msg) {
+    stdclock::time_point curr = stdclock::now();
+    double span = std::chrono::duration<double, std::micro>(curr - last_).count();
+    last_ = curr;
+    TimeAggregate::global().record_us((header_ + ":" + msg).c_str(), span);
+    PrintTimeRecord(msg, span);
+    return span;
+}
+
+inline double
+TimeRecorder::ElapseFromBegin(const std::string& msg) {
+    stdclock::time_point curr = stdclock::now();
+    double span = std::chrono::duration<double, std::micro>(curr - start_).count();
+    PrintTimeRecord(msg, span);
+    return span;
+}
+
+inline std::string
+TimeRecorder::GetTimeSpanStr(double span) {
+    std::ostringstream ss;
+    ss << "[" << std::fixed << std::setprecision(3) << span / 1000.0 << " ms]";
+    return ss.str();
+}
+
+inline void
+TimeRecorder::PrintTimeRecord(const std::string& msg, double span) {
+    if (!print_) return;
+    std::cout << header_ << ": " << msg << " " << GetTimeSpanStr(span) << std::endl;
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "hugepage.h"
+
+// Scratch memory without malloc on the search path.
+//
+// Arena: every thread owns a bump allocator over 2 MB slabs. Slabs are
+// mmap'ed 2 MB aligned and advised for transparent hugepages, allocations
+// are cache-line aligned. An ArenaScope rewinds the thread's arena when it
+// ends, so the slabs are reused by the next call and, once the largest
+// batch has been seen, a search does no heap allocation at all. Memory
+// from an arena belongs to the thread that allocated it; threads of a
+// parallel region allocate from their own arenas.
+//
+// ObjectPool: a free list of objects whose internal buffers are worth
+// keeping between calls (e.g. planners holding vectors); acquire() hands
+// one out, it returns to the pool when the handle goes out of scope.
+
+constexpr size_t CACHE_LINE_SIZE = 64;
+constexpr size_t ARENA_SLAB_SIZE = HUGE_PAGE_SIZE;
+
+class Arena {
+ public:
+    struct Mark {
+        size_t slab;
+        size_t offset;
+    };
+
+    static Arena& local() {
+        static thread_local Arena arena;
+        return arena;
+    }
+
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    ~Arena() {
+        for (auto& s : slabs_) huge_unmap(s);
+    }
+
+    void* allocate(size_t bytes, size_t align = CACHE_LINE_SIZE) {
+        bytes = std::max<size_t>(bytes, 1);
+        while (true) {
+            if (cur_ < slabs_.size()) {
+                size_t off = (offset_ + align - 1) / align * align;
+                if (off + bytes <= slabs_[cur_].size) {
+                    offset_ = off + bytes;
+                    return slabs_[cur_].base + off;
+                }
+                // the next slab, if kept from an earlier call, may not fit
+                // a big request: a new slab goes in front of it
+                cur_++;
+                offset_ = 0;
+                if (cur_ < slabs_.size() && slabs_[cur_].size >= bytes + align) continue;
+            }
+            slabs_.insert(slabs_.begin() + std::min(cur_, slabs_.size()), new_slab(bytes + align));
+            cur_ = std::min(cur_, slabs_.size() - 1);
+            offset_ = 0;
+        }
+    }
+
+    // n uninitialized T, cache-line aligned
+    template<typename T>
+    T* alloc(size_t n) {
+        return static_cast<T*>(allocate(n * sizeof(T), std::max(CACHE_LINE_SIZE, alignof(T))));
+    }
+
+    Mark mark() const { return {cur_, offset_}; }
+    void rewind(const Mark& m) {
+        cur_ = m.slab;
+        offset_ = m.offset;
+    }
+
+    size_t num_slabs() const { return slabs_.size(); }
+    size_t reserved_bytes() const {
+        size_t bytes = 0;
+        for (auto& s : slabs_) bytes += s.size;
+        return bytes;
+    }
+
+ private:
+    // 2 MB aligned, so the kernel can back it with hugepages
+    static HugeRegion new_slab(size_t bytes) { return huge_map(bytes, HugePageMode::THP); }
+
+    std::vector<HugeRegion> slabs_;
+    size_t cur_ = 0;
+    size_t offset_ = 0;
+};
+
+// Allocations from the calling thread's arena, released together at scope end.
+class ArenaScope {
+ public:
+    ArenaScope() : arena_(Arena::local()), mark_(arena_.mark()) {}
+    ~ArenaScope() { arena_.rewind(mark_); }
+    ArenaScope(const ArenaScope&) = delete;
+
+    template<typename T>
+    T* alloc(size_t n) { return arena_.alloc<T>(n); }
+
+ private:
+    Arena& arena_;
+    Arena::Mark mark_;
+};
+
+template<typename T>
+class ObjectPool {
+ public:
+    struct Release {
+        ObjectPool* pool;
+        void operator()(T* obj) const { pool->release(obj); }
+    };
+    using Handle = std::unique_ptr<T, Release>;
+
+    Handle acquire() {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            if (!free_.empty()) {
+                T* obj = free_.back().release();
+                free_.pop_back();
+                return Handle(obj, Release{this});
+            }
+        }
+        return Handle(new T(), Release{this});
+    }
+
+    size_t idle() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return free_.size();
+    }
+
+ private:
+    void release(T* obj) {
+        std::lock_guard<std::mutex> lk(mu_);
+        free_.emplace_back(obj);
+    }
+
+    mutable std::mutex mu_;
+    std::vector<std::unique_ptr<T>> free_;
+};
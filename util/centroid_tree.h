@@ -0,0 +1,280 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "constants.h"
+#include "defines.h"
+#include "distance.h"
+#include "heap.h"
+#include "kmeans.h"
+#include "utils.h"
+
+// Multi-level centroid tree produced by hierarchical k-means.
+// Level l is stored as
+//   LEVEL + l + CENTROIDS + BIN    float centroids, (n_l, dim) header
+//   LEVEL + l + PARENT_IDS + BIN   uint32 parent id in level l - 1, (n_l, 1) header, l > 0
+// Levels are numbered like LevelType, the last loaded level holds the leaf
+// centroids whose ids are returned by the search. build_centroid_tree (the
+// build_tree tool) writes these files from the leaf centroid file by
+// clustering every level with k-means into the one above it.
+
+inline std::string level_file(const std::string& index_path, int level, const char* file_type) {
+    return index_path + LEVEL + std::to_string(level) + file_type + BIN;
+}
+
+// distance computations per level, summed over all searched queries
+struct TreeSearchStats {
+    std::vector<int64_t> level_dis_cnt;
+
+    void reset(size_t nlevels) { level_dis_cnt.assign(nlevels, 0); }
+
+    int64_t total() const {
+        int64_t sum = 0;
+        for (auto c : level_dis_cnt) sum += c;
+        return sum;
+    }
+
+    void print() const {
+        for (size_t l = 0; l < level_dis_cnt.size(); l++) {
+            std::cout << "level " << l << " distance computations: " << level_dis_cnt[l] << std::endl;
+        }
+        std::cout << "total distance computations: " << total() << std::endl;
+    }
+};
+
+class CentroidTree {
+ public:
+    int num_levels() const { return (int)centroids_.size(); }
+    int64_t dimension() const { return dim_; }
+    int64_t level_size(int level) const { return level_n_[level]; }
+    const float* level_centroids(int level) const { return centroids_[level].data(); }
+
+    // load LEVEL + 0 ... until a level file is missing or FINAL_LEVEL is reached;
+    // false when no level exists or the levels do not fit together
+    bool load(const std::string& index_path, int max_levels = (int)LevelType::FINAL_LEVEL + 1) {
+        centroids_.clear();
+        level_n_.clear();
+        child_offsets_.clear();
+        child_ids_.clear();
+        for (int l = 0; l < max_levels; l++) {
+            std::string cen_file = level_file(index_path, l, CENTROIDS);
+            if (access(cen_file.c_str(), F_OK) != 0) break;
+            uint32_t n, dim;
+            get_bin_metadata(cen_file, n, dim);
+            float* data = nullptr;
+            centroids_.emplace_back((uint64_t)n * dim);
+            data = centroids_.back().data();
+            read_bin_file<float>(cen_file, data, n, dim);
+            if (l > 0 && dim != dim_) {
+                std::cerr << cen_file << " has dim " << dim << ", level 0 has " << dim_ << std::endl;
+                return false;
+            }
+            dim_ = dim;
+            level_n_.push_back(n);
+
+            if (l == 0) continue;
+            uint32_t np, dp;
+            uint32_t* parents = nullptr;
+            std::string parent_file = level_file(index_path, l, PARENT_IDS);
+            if (access(parent_file.c_str(), F_OK) != 0) {
+                std::cerr << "missing " << parent_file << std::endl;
+                return false;
+            }
+            read_bin_file<uint32_t>(parent_file, parents, np, dp);
+            std::unique_ptr<uint32_t[]> parents_guard(parents);
+            bool valid = np == n && dp == 1;
+            for (uint32_t i = 0; valid && i < n; i++) valid = parents[i] < level_n_[l - 1];
+            if (!valid) {
+                std::cerr << parent_file << " does not map level " << l << " onto level " << l - 1 << std::endl;
+                return false;
+            }
+            build_children(l - 1, parents, n);
+        }
+        std::cout << "load centroid tree from " << index_path << " with " << num_levels() << " levels" << std::endl;
+        return num_levels() > 0;
+    }
+
+    // children of node id in level `level` live in level + 1
+    const uint32_t* children(int level, uint32_t id, uint32_t& cnt) const {
+        const auto& off = child_offsets_[level];
+        cnt = off[id + 1] - off[id];
+        return child_ids_[level].data() + off[id];
+    }
+
+    // beam[l] is the number of nodes kept at inner level l, the leaf level
+    // keeps k. dis/ids receive the k nearest leaf centroids sorted.
+    // When the children of the frontier hold fewer than k leaves, every
+    // beam is doubled and the query descends again, at worst the whole
+    // tree is expanded; so min(k, leaves) valid ids are always returned.
+    template<typename T1>
+    void search(const T1* x, int64_t k, const std::vector<int64_t>& beam,
+                float* dis, uint32_t* ids, int64_t* level_dis_cnt) const {
+        const int64_t want = std::min<int64_t>(k, level_n_.back());
+        for (int64_t widen = 1;; widen *= 2) {
+            int64_t found = descend(x, k, beam, widen, dis, ids, level_dis_cnt);
+            bool all_levels_full = true;
+            for (int l = 0; l + 1 < num_levels(); l++) {
+                if (beam_at(beam, l) * widen < level_n_[l]) all_levels_full = false;
+            }
+            if (found >= want || all_levels_full) return;
+        }
+    }
+
+ private:
+    static int64_t beam_at(const std::vector<int64_t>& beam, int l) {
+        return std::max<int64_t>(1, beam[std::min<size_t>(l, beam.size() - 1)]);
+    }
+
+    // one descent with every beam multiplied by widen, returns the number of
+    // leaves found
+    template<typename T1>
+    int64_t descend(const T1* x, int64_t k, const std::vector<int64_t>& beam, int64_t widen,
+                    float* dis, uint32_t* ids, int64_t* level_dis_cnt) const {
+        using C = CMax<float, uint32_t>;
+        thread_local std::vector<float> bdis;
+        thread_local std::vector<uint32_t> bids, frontier;
+
+        const int nlevels = num_levels();
+        frontier.clear();
+        int64_t found = 0;
+        for (int l = 0; l < nlevels; l++) {
+            const int64_t keep = l + 1 == nlevels ? k
+                               : std::min<int64_t>(beam_at(beam, l) * widen, level_n_[l]);
+            float* out_dis = l + 1 == nlevels ? dis : nullptr;
+            uint32_t* out_ids = l + 1 == nlevels ? ids : nullptr;
+            if (out_dis == nullptr) {
+                bdis.resize(keep);
+                bids.resize(keep);
+                out_dis = bdis.data();
+                out_ids = bids.data();
+            }
+            heap_heapify<C>(keep, out_dis, out_ids);
+
+            const float* cen = centroids_[l].data();
+            int64_t cnt = 0;
+            auto visit = [&](uint32_t id) {
+                float d = L2sqr<const T1, const float, float>(x, cen + (int64_t)id * dim_, dim_);
+                if (C::cmp(out_dis[0], d)) {
+                    heap_swap_top<C>(keep, out_dis, out_ids, d, id);
+                }
+                cnt++;
+            };
+            if (l == 0) {
+                for (uint32_t id = 0; id < level_n_[0]; id++) visit(id);
+            } else {
+                for (auto p : frontier) {
+                    uint32_t nc;
+                    const uint32_t* ch = children(l - 1, p, nc);
+                    for (uint32_t c = 0; c < nc; c++) visit(ch[c]);
+                }
+            }
+            if (level_dis_cnt != nullptr) level_dis_cnt[l] += cnt;
+
+            if (l + 1 == nlevels) {
+                heap_reorder<C>(k, dis, ids);
+                found = std::min<int64_t>(cnt, k);
+            } else {
+                frontier.clear();
+                for (int64_t b = 0; b < keep; b++) {
+                    if (out_ids[b] != (uint32_t)-1) frontier.push_back(out_ids[b]);
+                }
+            }
+        }
+        return found;
+    }
+
+    void build_children(int parent_level, const uint32_t* parents, uint32_t n) {
+        const int64_t np = level_n_[parent_level];
+        std::vector<uint32_t> off(np + 1, 0);
+        for (uint32_t i = 0; i < n; i++) off[parents[i] + 1]++;
+        for (int64_t p = 0; p < np; p++) off[p + 1] += off[p];
+        std::vector<uint32_t> ids(n);
+        std::vector<uint32_t> pos(off.begin(), off.end() - 1);
+        for (uint32_t i = 0; i < n; i++) {
+            ids[pos[parents[i]]++] = i;
+        }
+        child_offsets_.push_back(std::move(off));
+        child_ids_.push_back(std::move(ids));
+    }
+
+    int64_t dim_ = 0;
+    std::vector<std::vector<float>> centroids_;
+    std::vector<uint32_t> level_n_;
+    // CSR children lists, child_*_[l] maps level l nodes to level l + 1 nodes
+    std::vector<std::vector<uint32_t>> child_offsets_;
+    std::vector<std::vector<uint32_t>> child_ids_;
+};
+
+// tree-structured replacement of knn_1 for the coarse search,
+// per-level distance counts are accumulated into stats
+template<class C, typename T1>
+void tree_knn(const T1* x,
+              const CentroidTree& tree,
+              int64_t nx,
+              int64_t k,
+              const std::vector<int64_t>& beam,
+              typename C::T* value,
+              typename C::TI* labels,
+              TreeSearchStats* stats = nullptr)
+{
+    const int nlevels = tree.num_levels();
+    std::cout << "do tree_knn with nx = " << nx << ", levels = " << nlevels
+              << ", k = " << k << std::endl;
+    if (stats != nullptr) stats->reset(nlevels);
+
+#pragma omp parallel
+    {
+        std::vector<int64_t> local_cnt(nlevels, 0);
+#pragma omp for schedule(dynamic, 16)
+        for (int64_t i = 0; i < nx; i++) {
+            tree.search(x + i * tree.dimension(), k, beam, value + i * k, labels + i * k, local_cnt.data());
+        }
+        if (stats != nullptr) {
+#pragma omp critical
+            for (int l = 0; l < nlevels; l++) stats->level_dis_cnt[l] += local_cnt[l];
+        }
+    }
+}
+
+// Write the tree of leaf centroids (n, dim) to index_path: every level is
+// clustered by k-means into ceil(n_l / fanout) centroids, which form the
+// level above it and give its parent ids, until a level holds at most
+// fanout centroids or FINAL_LEVEL + 1 levels exist. The leaves are the
+// last level and keep their ids.
+inline void build_centroid_tree(const std::string& index_path, const float* leaves,
+                                int64_t n, int64_t dim, int64_t fanout, int niter = 10) {
+    assert(fanout >= 2);
+    // bottom-up: levels[0] are the leaves
+    std::vector<std::vector<float>> levels(1, std::vector<float>(leaves, leaves + n * dim));
+    std::vector<std::vector<uint32_t>> parents;
+    const int max_levels = (int)LevelType::FINAL_LEVEL + 1;
+    for (int64_t cur = n; cur > fanout && (int)levels.size() < max_levels;) {
+        const int64_t up = (cur + fanout - 1) / fanout;
+        std::vector<float> cen(up * dim);
+        std::vector<uint32_t> assign(cur);
+        kmeans<float>(levels.back().data(), cur, dim, up, cen.data(), assign.data(), niter);
+        parents.push_back(std::move(assign));
+        levels.push_back(std::move(cen));
+        cur = up;
+    }
+
+    const int nlevels = levels.size();
+    for (int l = 0; l < nlevels; l++) {
+        // file level l is bottom-up level nlevels - 1 - l
+        const int b = nlevels - 1 - l;
+        write_bin_file<float>(level_file(index_path, l, CENTROIDS), levels[b].data(),
+                              levels[b].size() / dim, dim);
+        if (l > 0) {
+            write_bin_file<uint32_t>(level_file(index_path, l, PARENT_IDS), parents[b].data(),
+                                     parents[b].size(), 1);
+        }
+    }
+    std::cout << "build centroid tree of " << n << " leaves with " << nlevels << " levels to "
+              << index_path << std::endl;
+}
@@ -25,6 +25,8 @@ constexpr static int SPLIT_THRESHOLD = 500;
 constexpr static int MAX_CLUSTER_K2 = 500;
 
 constexpr static int KMEANS_THRESHOLD = 2000;
+// bound-accelerated k-means uses Hamerly below this k, Yinyang with k / 10 groups above
+constexpr static int YINYANG_MIN_K = 32;
 // if cluster size smaller than SAME_SIZE_THRESHOLD , use same size kmeans or graph partition
 constexpr static int SAME_SIZE_THRESHOLD = 5000;
 
@@ -43,6 +45,7 @@ constexpr static float SEARCH_PRUNING_RATE = 0.9;
 constexpr const char* GLOBAL = "global-";
 constexpr const char* CLUSTER = "cluster-";
 constexpr const char* BUCKET = "bucket-";
+constexpr const char* LEVEL = "level-";
 
 // file_name
 constexpr const char* HNSW = "hnsw-";
@@ -58,6 +61,10 @@ constexpr const char* RAWDATA = "raw_data";
 constexpr const char* SAMPLEDATA = "sampledata";
 constexpr const char* META = "meta";
 constexpr const char* INDEX = "index";
+constexpr const char* PARENT_IDS = "parent_ids";
+constexpr const char* LAYOUT = "layout";
+constexpr const char* RESIDUAL_CODES = "residual_codes";
+constexpr const char* RESIDUAL_PARAMS = "residual_params";
 
 // suffix
 constexpr const char* BIN = ".bin";
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <omp.h>
+#include <string>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+#include "flat.h"
+#include "merge.h"
+#include "random.h"
+#include "read_file.h"
+#include "utils.h"
+
+// Synthetic datasets in the (n, dim) bin format: base and query vectors are
+// drawn from the same Gaussian mixture, the cluster of a query follows a
+// Zipf law over the clusters so the probe locality resembles real traffic.
+// Row i only depends on (seed, i / GEN_CHUNK_ROWS), chunks are generated in
+// parallel and written with pwrite at their final offset, so the output is
+// the same for any thread count and streams at disk speed.
+//
+// ground truth uses the big-ann layout:
+//   (nq, k) header, uint32 ids[nq * k], float dis[nq * k]
+
+constexpr static int64_t GEN_CHUNK_ROWS = 1 << 16;
+
+struct DatasetConfig {
+    int64_t n = 1000000;
+    int64_t dim = 128;
+    int64_t nclusters = 1000;
+    // mixture stddev as a fraction of the value range
+    float sigma = 0.05;
+    // Zipf exponent of the query clusters, 0 is uniform
+    double zipf = 1.0;
+    uint64_t seed = 1234;
+};
+
+template<typename T> struct value_range { static constexpr float lo = -1, hi = 1; };
+template<> struct value_range<uint8_t> { static constexpr float lo = 0, hi = 255; };
+template<> struct value_range<int8_t> { static constexpr float lo = -128, hi = 127; };
+
+template<typename T>
+inline T to_value(float v) {
+    v = std::min(value_range<T>::hi, std::max(value_range<T>::lo, v));
+    return std::is_integral<T>::value ? (T)(int)(v + (v >= 0 ? 0.5f : -0.5f)) : (T)v;
+}
+
+// approximately N(0, 1): the sum of the four 16-bit uniforms of one draw
+// (Irwin-Hall, n = 4) rescaled to unit variance. One rng call and no libm
+// per value, which keeps generation at disk speed; the tails stop at
+// +-2 sqrt(3), irrelevant for a synthetic mixture
+inline float gaussian(Xoshiro256& rng) {
+    uint64_t r = rng();
+    uint32_t sum = (r & 0xffff) + ((r >> 16) & 0xffff) + ((r >> 32) & 0xffff) + (r >> 48);
+    return ((float)sum - 2 * 65535.0f) * (1.7320508f / 65535.0f);
+}
+
+class GaussianMixture {
+ public:
+    template<typename T>
+    void init(const DatasetConfig& cfg) {
+        cfg_ = cfg;
+        const float lo = value_range<T>::lo, hi = value_range<T>::hi;
+        scale_ = cfg.sigma * (hi - lo);
+        Xoshiro256 rng = rng_stream(cfg.seed, 0);
+        centers_.resize(cfg.nclusters * cfg.dim);
+        for (auto& c : centers_) c = lo + (hi - lo) * rng.next_float();
+        zipf_cdf_.resize(cfg.nclusters);
+        double sum = 0;
+        for (int64_t c = 0; c < cfg.nclusters; c++) {
+            sum += 1.0 / std::pow(c + 1, cfg.zipf);
+            zipf_cdf_[c] = sum;
+        }
+        for (auto& p : zipf_cdf_) p /= sum;
+    }
+
+    // n rows drawn with rng, clusters are uniform unless zipf_clusters
+    template<typename T>
+    void sample(T* out, int64_t n, Xoshiro256& rng, bool zipf_clusters) const {
+        for (int64_t i = 0; i < n; i++) {
+            int64_t c = zipf_clusters
+                ? std::lower_bound(zipf_cdf_.begin(), zipf_cdf_.end(), rng.next_double()) - zipf_cdf_.begin()
+                : (int64_t)rng.next_below(cfg_.nclusters);
+            c = std::min(c, cfg_.nclusters - 1);
+            const float* center = centers_.data() + c * cfg_.dim;
+            T* row = out + i * cfg_.dim;
+            for (int64_t d = 0; d < cfg_.dim; d++) row[d] = to_value<T>(center[d] + scale_ * gaussian(rng));
+        }
+    }
+
+ private:
+    DatasetConfig cfg_;
+    float scale_ = 0;
+    std::vector<float> centers_;
+    std::vector<double> zipf_cdf_;
+};
+
+// write n rows of the mixture to file_name, stream 1 is the base set and
+// stream 2 the queries
+template<typename T>
+void generate_bin_file(const std::string& file_name, const GaussianMixture& mixture,
+                       const DatasetConfig& cfg, int64_t n, int64_t stream, bool zipf_clusters) {
+    int fd = open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assert(fd >= 0);
+    uint32_t header[2] = {(uint32_t)n, (uint32_t)cfg.dim};
+    ssize_t hw = pwrite(fd, header, sizeof(header), 0);
+    assert(hw == sizeof(header));
+
+    const uint64_t row_bytes = cfg.dim * sizeof(T);
+    const int64_t nchunk = (n + GEN_CHUNK_ROWS - 1) / GEN_CHUNK_ROWS;
+    // every chunk gets its own generator, seeded from (seed, stream, chunk)
+    const uint64_t stream_seed = rng_stream(cfg.seed, stream)();
+#pragma omp parallel
+{
+    std::unique_ptr<T[]> buf(new T[GEN_CHUNK_ROWS * cfg.dim]);
+#pragma omp for schedule(dynamic)
+    for (int64_t chunk = 0; chunk < nchunk; chunk++) {
+        int64_t from = chunk * GEN_CHUNK_ROWS;
+        int64_t rows = std::min(GEN_CHUNK_ROWS, n - from);
+        Xoshiro256 rng(stream_seed + chunk);
+        mixture.sample<T>(buf.get(), rows, rng, zipf_clusters);
+        uint64_t bytes = rows * row_bytes, off = 0;
+        while (off < bytes) {
+            ssize_t w = pwrite(fd, (char*)buf.get() + off, bytes - off, sizeof(header) + from * row_bytes + off);
+            assert(w > 0);
+            off += w;
+        }
+    }
+}
+    close(fd);
+    std::cout << "generate " << n << " vectors to " << file_name << ", dim = " << cfg.dim << std::endl;
+}
+
+// exact top-k of every query over base_file, the base is streamed in blocks,
+// each block is searched with knn_2 and merged into the running result
+template<typename T>
+void generate_ground_truth(const std::string& base_file, const std::string& query_file,
+                           const std::string& gt_file, int64_t k, int64_t block_rows = 1 << 18) {
+    uint32_t nq, dim;
+    T* query = nullptr;
+    read_bin_file<T>(query_file, query, nq, dim);
+    std::unique_ptr<T[]> query_guard(query);
+
+    int32_t nb, db;
+    FILE* f = read_file_head(base_file.c_str(), &nb, &db);
+    assert(f != nullptr && (uint32_t)db == dim);
+    k = std::min<int64_t>(k, nb);
+
+    ResultSet<float, uint32_t> result, block_result;
+    std::unique_ptr<T[]> block(new T[block_rows * dim]);
+    int64_t base_id = 0;
+    for (int32_t rows; (rows = read_file_data<T>(f, block_rows, dim, block.get())) > 0; base_id += rows) {
+        bool first = base_id == 0;
+        // the widening kernel needs no scratch buffer, so any dim works
+        knn_2<CMax<float, uint32_t>, T, T>(
+            query, block.get(), nq, rows, dim, k, first ? result : block_result,
+            l2_ps_kernel<T, T>);
+        if (!first) {
+            // a block shorter than k leaves its tail at the neutral value
+            merge<CMax<float, uint32_t>>(result, block_result, base_id);
+        }
+    }
+    fclose(f);
+
+    write_comp<float, uint32_t>(result, gt_file);
+}
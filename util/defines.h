@@ -15,6 +15,7 @@ enum class DataType {
     None = 0,
     INT8 = 1,
     FLOAT = 2,
+    FLOAT16 = 3,
 };
 
 enum class QuantizerType {
@@ -23,6 +24,21 @@ enum class QuantizerType {
     PQRES = 2,
 };
 
+// residual (vector - centroid) storage of the cluster files
+enum class ResidualCodec {
+    None = 0,
+    INT8 = 1,
+    SQ4 = 2,
+};
+
+enum class KmeansInit {
+    RANDOM = 0,
+    KMEANS_PP = 1,
+    KMEANS_PARALLEL = 2,
+    // the centroids already hold the seeds, e.g. from a timed kmeans_init
+    GIVEN = 3,
+};
+
 enum class LevelType {
     FIRST_LEVEL = 0,
     SECOND_LEVEL = 1,
@@ -30,3 +46,17 @@ enum class LevelType {
     BALANCE_LEVEL = 3,
     FINAL_LEVEL =4,
 };
+
+// page backing of large matrices, see hugepage.h
+enum class HugePageMode {
+    None = 0,
+    THP = 1,
+    HUGETLB = 2,
+};
+
+// brute-force knn of flat.h: knn_1, knn_2, knn_3
+enum class KnnVariant {
+    QUERY_SCAN = 1,
+    BASE_SCAN = 2,
+    TILED = 3,
+};
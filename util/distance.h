@@ -5,6 +5,8 @@
 #include <stdint.h>
 #include <assert.h>
 
+#include "float16.h"
+
 // Data type: T1, T2
 // Distance type: R
 
@@ -97,7 +99,7 @@ inline float L2sqr<const float, const float, float>(const float *a, const float
   int16_t yshortbuffer[16];                                                    \
   if (n > 0) {                                                                 \
     for (int i = 0; i < 16; i++) {                                             \
-      if (i < n) {                                                             \
+      if ((size_t)i < n) {                                                     \
         xshortbuffer[i] = (int16_t)a[i];                                       \
         yshortbuffer[i] = (int16_t)b[i];                                       \
       } else {                                                                 \
@@ -147,7 +149,7 @@ inline uint32_t L2sqr<const uint8_t, const uint8_t, uint32_t>(const uint8_t *a,
     int16_t xshortbuffer[16];                                                  \
     int16_t yshortbuffer[16];                                                  \
     for (int i = 0; i < 16; i++) {                                             \
-      if (i < n) {                                                             \
+      if ((size_t)i < n) {                                                     \
         xshortbuffer[i] = (int16_t)a[i];                                       \
         yshortbuffer[i] = (int16_t)b[i];                                       \
       } else {                                                                 \
@@ -184,7 +186,7 @@ inline int L2sqr<const int8_t, const int8_t, int>(const int8_t *a, const int8_t
 template<>
 inline float L2sqr<int8_t, float, float>(int8_t *a, float *b, size_t n) {
     float afloatbuffer[256];
-    for (int i=0; i< n; i++) {
+    for (size_t i = 0; i < n; i++) {
         afloatbuffer[i] = (float) a[i];
     }
     return L2sqr<float, float, float>(afloatbuffer, b, n);
@@ -193,7 +195,7 @@ inline float L2sqr<int8_t, float, float>(int8_t *a, float *b, size_t n) {
 template<>
 inline float L2sqr<const int8_t, const float, float>(const int8_t *a, const float *b, size_t n) {
     float afloatbuffer[256];
-    for (int i=0; i< n; i++) {
+    for (size_t i = 0; i < n; i++) {
         afloatbuffer[i] = (float) a[i];
     }
     return L2sqr<const float, const float, float>(afloatbuffer, b, n);
@@ -203,7 +205,7 @@ inline float L2sqr<const int8_t, const float, float>(const int8_t *a, const floa
 template<>
 inline float L2sqr<uint8_t, float, float>(uint8_t *a, float *b, size_t n) {
     float afloatbuffer[256];
-    for (int i=0; i< n; i++) {
+    for (size_t i = 0; i < n; i++) {
         afloatbuffer[i] = (float) a[i];
     }
     return L2sqr<float, float, float>(afloatbuffer, b, n);
@@ -212,7 +214,7 @@ inline float L2sqr<uint8_t, float, float>(uint8_t *a, float *b, size_t n) {
 template<>
 inline float L2sqr<const uint8_t, const float, float>(const uint8_t *a, const float *b, size_t n) {
     float afloatbuffer[256];
-    for (int i=0; i< n; i++) {
+    for (size_t i = 0; i < n; i++) {
         afloatbuffer[i] = (float) a[i];
     }
     return L2sqr<const float, const float, float>(afloatbuffer, b, n);
@@ -301,6 +303,189 @@ inline float IP<const float, const float, float>(const float* a, const float* b,
     IP_FLOAT_IMPL;
 }
 
+// Integer IP: the bytes are widened to int16 and multiplied pairwise into
+// int32 with madd, which is exact for u8 x u8 where the int16 pair sums of
+// maddubs would saturate. With AVX-512BW the loop takes 32 bytes per step,
+// fused into dpwssd when AVX-512 VNNI is available.
+inline int32_t hsum_epi32(__m256i v) {
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    s = _mm_hadd_epi32(s, s);
+    s = _mm_hadd_epi32(s, s);
+    return _mm_cvtsi128_si32(s);
+}
+
+inline __m256i load_epi16x16(const uint8_t* p) { return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)p)); }
+inline __m256i load_epi16x16(const int8_t* p) { return _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)p)); }
+
+#if defined(__AVX512BW__)
+inline __m512i load_epi16x32(const uint8_t* p) { return _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)p)); }
+inline __m512i load_epi16x32(const int8_t* p) { return _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i*)p)); }
+#endif
+
+template<typename T>
+inline int32_t ip_int8_kernel(const T* a, const T* b, size_t n) {
+    size_t i = 0;
+    int32_t dis = 0;
+#if defined(__AVX512BW__)
+    __m512i msum512 = _mm512_setzero_si512();
+    for (; i + 32 <= n; i += 32) {
+#if defined(__AVX512VNNI__)
+        msum512 = _mm512_dpwssd_epi32(msum512, load_epi16x32(a + i), load_epi16x32(b + i));
+#else
+        msum512 = _mm512_add_epi32(msum512, _mm512_madd_epi16(load_epi16x32(a + i), load_epi16x32(b + i)));
+#endif
+    }
+    dis += _mm512_reduce_add_epi32(msum512);
+#endif
+    __m256i msum = _mm256_setzero_si256();
+    for (; i + 16 <= n; i += 16) {
+        msum = _mm256_add_epi32(msum, _mm256_madd_epi16(load_epi16x16(a + i), load_epi16x16(b + i)));
+    }
+    dis += hsum_epi32(msum);
+    for (; i < n; i++) dis += (int32_t)a[i] * (int32_t)b[i];
+    return dis;
+}
+
+template<>
+inline uint32_t IP<uint8_t, uint8_t, uint32_t>(uint8_t* a, uint8_t* b, size_t n) {
+    return ip_int8_kernel<uint8_t>(a, b, n);
+}
+
+template<>
+inline uint32_t IP<const uint8_t, const uint8_t, uint32_t>(const uint8_t* a, const uint8_t* b, size_t n) {
+    return ip_int8_kernel<uint8_t>(a, b, n);
+}
+
+template<>
+inline int IP<int8_t, int8_t, int>(int8_t* a, int8_t* b, size_t n) {
+    return ip_int8_kernel<int8_t>(a, b, n);
+}
+
+template<>
+inline int IP<const int8_t, const int8_t, int>(const int8_t* a, const int8_t* b, size_t n) {
+    return ip_int8_kernel<int8_t>(a, b, n);
+}
+
+// Mixed and half precision kernels: either side is loaded 8 lanes at a
+// time as float (bytes widened, float16 through F16C) and accumulated
+// with fma in float.
+inline __m256 load_ps8(const float* p) { return _mm256_loadu_ps(p); }
+inline __m256 load_ps8(const float16* p) { return load_fp16x8(p); }
+inline __m256 load_ps8(const uint8_t* p) {
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p)));
+}
+inline __m256 load_ps8(const int8_t* p) {
+    return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)p)));
+}
+
+inline float hsum_ps(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_hadd_ps(s, s);
+    s = _mm_hadd_ps(s, s);
+    return _mm_cvtss_f32(s);
+}
+
+template<typename T1, typename T2>
+inline float ip_ps_kernel(const T1* a, const T2* b, size_t n) {
+    __m256 msum = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) msum = _mm256_fmadd_ps(load_ps8(a + i), load_ps8(b + i), msum);
+    float dis = hsum_ps(msum);
+    for (; i < n; i++) dis += (float)a[i] * (float)b[i];
+    return dis;
+}
+
+template<typename T1, typename T2>
+inline float l2_ps_kernel(const T1* a, const T2* b, size_t n) {
+    __m256 msum = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_sub_ps(load_ps8(a + i), load_ps8(b + i));
+        msum = _mm256_fmadd_ps(d, d, msum);
+    }
+    float dis = hsum_ps(msum);
+    for (; i < n; i++) {
+        float d = (float)a[i] - (float)b[i];
+        dis += d * d;
+    }
+    return dis;
+}
+
+#define MIXED_FLOAT_KERNEL(NAME, KERNEL, T1, T2)                               \
+  template<>                                                                   \
+  inline float NAME<T1, T2, float>(T1* a, T2* b, size_t n) {                   \
+    return KERNEL(a, b, n);                                                    \
+  }                                                                            \
+  template<>                                                                   \
+  inline float NAME<const T1, const T2, float>(const T1* a, const T2* b, size_t n) { \
+    return KERNEL(a, b, n);                                                    \
+  }
+
+MIXED_FLOAT_KERNEL(IP, ip_ps_kernel, uint8_t, float)
+MIXED_FLOAT_KERNEL(IP, ip_ps_kernel, int8_t, float)
+MIXED_FLOAT_KERNEL(IP, ip_ps_kernel, float16, float16)
+MIXED_FLOAT_KERNEL(IP, ip_ps_kernel, float, float16)
+MIXED_FLOAT_KERNEL(IP, ip_ps_kernel, float16, float)
+MIXED_FLOAT_KERNEL(L2sqr, l2_ps_kernel, float16, float16)
+MIXED_FLOAT_KERNEL(L2sqr, l2_ps_kernel, float, float16)
+MIXED_FLOAT_KERNEL(L2sqr, l2_ps_kernel, float16, float)
+
+// Register-blocked L2 of 4 queries against one base row for the tiled scan
+// (knn_3): x holds the 4 queries, n apart, each 8 lanes of the row are
+// loaded once and feed 4 accumulators. Enabled for the pairs whose L2sqr is
+// computed in float lanes; compute() falls back to L2sqr elsewhere.
+template<typename T1, typename T2>
+inline void l2_ps_kernel_4x1(const T1* x, const T2* y, size_t n, float* dis) {
+    __m256 msum0 = _mm256_setzero_ps(), msum1 = _mm256_setzero_ps();
+    __m256 msum2 = _mm256_setzero_ps(), msum3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 my = load_ps8(y + i);
+        const __m256 d0 = _mm256_sub_ps(load_ps8(x + i), my);
+        const __m256 d1 = _mm256_sub_ps(load_ps8(x + n + i), my);
+        const __m256 d2 = _mm256_sub_ps(load_ps8(x + 2 * n + i), my);
+        const __m256 d3 = _mm256_sub_ps(load_ps8(x + 3 * n + i), my);
+        msum0 = _mm256_fmadd_ps(d0, d0, msum0);
+        msum1 = _mm256_fmadd_ps(d1, d1, msum1);
+        msum2 = _mm256_fmadd_ps(d2, d2, msum2);
+        msum3 = _mm256_fmadd_ps(d3, d3, msum3);
+    }
+    dis[0] = hsum_ps(msum0);
+    dis[1] = hsum_ps(msum1);
+    dis[2] = hsum_ps(msum2);
+    dis[3] = hsum_ps(msum3);
+    for (; i < n; i++) {
+        for (int b = 0; b < 4; b++) {
+            float d = (float)x[b * n + i] - (float)y[i];
+            dis[b] += d * d;
+        }
+    }
+}
+
+template<typename T1, typename T2, typename R>
+struct L2Block4 {
+    static constexpr bool enabled = false;
+    static void compute(const T1* x, const T2* y, size_t n, R* dis) {
+        for (int b = 0; b < 4; b++) dis[b] = L2sqr<const T1, const T2, R>(x + b * n, y, n);
+    }
+};
+
+#define L2_BLOCK4_KERNEL(T1, T2)                                               \
+  template<>                                                                   \
+  struct L2Block4<T1, T2, float> {                                             \
+    static constexpr bool enabled = true;                                      \
+    static void compute(const T1* x, const T2* y, size_t n, float* dis) {      \
+      l2_ps_kernel_4x1(x, y, n, dis);                                          \
+    }                                                                          \
+  };
+
+L2_BLOCK4_KERNEL(float, float)
+L2_BLOCK4_KERNEL(uint8_t, float)
+L2_BLOCK4_KERNEL(int8_t, float)
+L2_BLOCK4_KERNEL(float16, float16)
+L2_BLOCK4_KERNEL(float, float16)
+L2_BLOCK4_KERNEL(float16, float)
+
 // A vector multiply a matrix
 // args:　
 // a: subquery vector;
@@ -308,6 +493,7 @@ inline float IP<const float, const float, float>(const float* a, const float* b,
 // c: result;
 // n: sub_dim;
 // m: the number of centroids, m is divisible by 32.
+// Byte and float16 subqueries are converted per element in the kernel.
 template<typename T1>
 inline void compute_lookuptable_IP(T1* a, float* b, float* c, size_t n, size_t m) {
     float* a_buffer = new float[n];
@@ -331,7 +517,7 @@ inline void compute_lookuptable_IP(T1* a, float* b, float* c, size_t n, size_t m
     msum3 = _mm256_setzero_ps();                                               \
     msum4 = _mm256_setzero_ps();                                               \
     while (dim < n) {                                                          \
-      __m256 mx = _mm256_set1_ps(*(a + dim));                                  \
+      __m256 mx = _mm256_set1_ps((float)*(a + dim));                           \
       __m256 my1 = _mm256_loadu_ps(y);                                         \
       __m256 my2 = _mm256_loadu_ps(y + 8);                                     \
       __m256 my3 = _mm256_loadu_ps(y + 16);                                    \
@@ -361,6 +547,36 @@ inline void compute_lookuptable_IP<const float>(const float* a, float* b, float*
     COMPUTE_LOOKUPTABLE_IP_IMPL
 }
 
+template<>
+inline void compute_lookuptable_IP<uint8_t>(uint8_t* a, float* b, float* c, size_t n, size_t m) {
+    COMPUTE_LOOKUPTABLE_IP_IMPL
+}
+
+template<>
+inline void compute_lookuptable_IP<const uint8_t>(const uint8_t* a, float* b, float* c, size_t n, size_t m) {
+    COMPUTE_LOOKUPTABLE_IP_IMPL
+}
+
+template<>
+inline void compute_lookuptable_IP<int8_t>(int8_t* a, float* b, float* c, size_t n, size_t m) {
+    COMPUTE_LOOKUPTABLE_IP_IMPL
+}
+
+template<>
+inline void compute_lookuptable_IP<const int8_t>(const int8_t* a, float* b, float* c, size_t n, size_t m) {
+    COMPUTE_LOOKUPTABLE_IP_IMPL
+}
+
+template<>
+inline void compute_lookuptable_IP<float16>(float16* a, float* b, float* c, size_t n, size_t m) {
+    COMPUTE_LOOKUPTABLE_IP_IMPL
+}
+
+template<>
+inline void compute_lookuptable_IP<const float16>(const float16* a, float* b, float* c, size_t n, size_t m) {
+    COMPUTE_LOOKUPTABLE_IP_IMPL
+}
+
 template<typename T1>
 inline void compute_lookuptable_L2(T1* a, float* b, float* c, size_t n, size_t m) {
     float* a_buffer = new float[n];
@@ -384,7 +600,7 @@ inline void compute_lookuptable_L2(T1* a, float* b, float* c, size_t n, size_t m
     msum3 = _mm256_setzero_ps();                                               \
     msum4 = _mm256_setzero_ps();                                               \
     while (dim < n) {                                                          \
-      __m256 mx = _mm256_set1_ps(*(a + dim));                                  \
+      __m256 mx = _mm256_set1_ps((float)*(a + dim));                           \
       __m256 my1 = _mm256_loadu_ps(y);                                         \
       __m256 my2 = _mm256_loadu_ps(y + 8);                                     \
       __m256 my3 = _mm256_loadu_ps(y + 16);                                    \
@@ -419,6 +635,36 @@ inline void compute_lookuptable_L2<const float>(const float* a, float* b, float*
     COMPUTE_LOOKUPTABLE_L2_IMPL;
 }
 
+template<>
+inline void compute_lookuptable_L2<uint8_t>(uint8_t* a, float* b, float* c, size_t n, size_t m) {
+    COMPUTE_LOOKUPTABLE_L2_IMPL;
+}
+
+template<>
+inline void compute_lookuptable_L2<const uint8_t>(const uint8_t* a, float* b, float* c, size_t n, size_t m) {
+    COMPUTE_LOOKUPTABLE_L2_IMPL;
+}
+
+template<>
+inline void compute_lookuptable_L2<int8_t>(int8_t* a, float* b, float* c, size_t n, size_t m) {
+    COMPUTE_LOOKUPTABLE_L2_IMPL;
+}
+
+template<>
+inline void compute_lookuptable_L2<const int8_t>(const int8_t* a, float* b, float* c, size_t n, size_t m) {
+    COMPUTE_LOOKUPTABLE_L2_IMPL;
+}
+
+template<>
+inline void compute_lookuptable_L2<float16>(float16* a, float* b, float* c, size_t n, size_t m) {
+    COMPUTE_LOOKUPTABLE_L2_IMPL;
+}
+
+template<>
+inline void compute_lookuptable_L2<const float16>(const float16* a, float* b, float* c, size_t n, size_t m) {
+    COMPUTE_LOOKUPTABLE_L2_IMPL;
+}
+
 inline void matrix_transpose(const float* src, float* des, int64_t row, int64_t col) {
     assert(src != nullptr);
     assert(des != nullptr);
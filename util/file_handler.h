@@ -5,11 +5,15 @@
 #include <cassert>
 #include <cstring>
 #include "constants.h"
+#include "hugepage.h"
+#include "metrics.h"
 
 
 class IOReader {
  public:
-     IOReader(const std::string& file_name, const uint64_t cache_size = GIGABYTE)
+     // the cache buffer is mapped with mode, see hugepage.h
+     IOReader(const std::string& file_name, const uint64_t cache_size = GIGABYTE,
+              HugePageMode mode = HugePageMode::None)
          : cache_size_(cache_size), cur_off_(0) {
         reader_.open(file_name, std::ios::binary | std::ios::ate);
         assert(reader_.is_open() == true);
@@ -18,13 +22,13 @@ class IOReader {
         reader_.seekg(0, reader_.beg);
         assert(cache_size_ > 0);
         cache_size_ = (std::min)(cache_size_, fsize_);
-        cache_buf_ = (char*) malloc(cache_size_);
-        assert(cache_buf_ != nullptr);
-        reader_.read(cache_buf_, cache_size_);
+        cache_region_ = huge_map(cache_size_, mode);
+        cache_buf_ = cache_region_.base;
+        file_read(cache_buf_, cache_size_);
      }
 
      ~IOReader() {
-         free(cache_buf_);
+         huge_unmap(cache_region_);
          reader_.close();
      }
 
@@ -41,21 +45,31 @@ class IOReader {
              assert(n_bytes - in_cache <= fsize_ - reader_.tellg());
              memcpy(read_buf, cache_buf_ + cur_off_, in_cache);
              cur_off_ = cache_size_;
-             reader_.read(read_buf + in_cache, n_bytes - in_cache);
+             file_read(read_buf + in_cache, n_bytes - in_cache);
              if (cache_size_ <= fsize_ - reader_.tellg()) {
-                 reader_.read(cache_buf_, cache_size_);
+                 file_read(cache_buf_, cache_size_);
                  cur_off_ = 0;
              }
          }
      }
 
  private:
+    // every read that reaches the file is counted, cache hits are not
+    void file_read(char* buf, const uint64_t n_bytes) {
+        static Counter& bytes_read = MetricsRegistry::instance().counter(METRIC_BYTES_READ);
+        static Counter& read_ios = MetricsRegistry::instance().counter(METRIC_READ_IOPS);
+        reader_.read(buf, n_bytes);
+        bytes_read.add(n_bytes);
+        read_ios.add();
+    }
+
   // underlying ifstream
     std::ifstream reader_;
   // # bytes to cache in one shot read
     uint64_t cache_size_ = 0;
   // underlying buf for cache
     char* cache_buf_ = nullptr;
+    HugeRegion cache_region_;
   // offset into cache_buf for cur_pos
     uint64_t cur_off_ = 0;
   // file size
@@ -1,9 +1,12 @@
 #pragma once
 
+#include "arena.h"
 #include "distance.h"
 #include "heap.h"
 #include "system.h"
 #include "utils.h"
+#include "work_stealing.h"
+#include "metrics.h"
 
 #include <algorithm>
 #include <omp.h>
@@ -11,6 +14,15 @@
 // Data type: T1, T2
 // Distance type: C::T
 // ID type C::TI
+// knn_1 scans the whole base per query, knn_2 splits the base scan over the
+// threads for blocks of queries sized to the L3, knn_3 tiles both axes to
+// the L1 / L2 (see KnnTiling) and computes L2 with a 4 x 1 micro-kernel.
+// All variants run on OpenMP by default. Passing a WorkStealingPool
+// schedules the query loop (knn_1), the base scan (knn_2) or the query
+// tiles (knn_3) on it instead, which balances skewed per-task cost.
+// Distance computations, heap updates and per-query latency (knn_1) are
+// reported to the MetricsRegistry. The knn_2 heaps come from the calling
+// thread's arena.
 
 template<class C, typename T1, typename T2>
 void knn_1 (const T1 * x, // query_data
@@ -21,13 +33,21 @@ void knn_1 (const T1 * x, // query_data
             int64_t k,
             typename C::T * value,  //dis
             typename C::TI * labels,  //ids
-            Computer<T1, T2, typename C::T> comptuer  //dis metric
+            Computer<T1, T2, typename C::T> comptuer,  //dis metric
+            WorkStealingPool* pool = nullptr
             )
 {
     std::cout << "do knn_1 with nx = " << nx << ", ny = " << ny
               << ", k = " << k << std::endl;
-#pragma omp parallel for
-    for (int64_t i = 0; i < nx; i++) {
+    // looked up once, building the name keys would allocate on every call
+    static Counter& heap_ops = MetricsRegistry::instance().counter(METRIC_HEAP_OPERATIONS);
+    static Counter& dis_cnt = MetricsRegistry::instance().counter(METRIC_DISTANCE_COMPUTATIONS);
+    static Histogram& latency = MetricsRegistry::instance().histogram(METRIC_QUERY_LATENCY_NS);
+    dis_cnt.add(nx * ny);
+
+    auto search_one = [&](int64_t i) {
+        ScopedLatency timer(latency);
+        int64_t swaps = 0;
         auto *x_i = x + i * dim;
         auto *y_j = y;
 
@@ -40,11 +60,22 @@ void knn_1 (const T1 * x, // query_data
             auto disij = comptuer (x_i, y_j, dim);
             if (C::cmp(val_[0], disij)) {
                 heap_swap_top<C>(k, val_, ids_, disij, j);
+                swaps++;
             }
             y_j += dim;
         }
 
         heap_reorder<C> (k, val_, ids_);
+        heap_ops.add(swaps);
+    };
+
+    if (pool != nullptr) {
+        pool->parallel_for(nx, [&](int64_t i, int) { search_one(i); });
+        return;
+    }
+#pragma omp parallel for
+    for (int64_t i = 0; i < nx; i++) {
+        search_one(i);
     }
 }
 
@@ -55,13 +86,18 @@ void knn_2 (const T1 * x, // query
             int64_t k,
             typename C::T * value,
             typename C::TI * labels,
-            Computer<T1, T2, typename C::T> comptuer)
+            Computer<T1, T2, typename C::T> comptuer,
+            WorkStealingPool* pool = nullptr)
 {
     using DIS_TYPE = typename C::T;
     using ID_TYPE = typename C::TI;
 
-    int64_t thread_max_num = omp_get_max_threads();
+    int64_t thread_max_num = pool != nullptr ? pool->num_threads() : omp_get_max_threads();
     int64_t l3_size = get_L3_Size();
+    // looked up once, building the name keys would allocate on every call
+    static Counter& heap_ops = MetricsRegistry::instance().counter(METRIC_HEAP_OPERATIONS);
+    static Counter& dis_cnt = MetricsRegistry::instance().counter(METRIC_DISTANCE_COMPUTATIONS);
+    dis_cnt.add(nx * ny);
 
     int64_t block_x = std::min(
         int64_t(l3_size / (dim * sizeof(T1) + thread_max_num * k * (sizeof(DIS_TYPE) + sizeof(ID_TYPE)))),
@@ -71,8 +107,9 @@ void knn_2 (const T1 * x, // query
     }
 
     int64_t all_heap_size = block_x * k * thread_max_num;
-    DIS_TYPE* value_global = new DIS_TYPE[all_heap_size];
-    ID_TYPE* labels_global = new ID_TYPE[all_heap_size];
+    ArenaScope scratch;
+    DIS_TYPE* value_global = scratch.alloc<DIS_TYPE>(all_heap_size);
+    ID_TYPE* labels_global = scratch.alloc<ID_TYPE>(all_heap_size);
 
     for (int64_t x_from = 0, x_to; x_from < nx; x_from = x_to) {
         x_to = std::min(nx, x_from + block_x);
@@ -82,20 +119,30 @@ void knn_2 (const T1 * x, // query
         // init heap
         heap_heapify<C>(all_heap_size, value_global, labels_global);
 
-#pragma omp parallel for schedule(static)
-        for (int j = 0; j < ny; j++) {
-            int64_t thread_no = omp_get_thread_num();
+        auto scan_one = [&](int64_t j, int64_t thread_no) {
             auto* y_j = y + j * dim;
             auto* x_i = x + x_from * dim;
+            int64_t swaps = 0;
             for (int64_t i = 0; i < size; i++) {
                 DIS_TYPE disij = comptuer (x_i, y_j, dim);
                 DIS_TYPE* val_ = value_global + thread_no * thread_heap_size + i * k;
                 ID_TYPE* ids_ = labels_global + thread_no * thread_heap_size + i * k;
                 if (C::cmp(val_[0], disij)) {
                     heap_swap_top<C> (k, val_, ids_, disij, j);
+                    swaps++;
                 }
                 x_i += dim;
             }
+            heap_ops.add(swaps);
+        };
+
+        if (pool != nullptr) {
+            pool->parallel_for(ny, [&](int64_t j, int t) { scan_one(j, t); }, 64);
+        } else {
+#pragma omp parallel for schedule(static)
+            for (int j = 0; j < ny; j++) {
+                scan_one(j, omp_get_thread_num());
+            }
         }
 
         // merge heap
@@ -124,8 +171,151 @@ void knn_2 (const T1 * x, // query
         memcpy(value + x_from * k, value_global, thread_heap_size * sizeof(DIS_TYPE));
         memcpy(labels + x_from * k, labels_global, thread_heap_size * sizeof(ID_TYPE));
     }
+}
+
+// Tiles of knn_3. A task owns query_tile queries, their vectors and heaps
+// stay in one half of the L2 while the base is scanned in tiles of
+// base_tile rows that fill the other half, so every base tile comes from
+// memory once per query tile instead of once per query. Within a tile
+// query_block queries are computed against one base row at a time, the row
+// is loaded once into L1 for all of them; the block and the row fill at most
+// half of the L1, up to MAX_QUERY_BLOCK queries. The sizes follow the cache
+// sizes detected at the first call; fewer queries per tile are taken when
+// the queries would not give every thread a tile.
+struct KnnTiling {
+    static constexpr int64_t MAX_QUERY_BLOCK = 8;
+    int64_t query_block;
+    int64_t query_tile;
+    int64_t base_tile;
+};
+
+inline KnnTiling knn_tiling(int64_t nx, int64_t ny, int64_t query_bytes, int64_t base_bytes,
+                            int64_t heap_bytes, int64_t threads) {
+    const int64_t half_l1 = get_L1_Size() / 2;
+    const int64_t half_l2 = get_L2_Size() / 2;
+    KnnTiling t;
+    t.query_block = std::max<int64_t>(1, (half_l1 - base_bytes) / query_bytes);
+    t.query_block = std::min(t.query_block, KnnTiling::MAX_QUERY_BLOCK);
+    t.base_tile = std::max<int64_t>(t.query_block, half_l2 / base_bytes);
+    t.base_tile = std::min(t.base_tile, std::max<int64_t>(ny, 1));
+    t.query_tile = std::max<int64_t>(t.query_block, half_l2 / (query_bytes + heap_bytes));
+    t.query_tile = std::min(t.query_tile, std::max<int64_t>(1, (nx + threads - 1) / threads));
+    return t;
+}
+
+template<class C, typename T1, typename T2>
+void knn_3 (const T1 * x, // query
+            const T2 * y, // base
+            int64_t nx, int64_t ny, int64_t dim,
+            int64_t k,
+            typename C::T * value,
+            typename C::TI * labels,
+            Computer<T1, T2, typename C::T> comptuer,
+            WorkStealingPool* pool = nullptr)
+{
+    using DIS_TYPE = typename C::T;
+    const int64_t threads = pool != nullptr ? pool->num_threads() : omp_get_max_threads();
+    const KnnTiling tiling = knn_tiling(nx, ny, dim * sizeof(T1), dim * sizeof(T2),
+                                        k * (sizeof(DIS_TYPE) + sizeof(typename C::TI)), threads);
+    const int64_t QB = tiling.query_block;
+    std::cout << "do knn_3 with nx = " << nx << ", ny = " << ny << ", k = " << k
+              << ", query block = " << QB << ", query tile = " << tiling.query_tile
+              << ", base tile = " << tiling.base_tile << std::endl;
+    static Counter& heap_ops = MetricsRegistry::instance().counter(METRIC_HEAP_OPERATIONS);
+    static Counter& dis_cnt = MetricsRegistry::instance().counter(METRIC_DISTANCE_COMPUTATIONS);
+    dis_cnt.add(nx * ny);
+    // plain L2 goes through the 4 x 1 register-blocked kernel, 4 queries of a
+    // block per call, instead of one computer call per pair
+    using L2Fn = DIS_TYPE (*)(const T1*, const T2*, size_t);
+    const L2Fn* fn = comptuer.template target<L2Fn>();
+    const bool blocked = L2Block4<T1, T2, DIS_TYPE>::enabled && fn != nullptr &&
+                         *fn == &L2sqr<const T1, const T2, DIS_TYPE>;
+
+    auto search_tile = [&](int64_t tile) {
+        const int64_t q_from = tile * tiling.query_tile;
+        const int64_t q_to = std::min(nx, q_from + tiling.query_tile);
+        for (int64_t i = q_from; i < q_to; i++) heap_heapify<C>(k, value + i * k, labels + i * k);
+
+        int64_t swaps = 0;
+        for (int64_t y_from = 0; y_from < ny; y_from += tiling.base_tile) {
+            const int64_t y_to = std::min(ny, y_from + tiling.base_tile);
+            for (int64_t i0 = q_from; i0 < q_to; i0 += QB) {
+                const int64_t nb = std::min(QB, q_to - i0);
+                const T1* x_i = x + i0 * dim;
+                DIS_TYPE* val_ = value + i0 * k;
+                auto* ids_ = labels + i0 * k;
+                for (int64_t j = y_from; j < y_to; j++) {
+                    const T2* y_j = y + j * dim;
+                    DIS_TYPE dis[KnnTiling::MAX_QUERY_BLOCK];
+                    int64_t b = 0;
+                    if (blocked) {
+                        for (; b + 4 <= nb; b += 4) L2Block4<T1, T2, DIS_TYPE>::compute(x_i + b * dim, y_j, dim, dis + b);
+                    }
+                    for (; b < nb; b++) dis[b] = comptuer(x_i + b * dim, y_j, dim);
+                    for (int64_t b = 0; b < nb; b++) {
+                        if (C::cmp(val_[b * k], dis[b])) {
+                            heap_swap_top<C>(k, val_ + b * k, ids_ + b * k, dis[b], j);
+                            swaps++;
+                        }
+                    }
+                }
+            }
+        }
+
+        for (int64_t i = q_from; i < q_to; i++) heap_reorder<C>(k, value + i * k, labels + i * k);
+        heap_ops.add(swaps);
+    };
+
+    const int64_t ntiles = (nx + tiling.query_tile - 1) / tiling.query_tile;
+    if (pool != nullptr) {
+        pool->parallel_for(ntiles, [&](int64_t tile, int) { search_tile(tile); });
+        return;
+    }
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t tile = 0; tile < ntiles; tile++) {
+        search_tile(tile);
+    }
+}
+
+// one of the variants above
+template<class C, typename T1, typename T2>
+void knn(KnnVariant variant, const T1* x, const T2* y, int64_t nx, int64_t ny, int64_t dim, int64_t k,
+         typename C::T* value, typename C::TI* labels,
+         Computer<T1, T2, typename C::T> computer, WorkStealingPool* pool = nullptr) {
+    switch (variant) {
+        case KnnVariant::BASE_SCAN:
+            knn_2<C, T1, T2>(x, y, nx, ny, dim, k, value, labels, computer, pool);
+            break;
+        case KnnVariant::TILED:
+            knn_3<C, T1, T2>(x, y, nx, ny, dim, k, value, labels, computer, pool);
+            break;
+        default:
+            knn_1<C, T1, T2>(x, y, nx, ny, dim, k, value, labels, computer, pool);
+            break;
+    }
+}
 
-    delete[] value_global;
-    delete[] labels_global;
+// the same scans writing into a ResultSet, resized to nx x k
+template<class C, typename T1, typename T2>
+void knn_1(const T1* x, const T2* y, int64_t nx, int64_t ny, int64_t dim, int64_t k,
+           ResultSet<typename C::T, typename C::TI>& result,
+           Computer<T1, T2, typename C::T> computer, WorkStealingPool* pool = nullptr) {
+    result.resize(nx, k);
+    knn_1<C, T1, T2>(x, y, nx, ny, dim, k, result.dis.data(), result.ids.data(), computer, pool);
 }
 
+template<class C, typename T1, typename T2>
+void knn_2(const T1* x, const T2* y, int64_t nx, int64_t ny, int64_t dim, int64_t k,
+           ResultSet<typename C::T, typename C::TI>& result,
+           Computer<T1, T2, typename C::T> computer, WorkStealingPool* pool = nullptr) {
+    result.resize(nx, k);
+    knn_2<C, T1, T2>(x, y, nx, ny, dim, k, result.dis.data(), result.ids.data(), computer, pool);
+}
+
+template<class C, typename T1, typename T2>
+void knn_3(const T1* x, const T2* y, int64_t nx, int64_t ny, int64_t dim, int64_t k,
+           ResultSet<typename C::T, typename C::TI>& result,
+           Computer<T1, T2, typename C::T> computer, WorkStealingPool* pool = nullptr) {
+    result.resize(nx, k);
+    knn_3<C, T1, T2>(x, y, nx, ny, dim, k, result.dis.data(), result.ids.data(), computer, pool);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <immintrin.h>
+
+// IEEE half precision storage type. Vectors are stored as float16 and
+// converted to float with F16C on load, all arithmetic is in float;
+// DataType::FLOAT16 files hold float16 elements.
+struct float16 {
+    uint16_t bits;
+
+    float16() = default;
+    float16(float f) : bits(_cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT)) {}
+    operator float() const { return _cvtsh_ss(bits); }
+};
+static_assert(sizeof(float16) == 2, "float16 is stored in 2 bytes");
+
+// 8 float16 to float
+inline __m256 load_fp16x8(const float16* p) {
+    return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)p));
+}
+
+inline void fp16_to_float(const float16* src, float* dst, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_ps(dst + i, load_fp16x8(src + i));
+    for (; i < n; i++) dst[i] = src[i];
+}
+
+inline void float_to_fp16(const float* src, float16* dst, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*)(dst + i), h);
+    }
+    for (; i < n; i++) dst[i] = src[i];
+}
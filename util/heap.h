@@ -147,7 +147,7 @@ size_t heap_reorder (size_t k, typename C::T * bh_val, typename C::TI * bh_ids)
         heap_pop<C> (k-i, bh_val, bh_ids);
         bh_val[k-ii-1] = val;
         bh_ids[k-ii-1] = id;
-        if (id != -1) ii++;
+        if (id != (typename C::TI)-1) ii++;
     }
     /* Count the number of elements which are effectively returned */
     size_t nel = ii;
@@ -0,0 +1,436 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "constants.h"
+#include "distance.h"
+#include "heap.h"
+
+// HNSW graph over the centroid matrix, used for nprobe selection when the
+// number of leaf centroids makes the brute-force scan of knn_1 too slow.
+// The graph only stores links, the centroid vectors are referenced from
+// the caller's buffer (the centroid file loaded in memory).
+//
+// file layout of GLOBAL + HNSW + INDEX + BIN:
+//   uint32 n, uint32 dim, uint64 checksum of the centroids (centroid_checksum)
+//   uint32 M, int32 max_level, uint32 entry
+//   int32 level[n]
+//   uint32 level0_links[n][2M + 1]           (count, ids...)
+//   for each node with level > 0: uint32 links[level][M + 1]
+
+inline std::string hnsw_index_file(const std::string& index_path) {
+    return index_path + GLOBAL + HNSW + INDEX + BIN;
+}
+
+// FNV-1a over the bytes of the centroid matrix, tells a graph of another
+// centroid file of the same shape apart
+inline uint64_t centroid_checksum(const float* centroids, int64_t n, int64_t dim) {
+    const unsigned char* p = (const unsigned char*)centroids;
+    uint64_t h = 1469598103934665603ull;
+    for (uint64_t i = 0; i < (uint64_t)n * dim * sizeof(float); i++) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+class CentroidHNSW {
+ public:
+    explicit CentroidHNSW(uint32_t M = 16, uint32_t ef_construction = 200, int64_t seed = 100)
+        : M_(M), max_m0_(2 * M), ef_construction_(ef_construction), seed_(seed) {}
+
+    int64_t size() const { return n_; }
+    int64_t dimension() const { return dim_; }
+
+    void build(const float* centroids, int64_t n, int64_t dim) {
+        data_ = centroids;
+        n_ = n;
+        dim_ = dim;
+        levels_.assign(n, 0);
+        links0_.assign(n * (max_m0_ + 1), 0);
+        upper_links_.assign(n, std::vector<uint32_t>());
+        node_locks_ = std::vector<std::mutex>(n);
+
+        std::mt19937_64 gen(seed_);
+        std::uniform_real_distribution<double> u(0.0, 1.0);
+        const double mult = 1.0 / log(1.0 * M_);
+        for (int64_t i = 0; i < n; i++) {
+            levels_[i] = (int)(-log(std::max(u(gen), 1e-12)) * mult);
+            if (levels_[i] > 0) {
+                upper_links_[i].assign(levels_[i] * (M_ + 1), 0);
+            }
+        }
+        if (n == 0) return;
+
+        entry_ = 0;
+        max_level_ = levels_[0];
+#pragma omp parallel for schedule(dynamic, 64)
+        for (int64_t i = 1; i < n; i++) {
+            insert(i);
+        }
+        std::cout << "build hnsw over " << n << " centroids, max level = " << max_level_
+                  << ", M = " << M_ << ", ef_construction = " << ef_construction_ << std::endl;
+    }
+
+    // k nearest centroids of x, sorted by ascending distance
+    template<typename T1>
+    void search(const T1* x, int64_t k, int64_t ef, float* dis, uint32_t* ids) const {
+        using C = CMax<float, uint32_t>;
+        heap_heapify<C>(k, dis, ids);
+        if (n_ == 0) return;
+        auto dist = [&](uint32_t id) {
+            return L2sqr<const T1, const float, float>(x, data_ + (int64_t)id * dim_, dim_);
+        };
+
+        uint32_t cur = entry_;
+        float cur_dis = dist(cur);
+        for (int lev = max_level_; lev > 0; lev--) {
+            greedy_step(cur, cur_dis, lev, dist);
+        }
+        auto top = search_layer(cur, cur_dis, std::max(ef, k), 0, dist);
+        while (!top.empty()) {
+            if (C::cmp(dis[0], top.top().first)) {
+                heap_swap_top<C>(k, dis, ids, top.top().first, top.top().second);
+            }
+            top.pop();
+        }
+        heap_reorder<C>(k, dis, ids);
+    }
+
+    void save(const std::string& file_name) const {
+        std::ofstream writer(file_name, std::ios::binary);
+        uint32_t n = n_, dim = dim_;
+        uint64_t checksum = centroid_checksum(data_, n_, dim_);
+        writer.write((char*)&n, sizeof(uint32_t));
+        writer.write((char*)&dim, sizeof(uint32_t));
+        writer.write((char*)&checksum, sizeof(uint64_t));
+        writer.write((char*)&M_, sizeof(uint32_t));
+        writer.write((char*)&max_level_, sizeof(int32_t));
+        writer.write((char*)&entry_, sizeof(uint32_t));
+        writer.write((char*)levels_.data(), n_ * sizeof(int32_t));
+        writer.write((char*)links0_.data(), links0_.size() * sizeof(uint32_t));
+        for (int64_t i = 0; i < n_; i++) {
+            if (levels_[i] > 0) {
+                writer.write((char*)upper_links_[i].data(), upper_links_[i].size() * sizeof(uint32_t));
+            }
+        }
+        writer.close();
+        std::cout << "write hnsw index to " << file_name << ", n = " << n_ << ", dim = " << dim_ << std::endl;
+    }
+
+    // centroids (n, dim) must be the matrix the graph was built on; false
+    // and nothing loaded when the file header has another n, dim or
+    // centroid checksum
+    bool load(const std::string& file_name, const float* centroids, int64_t n_expect, int64_t dim_expect) {
+        std::ifstream reader(file_name, std::ios::binary);
+        uint32_t n = 0, dim = 0;
+        reader.read((char*)&n, sizeof(uint32_t));
+        reader.read((char*)&dim, sizeof(uint32_t));
+        if (!reader || n != n_expect || dim != dim_expect) {
+            std::cerr << file_name << " has n = " << n << ", dim = " << dim << ", the centroids have n = "
+                      << n_expect << ", dim = " << dim_expect << std::endl;
+            return false;
+        }
+        uint64_t checksum = 0;
+        reader.read((char*)&checksum, sizeof(uint64_t));
+        if (!reader || checksum != centroid_checksum(centroids, n, dim)) {
+            std::cerr << file_name << " was built on other centroids of the same shape" << std::endl;
+            return false;
+        }
+        reader.read((char*)&M_, sizeof(uint32_t));
+        reader.read((char*)&max_level_, sizeof(int32_t));
+        reader.read((char*)&entry_, sizeof(uint32_t));
+        n_ = n;
+        dim_ = dim;
+        max_m0_ = 2 * M_;
+        data_ = centroids;
+        levels_.resize(n_);
+        reader.read((char*)levels_.data(), n_ * sizeof(int32_t));
+        links0_.resize(n_ * (max_m0_ + 1));
+        reader.read((char*)links0_.data(), links0_.size() * sizeof(uint32_t));
+        upper_links_.assign(n_, std::vector<uint32_t>());
+        for (int64_t i = 0; i < n_; i++) {
+            if (levels_[i] > 0) {
+                upper_links_[i].resize(levels_[i] * (M_ + 1));
+                reader.read((char*)upper_links_[i].data(), upper_links_[i].size() * sizeof(uint32_t));
+            }
+        }
+        reader.close();
+        std::cout << "read hnsw index from " << file_name << ", n = " << n_ << ", dim = " << dim_ << std::endl;
+        return true;
+    }
+
+ private:
+    using DisId = std::pair<float, uint32_t>;
+    // max-heap on distance: the farthest result is on top
+    using ResultQueue = std::priority_queue<DisId>;
+    // min-heap on distance: the closest candidate is on top
+    using CandidateQueue = std::priority_queue<DisId, std::vector<DisId>, std::greater<DisId>>;
+
+    uint32_t* links(uint32_t id, int lev) {
+        return lev == 0 ? links0_.data() + (int64_t)id * (max_m0_ + 1)
+                        : upper_links_[id].data() + (lev - 1) * (M_ + 1);
+    }
+
+    const uint32_t* links(uint32_t id, int lev) const {
+        return lev == 0 ? links0_.data() + (int64_t)id * (max_m0_ + 1)
+                        : upper_links_[id].data() + (lev - 1) * (M_ + 1);
+    }
+
+    float centroid_dis(uint32_t a, uint32_t b) const {
+        return L2sqr<const float, const float, float>(data_ + (int64_t)a * dim_, data_ + (int64_t)b * dim_, dim_);
+    }
+
+    template<typename DIS>
+    void greedy_step(uint32_t& cur, float& cur_dis, int lev, DIS& dist) const {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            const uint32_t* l = links(cur, lev);
+            for (uint32_t j = 1; j <= l[0]; j++) {
+                float d = dist(l[j]);
+                if (d < cur_dis) {
+                    cur_dis = d;
+                    cur = l[j];
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    template<typename DIS>
+    ResultQueue search_layer(uint32_t ep, float ep_dis, int64_t ef, int lev, DIS& dist) const {
+        thread_local std::vector<uint32_t> visited;
+        thread_local uint32_t visited_tag = 0;
+        if ((int64_t)visited.size() < n_) {
+            visited.assign(n_, 0);
+            visited_tag = 0;
+        }
+        if (++visited_tag == 0) {
+            std::fill(visited.begin(), visited.end(), 0);
+            visited_tag = 1;
+        }
+
+        ResultQueue top;
+        CandidateQueue cand;
+        top.emplace(ep_dis, ep);
+        cand.emplace(ep_dis, ep);
+        visited[ep] = visited_tag;
+        while (!cand.empty()) {
+            auto c = cand.top();
+            if (c.first > top.top().first && (int64_t)top.size() >= ef) break;
+            cand.pop();
+            const uint32_t* l = links(c.second, lev);
+            for (uint32_t j = 1; j <= l[0]; j++) {
+                uint32_t nb = l[j];
+                if (visited[nb] == visited_tag) continue;
+                visited[nb] = visited_tag;
+                float d = dist(nb);
+                if ((int64_t)top.size() < ef || d < top.top().first) {
+                    cand.emplace(d, nb);
+                    top.emplace(d, nb);
+                    if ((int64_t)top.size() > ef) top.pop();
+                }
+            }
+        }
+        return top;
+    }
+
+    // keep at most m neighbors which are closer to the base than to each other
+    void select_neighbors(ResultQueue& top, uint32_t m, std::vector<DisId>& out) const {
+        std::vector<DisId> cands;
+        while (!top.empty()) {
+            cands.push_back(top.top());
+            top.pop();
+        }
+        std::reverse(cands.begin(), cands.end());
+        out.clear();
+        for (auto& c : cands) {
+            if (out.size() >= m) break;
+            bool good = true;
+            for (auto& o : out) {
+                if (centroid_dis(c.second, o.second) < c.first) {
+                    good = false;
+                    break;
+                }
+            }
+            if (good) out.push_back(c);
+        }
+    }
+
+    void insert(uint32_t id) {
+        const int level = levels_[id];
+        std::unique_lock<std::mutex> global_lk(global_lock_, std::defer_lock);
+        int max_level;
+        uint32_t cur;
+        {
+            std::lock_guard<std::mutex> lk(global_lock_);
+            max_level = max_level_;
+            cur = entry_;
+        }
+        if (level > max_level) {
+            // another insert may have raised the top level meanwhile
+            global_lk.lock();
+            max_level = max_level_;
+            cur = entry_;
+            if (level <= max_level) global_lk.unlock();
+        }
+
+        auto dist = [&](uint32_t o) { return centroid_dis(id, o); };
+        float cur_dis = dist(cur);
+        for (int lev = max_level; lev > level; lev--) {
+            locked_greedy_step(cur, cur_dis, lev, dist);
+        }
+
+        std::vector<DisId> selected;
+        for (int lev = std::min(level, max_level); lev >= 0; lev--) {
+            ResultQueue top;
+            {
+                top = locked_search_layer(cur, cur_dis, ef_construction_, lev, dist);
+            }
+            uint32_t m = lev == 0 ? max_m0_ : M_;
+            select_neighbors(top, M_, selected);
+            {
+                std::lock_guard<std::mutex> lk(node_locks_[id]);
+                uint32_t* l = links(id, lev);
+                l[0] = selected.size();
+                for (size_t j = 0; j < selected.size(); j++) l[j + 1] = selected[j].second;
+            }
+            for (auto& s : selected) {
+                std::lock_guard<std::mutex> lk(node_locks_[s.second]);
+                uint32_t* l = links(s.second, lev);
+                if (l[0] < m) {
+                    l[++l[0]] = id;
+                    continue;
+                }
+                // full: re-select among the old neighbors plus the new one
+                ResultQueue cands;
+                cands.emplace(s.first, id);
+                for (uint32_t j = 1; j <= l[0]; j++) {
+                    cands.emplace(centroid_dis(s.second, l[j]), l[j]);
+                }
+                std::vector<DisId> kept;
+                select_neighbors(cands, m, kept);
+                l[0] = kept.size();
+                for (size_t j = 0; j < kept.size(); j++) l[j + 1] = kept[j].second;
+            }
+            if (!selected.empty()) {
+                cur = selected[0].second;
+                cur_dis = selected[0].first;
+            }
+        }
+
+        if (global_lk.owns_lock()) {
+            max_level_ = level;
+            entry_ = id;
+        }
+    }
+
+    template<typename DIS>
+    void locked_greedy_step(uint32_t& cur, float& cur_dis, int lev, DIS& dist) {
+        bool changed = true;
+        std::vector<uint32_t> nbs;
+        while (changed) {
+            changed = false;
+            {
+                std::lock_guard<std::mutex> lk(node_locks_[cur]);
+                const uint32_t* l = links(cur, lev);
+                nbs.assign(l + 1, l + 1 + l[0]);
+            }
+            for (auto nb : nbs) {
+                float d = dist(nb);
+                if (d < cur_dis) {
+                    cur_dis = d;
+                    cur = nb;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    template<typename DIS>
+    ResultQueue locked_search_layer(uint32_t ep, float ep_dis, int64_t ef, int lev, DIS& dist) {
+        thread_local std::vector<uint32_t> visited;
+        thread_local uint32_t visited_tag = 0;
+        if ((int64_t)visited.size() < n_) {
+            visited.assign(n_, 0);
+            visited_tag = 0;
+        }
+        if (++visited_tag == 0) {
+            std::fill(visited.begin(), visited.end(), 0);
+            visited_tag = 1;
+        }
+
+        ResultQueue top;
+        CandidateQueue cand;
+        std::vector<uint32_t> nbs;
+        top.emplace(ep_dis, ep);
+        cand.emplace(ep_dis, ep);
+        visited[ep] = visited_tag;
+        while (!cand.empty()) {
+            auto c = cand.top();
+            if (c.first > top.top().first && (int64_t)top.size() >= ef) break;
+            cand.pop();
+            {
+                std::lock_guard<std::mutex> lk(node_locks_[c.second]);
+                const uint32_t* l = links(c.second, lev);
+                nbs.assign(l + 1, l + 1 + l[0]);
+            }
+            for (auto nb : nbs) {
+                if (visited[nb] == visited_tag) continue;
+                visited[nb] = visited_tag;
+                float d = dist(nb);
+                if ((int64_t)top.size() < ef || d < top.top().first) {
+                    cand.emplace(d, nb);
+                    top.emplace(d, nb);
+                    if ((int64_t)top.size() > ef) top.pop();
+                }
+            }
+        }
+        return top;
+    }
+
+    uint32_t M_;
+    uint32_t max_m0_;
+    uint32_t ef_construction_;
+    int64_t seed_;
+
+    const float* data_ = nullptr;
+    int64_t n_ = 0;
+    int64_t dim_ = 0;
+    int32_t max_level_ = 0;
+    uint32_t entry_ = 0;
+    std::vector<int32_t> levels_;
+    std::vector<uint32_t> links0_;
+    std::vector<std::vector<uint32_t>> upper_links_;
+
+    std::mutex global_lock_;
+    std::vector<std::mutex> node_locks_;
+};
+
+// drop-in replacement of knn_1 for nprobe selection, value/labels are nx * k
+template<class C, typename T1>
+void hnsw_knn(const T1* x,
+              const CentroidHNSW& index,
+              int64_t nx,
+              int64_t k,
+              int64_t ef,
+              typename C::T* value,
+              typename C::TI* labels)
+{
+    std::cout << "do hnsw_knn with nx = " << nx << ", ny = " << index.size()
+              << ", k = " << k << ", ef = " << ef << std::endl;
+#pragma omp parallel for schedule(dynamic, 16)
+    for (int64_t i = 0; i < nx; i++) {
+        index.search(x + i * index.dimension(), k, ef, value + i * k, labels + i * k);
+    }
+}
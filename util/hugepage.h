@@ -0,0 +1,98 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <sys/mman.h>
+#include <utility>
+
+#include "defines.h"
+
+// Hugepage backed memory for matrices scanned by every query (centroids,
+// queries, samples): with 4 KB pages a 50 MB centroid matrix spans 12800
+// pages, far more than the dTLB holds, with 2 MB pages it spans 25.
+//
+// HUGETLB maps from the reserved hugetlbfs pool (vm.nr_hugepages), which is
+// usually empty, and falls back to THP. THP maps 2 MB aligned and advises
+// MADV_HUGEPAGE, which works when transparent_hugepage is "madvise" or
+// "always"; the kernel may still hand out 4 KB pages when it cannot find
+// contiguous memory. None maps with the default policy. The mode actually
+// obtained is kept as the backing of the region.
+
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+struct HugeRegion {
+    char* base = nullptr;
+    size_t size = 0;
+    HugePageMode backing = HugePageMode::None;
+};
+
+inline const char* hugepage_mode_name(HugePageMode mode) {
+    switch (mode) {
+        case HugePageMode::THP: return "thp";
+        case HugePageMode::HUGETLB: return "hugetlb";
+        default: return "none";
+    }
+}
+
+inline HugeRegion huge_map(size_t bytes, HugePageMode mode) {
+    bytes = std::max<size_t>(bytes, 1);
+    const size_t size = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    if (mode == HugePageMode::HUGETLB) {
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) return {(char*)p, size, HugePageMode::HUGETLB};
+        mode = HugePageMode::THP;
+    }
+    if (mode == HugePageMode::None) {
+        void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        assert(p != MAP_FAILED);
+        return {(char*)p, bytes, HugePageMode::None};
+    }
+    // over-map by one hugepage and trim to a 2 MB aligned range, so every
+    // 2 MB of it can be backed by a hugepage
+    const size_t mapped = size + HUGE_PAGE_SIZE;
+    char* p = (char*)mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(p != MAP_FAILED);
+    char* base = (char*)(((uintptr_t)p + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+    if (base > p) munmap(p, base - p);
+    if (base + size < p + mapped) munmap(base + size, p + mapped - (base + size));
+    bool advised = madvise(base, size, MADV_HUGEPAGE) == 0;
+    return {base, size, advised ? HugePageMode::THP : HugePageMode::None};
+}
+
+inline void huge_unmap(const HugeRegion& region) {
+    if (region.base != nullptr) munmap(region.base, region.size);
+}
+
+// n zero-initialized T in a HugeRegion, move only
+template<typename T>
+class HugeArray {
+ public:
+    HugeArray() = default;
+    HugeArray(size_t n, HugePageMode mode) : n_(n), region_(huge_map(n * sizeof(T), mode)) {}
+    ~HugeArray() { huge_unmap(region_); }
+
+    HugeArray(HugeArray&& other) : n_(other.n_), region_(other.region_) {
+        other.n_ = 0;
+        other.region_ = HugeRegion();
+    }
+    HugeArray& operator=(HugeArray&& other) {
+        std::swap(n_, other.n_);
+        std::swap(region_, other.region_);
+        return *this;
+    }
+    HugeArray(const HugeArray&) = delete;
+
+    T* data() { return (T*)region_.base; }
+    const T* data() const { return (const T*)region_.base; }
+    size_t size() const { return n_; }
+    T& operator[](size_t i) { return data()[i]; }
+    const T& operator[](size_t i) const { return data()[i]; }
+
+    HugePageMode backing() const { return region_.backing; }
+
+ private:
+    size_t n_ = 0;
+    HugeRegion region_;
+};
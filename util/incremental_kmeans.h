@@ -0,0 +1,205 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "constants.h"
+#include "flat.h"
+#include "kmeans.h"
+#include "read_file.h"
+#include "utils.h"
+
+// Incremental index refresh: new vectors are streamed in batches, assigned
+// to their nearest centroid, folded into it with a mini-batch k-means step
+// (per-centroid learning rate 1 / count) and appended to the cluster files.
+// A cluster that grows past SPLIT_THRESHOLD is re-split with k-means, only
+// the split clusters are rewritten. Untouched clusters are never opened.
+//
+// index layout (all files carry the (n, dim) header):
+//   centroid_file                          float, K * dim
+//   CLUSTER + cid + RAWDATA + BIN          T, cluster vectors
+//   CLUSTER + cid + GLOBAL_IDS + BIN       uint32, (n, 1) global ids
+//   CLUSTER + cid + META + BIN             uint32, (nblocks, 1) rows per block,
+//                                          summing to n; every append adds one
+//                                          block, a split part is one block
+
+inline std::string cluster_file(const std::string& index_path, uint32_t cid, const char* file_type) {
+    return index_path + CLUSTER + std::to_string(cid) + file_type + BIN;
+}
+
+struct IncrementalStats {
+    int64_t new_vectors = 0;
+    int64_t touched_clusters = 0;
+    int64_t split_clusters = 0;
+    int64_t new_clusters = 0;
+    uint64_t bytes_written = 0;
+};
+
+// append n rows to a bin file and bump the row count in its header
+template<typename T>
+inline void append_bin_file(const std::string& file_name, const T* data, uint32_t n, uint32_t dim) {
+    std::fstream f(file_name, std::ios::binary | std::ios::in | std::ios::out);
+    if (!f.is_open()) {
+        write_bin_file<T>(file_name, const_cast<T*>(data), n, dim);
+        return;
+    }
+    uint32_t old_n, old_dim;
+    f.read((char*)&old_n, sizeof(uint32_t));
+    f.read((char*)&old_dim, sizeof(uint32_t));
+    assert(old_dim == dim);
+    f.seekp(2 * sizeof(uint32_t) + (uint64_t)old_n * dim * sizeof(T));
+    f.write((char*)data, (uint64_t)n * dim * sizeof(T));
+    old_n += n;
+    f.seekp(0);
+    f.write((char*)&old_n, sizeof(uint32_t));
+    f.close();
+}
+
+// split cluster cid into ceil(size / SPLIT_THRESHOLD) parts, part 0 keeps
+// cid and the others are appended after the last centroid
+template<typename T>
+void resplit_cluster(const std::string& index_path, uint32_t cid,
+                     std::vector<float>& centroids, uint32_t dim,
+                     IncrementalStats& stats) {
+    uint32_t n, d, nid, did;
+    T* data = nullptr;
+    uint32_t* ids = nullptr;
+    read_bin_file<T>(cluster_file(index_path, cid, RAWDATA), data, n, d);
+    read_bin_file<uint32_t>(cluster_file(index_path, cid, GLOBAL_IDS), ids, nid, did);
+    std::unique_ptr<T[]> data_guard(data);
+    std::unique_ptr<uint32_t[]> ids_guard(ids);
+    assert(d == dim && nid == n);
+
+    const int64_t k = (n + SPLIT_THRESHOLD - 1) / SPLIT_THRESHOLD;
+    std::vector<float> sub_centroids(k * dim);
+    std::vector<uint32_t> assign(n);
+    kmeans_bounded<T>(data, n, dim, k, sub_centroids.data(), assign.data());
+
+    const uint32_t first_new = centroids.size() / dim;
+    for (int64_t p = 0; p < k; p++) {
+        std::vector<T> part_data;
+        std::vector<uint32_t> part_ids;
+        for (uint32_t i = 0; i < n; i++) {
+            if (assign[i] != p) continue;
+            part_data.insert(part_data.end(), data + (uint64_t)i * dim, data + (uint64_t)(i + 1) * dim);
+            part_ids.push_back(ids[i]);
+        }
+        uint32_t part_cid = p == 0 ? cid : first_new + p - 1;
+        if (p == 0) {
+            memcpy(centroids.data() + (uint64_t)cid * dim, sub_centroids.data(), dim * sizeof(float));
+        } else {
+            centroids.insert(centroids.end(), sub_centroids.begin() + p * dim, sub_centroids.begin() + (p + 1) * dim);
+            stats.new_clusters++;
+        }
+        write_bin_file<T>(cluster_file(index_path, part_cid, RAWDATA), part_data.data(), part_ids.size(), dim);
+        write_bin_file<uint32_t>(cluster_file(index_path, part_cid, GLOBAL_IDS), part_ids.data(), part_ids.size(), 1);
+        uint32_t part_rows = part_ids.size();
+        write_bin_file<uint32_t>(cluster_file(index_path, part_cid, META), &part_rows, 1, 1);
+        stats.bytes_written += part_data.size() * sizeof(T) + (part_ids.size() + 1) * sizeof(uint32_t);
+    }
+    stats.split_clusters++;
+}
+
+// stream data_file into the index under index_path, the new vectors get
+// global ids base_id, base_id + 1, ... The centroid file is rewritten last.
+template<typename T>
+IncrementalStats incremental_kmeans(const std::string& index_path,
+                                    const std::string& centroid_file,
+                                    const std::string& data_file,
+                                    uint32_t base_id,
+                                    int32_t batch_size = 100000) {
+    IncrementalStats stats;
+
+    uint32_t K, dim;
+    float* cen = nullptr;
+    read_bin_file<float>(centroid_file, cen, K, dim);
+    std::vector<float> centroids(cen, cen + (uint64_t)K * dim);
+    delete[] cen;
+
+    // cluster sizes come from the raw data headers, nothing else is read
+    std::vector<int64_t> counts(K), old_counts(K);
+    for (uint32_t c = 0; c < K; c++) {
+        std::ifstream reader(cluster_file(index_path, c, RAWDATA), std::ios::binary);
+        uint32_t n = 0;
+        if (reader.is_open()) reader.read((char*)&n, sizeof(uint32_t));
+        counts[c] = old_counts[c] = n;
+    }
+
+    int32_t nd, dd;
+    FILE* f = read_file_head(data_file.c_str(), &nd, &dd);
+    if (f == nullptr) return stats;
+    assert((uint32_t)dd == dim);
+
+    std::unique_ptr<T[]> batch(new T[(uint64_t)batch_size * dim]);
+    std::unique_ptr<float[]> dis(new float[batch_size]);
+    std::unique_ptr<uint32_t[]> assign(new uint32_t[batch_size]);
+    std::vector<std::vector<uint32_t>> members(K);
+    std::vector<bool> touched(K, false);
+    uint32_t next_id = base_id;
+
+    int32_t nb;
+    while ((nb = read_file_data<T>(f, batch_size, dim, batch.get())) > 0) {
+        knn_1<CMax<float, uint32_t>, T, float>(
+            batch.get(), centroids.data(), nb, K, dim, 1,
+            dis.get(), assign.get(), L2sqr<const T, const float, float>);
+
+        for (auto& m : members) m.clear();
+        for (int32_t i = 0; i < nb; i++) members[assign[i]].push_back(i);
+
+#pragma omp parallel for schedule(dynamic)
+        for (uint32_t c = 0; c < K; c++) {
+            if (members[c].empty()) continue;
+            // mini-batch step, each point moves the centroid by 1 / count
+            float* ctr = centroids.data() + (uint64_t)c * dim;
+            int64_t cnt = counts[c];
+            for (auto i : members[c]) {
+                const T* x = batch.get() + (uint64_t)i * dim;
+                float eta = 1.0f / (float)(++cnt);
+                for (uint32_t d = 0; d < dim; d++) ctr[d] += eta * ((float)x[d] - ctr[d]);
+            }
+            counts[c] = cnt;
+        }
+
+        // append each batch to the clusters it hit, nothing else is touched
+        for (uint32_t c = 0; c < K; c++) {
+            if (members[c].empty()) continue;
+            std::vector<T> rows((uint64_t)members[c].size() * dim);
+            std::vector<uint32_t> ids(members[c].size());
+            for (size_t j = 0; j < members[c].size(); j++) {
+                uint32_t i = members[c][j];
+                memcpy(rows.data() + j * dim, batch.get() + (uint64_t)i * dim, dim * sizeof(T));
+                ids[j] = next_id + i;
+            }
+            append_bin_file<T>(cluster_file(index_path, c, RAWDATA), rows.data(), ids.size(), dim);
+            append_bin_file<uint32_t>(cluster_file(index_path, c, GLOBAL_IDS), ids.data(), ids.size(), 1);
+            // the appended rows are one more block of the cluster
+            uint32_t block_rows = ids.size();
+            append_bin_file<uint32_t>(cluster_file(index_path, c, META), &block_rows, 1, 1);
+            stats.bytes_written += rows.size() * sizeof(T) + (ids.size() + 1) * sizeof(uint32_t);
+            touched[c] = true;
+        }
+        next_id += nb;
+        stats.new_vectors += nb;
+    }
+    fclose(f);
+
+    for (uint32_t c = 0; c < K; c++) {
+        if (!touched[c]) continue;
+        stats.touched_clusters++;
+        if (old_counts[c] <= SPLIT_THRESHOLD && counts[c] > SPLIT_THRESHOLD) {
+            resplit_cluster<T>(index_path, c, centroids, dim, stats);
+        }
+    }
+
+    uint32_t newK = centroids.size() / dim;
+    write_bin_file<float>(centroid_file, centroids.data(), newK, dim);
+    std::cout << "incremental kmeans: " << stats.new_vectors << " new vectors, "
+              << stats.touched_clusters << " touched clusters, "
+              << stats.split_clusters << " split into " << stats.new_clusters << " new clusters, "
+              << stats.bytes_written << " bytes written" << std::endl;
+    return stats;
+}
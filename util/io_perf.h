@@ -5,7 +5,9 @@
 #include <cstdlib>
 #include <fstream>
 #include <array>
+#include <chrono>
 #include <iostream>
+#include "metrics.h"
 // ----------------------------------------------------------------------------------------------------
 /**
  * A class parsing a line of file /proc/$PID/io
@@ -87,6 +89,13 @@ public:
 
     ~PID_IO_Counter() {
         const PID_IO post_iamge = PID_IO();
+        auto& registry = MetricsRegistry::instance();
+        registry.counter("pid_io_rchar").add(post_iamge.getRchar() - pre_iamge.getRchar());
+        registry.counter("pid_io_wchar").add(post_iamge.getWchar() - pre_iamge.getWchar());
+        registry.counter("pid_io_syscr").add(post_iamge.getSyscr() - pre_iamge.getSyscr());
+        registry.counter("pid_io_syscw").add(post_iamge.getSyscw() - pre_iamge.getSyscw());
+        registry.counter("pid_io_read_bytes").add(post_iamge.getReadBytes() - pre_iamge.getReadBytes());
+        registry.counter("pid_io_write_bytes").add(post_iamge.getWriteBytes() - pre_iamge.getWriteBytes());
         std::cout << "# rchar: " << post_iamge.getRchar() - pre_iamge.getRchar() << std::endl;
         std::cout << "# wchar: " << post_iamge.getWchar() - pre_iamge.getWchar() << std::endl;
         std::cout << "# syscr: " << post_iamge.getSyscr() - pre_iamge.getSyscr() << std::endl;
@@ -168,6 +177,18 @@ class DiskStat {
         __builtin_unreachable(); // Wrong device name.
     }
 
+    /**
+     * @return whether /proc/diskstats has a line for device_name
+     */
+    static bool has_device(const std::string& device_name) {
+        std::ifstream file("/proc/diskstats");
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.find(" " + device_name + " ") != std::string::npos) return true;
+        }
+        return false;
+    }
+
     /**
      * @param field_index
      * @return get a field
@@ -191,6 +212,7 @@ class DiskStat_Read_Counter {
  private:
     std::string device_name;
     DiskStat pre_iamge;
+    std::chrono::steady_clock::time_point start;
 
     int aqu_sz(const DiskStat& post_iamge) { return post_iamge[11] - pre_iamge[11]; }
 
@@ -203,12 +225,23 @@ class DiskStat_Read_Counter {
     }
 
 public:
-    DiskStat_Read_Counter() : pre_iamge(DiskStat::read_IO_DiskStat()) {}
+    DiskStat_Read_Counter() : DiskStat_Read_Counter("nvme0n1") {}
 
-    DiskStat_Read_Counter(std::string device_name) : device_name(device_name), pre_iamge(DiskStat::read_IO_DiskStat(device_name)) {}
+    DiskStat_Read_Counter(std::string device_name)
+        : device_name(device_name), pre_iamge(DiskStat::read_IO_DiskStat(device_name)),
+          start(std::chrono::steady_clock::now()) {}
 
     ~DiskStat_Read_Counter() {
-        DiskStat post_iamge = DiskStat::read_IO_DiskStat();
+        DiskStat post_iamge = DiskStat::read_IO_DiskStat(device_name);
+        auto& registry = MetricsRegistry::instance();
+        const std::string prefix = "disk_" + device_name + "_";
+        registry.counter(prefix + "read_completed").add(post_iamge[1] - pre_iamge[1]);
+        registry.counter(prefix + "read_merged").add(post_iamge[2] - pre_iamge[2]);
+        registry.counter(prefix + "sectors_read").add(post_iamge[3] - pre_iamge[3]);
+        registry.counter(prefix + "read_ms").add(post_iamge[4] - pre_iamge[4]);
+        registry.counter(prefix + "io_ms").add(post_iamge[10] - pre_iamge[10]);
+        registry.counter(prefix + "weighted_io_ms").add(post_iamge[11] - pre_iamge[11]);
+        std::cout << "# device: " << device_name << std::endl;
         std::cout << "# read completed: " << post_iamge[1] - pre_iamge[1] << std::endl;
         std::cout << "# read merged: " << post_iamge[2] - pre_iamge[2] << std::endl;
         std::cout << "# sectors read: " << post_iamge[3] - pre_iamge[3] << std::endl;
@@ -216,6 +249,9 @@ public:
         std::cout << "# of milliseconds spent doing I/Os: " << post_iamge[10] - pre_iamge[10] << std::endl;
         std::cout << "weighted # of milliseconds spent doing I/Os: " << post_iamge[11] - pre_iamge[11] << std::endl;
         std::cout << "r_wait: " << r_wait(post_iamge) << std::endl;
+        // share of the wall time the device had IOs in flight, like iostat %util
+        double wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "util: " << (wall_ms > 0 ? (post_iamge[10] - pre_iamge[10]) / wall_ms : 0) << std::endl;
     }
 };
 // ----------------------------------------------------------------------------------------------------
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "constants.h"
+#include "utils.h"
+
+// Compact binary trace of the blocks every query probes, the input of the
+// offline replay simulator (trace_replay.h). One fixed-size record per
+// probed block, records are grouped by query in probe order.
+//
+// file layout:
+//   IOTraceHeader
+//   IOTraceRecord * header.n_records
+
+constexpr static uint32_t IO_TRACE_MAGIC = 0x52544f49;  // "IOTR"
+constexpr static uint32_t IO_TRACE_VERSION = 1;
+
+struct IOTraceHeader {
+    uint32_t magic = IO_TRACE_MAGIC;
+    uint32_t version = IO_TRACE_VERSION;
+    uint64_t n_records = 0;
+};
+
+#pragma pack(push, 1)
+struct IOTraceRecord {
+    uint32_t query_id;
+    uint32_t cluster_id;
+    uint32_t block_id;      // gen_global_block_id(cluster_id, bucket)
+    uint32_t bytes;         // 0 if the block size is unknown
+    uint64_t timestamp_ns;  // query issue time, relative to the trace start
+};
+#pragma pack(pop)
+
+// buffered writer, the record count in the header is patched on close()
+class IOTraceWriter {
+ public:
+    explicit IOTraceWriter(const std::string& file_name, size_t buffer_records = 1 << 16)
+        : file_name_(file_name), buffer_records_(buffer_records) {
+        f_ = fopen(file_name.c_str(), "wb");
+        assert(f_ != nullptr);
+        IOTraceHeader header;
+        fwrite(&header, sizeof(header), 1, f_);
+        buffer_.reserve(buffer_records_);
+    }
+
+    ~IOTraceWriter() { close(); }
+
+    void append(uint32_t query_id, uint32_t cluster_id, uint32_t block_id,
+                uint32_t bytes, uint64_t timestamp_ns) {
+        buffer_.push_back({query_id, cluster_id, block_id, bytes, timestamp_ns});
+        if (buffer_.size() >= buffer_records_) flush();
+    }
+
+    void close() {
+        if (f_ == nullptr) return;
+        flush();
+        IOTraceHeader header;
+        header.n_records = n_records_;
+        fseek(f_, 0, SEEK_SET);
+        fwrite(&header, sizeof(header), 1, f_);
+        fclose(f_);
+        f_ = nullptr;
+        std::cout << "write io trace to " << file_name_ << ", records = " << n_records_ << std::endl;
+    }
+
+ private:
+    void flush() {
+        if (buffer_.empty()) return;
+        fwrite(buffer_.data(), sizeof(IOTraceRecord), buffer_.size(), f_);
+        n_records_ += buffer_.size();
+        buffer_.clear();
+    }
+
+    std::string file_name_;
+    FILE* f_ = nullptr;
+    size_t buffer_records_;
+    std::vector<IOTraceRecord> buffer_;
+    uint64_t n_records_ = 0;
+};
+
+inline bool read_io_trace(const std::string& file_name, std::vector<IOTraceRecord>& records) {
+    FILE* f = fopen(file_name.c_str(), "rb");
+    if (f == nullptr) {
+        fprintf(stderr, "could not open %s\n", file_name.c_str());
+        return false;
+    }
+    IOTraceHeader header;
+    if (fread(&header, sizeof(header), 1, f) != 1 || header.magic != IO_TRACE_MAGIC ||
+        header.version != IO_TRACE_VERSION) {
+        fprintf(stderr, "%s is not an io trace\n", file_name.c_str());
+        fclose(f);
+        return false;
+    }
+    records.resize(header.n_records);
+    size_t n = fread(records.data(), sizeof(IOTraceRecord), header.n_records, f);
+    fclose(f);
+    records.resize(n);
+    std::cout << "read io trace from " << file_name << ", records = " << n << std::endl;
+    return n == header.n_records;
+}
+
+// Trace the probes of nq queries, idx is the (nq, nprobe) coarse search
+// result. With the cluster metas every bucket of a probed cluster is one
+// block of meta[cid][bid] * row_bytes bytes, without them every probe is a
+// single block 0 of unknown size. Queries are spread evenly over span_ns,
+// the measured time of the batched coarse search.
+inline void trace_probes(IOTraceWriter& writer, const uint32_t* idx,
+                         uint32_t nq, int nprobe, uint64_t span_ns,
+                         const std::vector<std::vector<uint32_t>>& metas = {},
+                         uint64_t row_bytes = 0) {
+    for (uint32_t q = 0; q < nq; q++) {
+        uint64_t ts = nq > 0 ? span_ns * q / nq : 0;
+        for (int j = 0; j < nprobe; j++) {
+            uint32_t cid = idx[(uint64_t)q * nprobe + j];
+            if (cid >= metas.size()) {
+                writer.append(q, cid, gen_global_block_id(cid, 0), 0, ts);
+                continue;
+            }
+            for (uint32_t bid = 0; bid < metas[cid].size(); bid++) {
+                writer.append(q, cid, gen_global_block_id(cid, bid),
+                              (uint32_t)(metas[cid][bid] * row_bytes), ts);
+            }
+        }
+    }
+}
@@ -0,0 +1,518 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "constants.h"
+#include "defines.h"
+#include "distance.h"
+#include "flat.h"
+#include "utils.h"
+
+// Lloyd k-means on the flat knn kernels, used by the incremental index
+// refresh to re-split clusters, and a bound-accelerated variant for the K2
+// sub-problems: Hamerly (one lower bound per point) for small k and Yinyang
+// (one lower bound per centroid group) for large k. Both skip the distance
+// computations the triangle inequality proves useless.
+// Centroids are seeded by random sampling, k-means++ or k-means|| (see KmeansInit).
+
+struct KmeansStats {
+    int iterations = 0;       // Lloyd iterations run
+    double objective = 0;     // sum of squared distances after the last assignment
+    int64_t dis_cnt = 0;      // point-to-centroid distance computations
+};
+
+// recompute centroids from the assignment, empty clusters take half of the
+// largest cluster by copying its centroid with a small perturbation.
+// sum (k * dim) and cnt (k) are caller provided scratch.
+template<typename T>
+void update_centroids(const T* data, int64_t n, int64_t dim, int64_t k,
+                      const uint32_t* assign, float* centroids,
+                      double* sum, int64_t* cnt) {
+    std::fill(cnt, cnt + k, 0);
+    std::fill(sum, sum + k * dim, 0);
+    for (int64_t i = 0; i < n; i++) {
+        const T* x = data + i * dim;
+        double* s = sum + assign[i] * dim;
+        for (int64_t d = 0; d < dim; d++) s[d] += x[d];
+        cnt[assign[i]]++;
+    }
+    for (int64_t c = 0; c < k; c++) {
+        if (cnt[c] == 0) continue;
+        for (int64_t d = 0; d < dim; d++) {
+            centroids[c * dim + d] = (float)(sum[c * dim + d] / cnt[c]);
+        }
+    }
+    for (int64_t c = 0; c < k; c++) {
+        if (cnt[c] != 0) continue;
+        int64_t big = std::max_element(cnt, cnt + k) - cnt;
+        float* dst = centroids + c * dim;
+        float* src = centroids + big * dim;
+        for (int64_t d = 0; d < dim; d++) {
+            float eps = (d & 1) ? 1.0f / 1024 : -1.0f / 1024;
+            dst[d] = src[d] * (1 + eps);
+            src[d] = src[d] * (1 - eps);
+        }
+        cnt[c] = cnt[big] / 2;
+        cnt[big] -= cnt[c];
+    }
+}
+
+template<typename T>
+void update_centroids(const T* data, int64_t n, int64_t dim, int64_t k,
+                      const uint32_t* assign, float* centroids) {
+    std::vector<int64_t> cnt(k);
+    std::vector<double> sum(k * dim);
+    update_centroids<T>(data, n, dim, k, assign, centroids, sum.data(), cnt.data());
+}
+
+// uniform [0, 1) from (seed, a, b), gives the same draws for any thread count
+inline double hash_uniform(uint64_t seed, uint64_t a, uint64_t b) {
+    uint64_t z = seed + 0x9e3779b97f4a7c15ULL * (a + 1) + 0xbf58476d1ce4e5b9ULL * (b + 1);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z = z ^ (z >> 31);
+    return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// index i with probability w[i] / sum(w)
+inline int64_t sample_weighted(const double* w, int64_t n, double u) {
+    double total = 0;
+    for (int64_t i = 0; i < n; i++) total += w[i];
+    double r = u * total, acc = 0;
+    for (int64_t i = 0; i < n; i++) {
+        acc += w[i];
+        if (r < acc) return i;
+    }
+    return n - 1;
+}
+
+// k-means++ over n points with optional weights
+template<typename T>
+void kmeans_pp_init(const T* data, int64_t n, int64_t dim, int64_t k, float* centroids,
+                    int64_t seed = 1234, const double* weights = nullptr) {
+    std::vector<double> mind(n, std::numeric_limits<double>::max());
+    std::vector<double> prob(n);
+    for (int64_t i = 0; i < n; i++) prob[i] = weights ? weights[i] : 1.0;
+    int64_t pick = sample_weighted(prob.data(), n, hash_uniform(seed, 0, 0));
+    for (int64_t c = 0; c < k; c++) {
+        float* ctr = centroids + c * dim;
+        for (int64_t d = 0; d < dim; d++) ctr[d] = (float)data[pick * dim + d];
+        if (c + 1 == k) break;
+#pragma omp parallel for
+        for (int64_t i = 0; i < n; i++) {
+            double d = L2sqr<const T, const float, float>(data + i * dim, ctr, dim);
+            if (d < mind[i]) mind[i] = d;
+            prob[i] = (weights ? weights[i] : 1.0) * mind[i];
+        }
+        pick = sample_weighted(prob.data(), n, hash_uniform(seed, 0, c + 1));
+    }
+}
+
+// k-means|| (Bahmani et al.): `rounds` passes over the data, each keeping
+// every point with probability l * d(x)^2 / phi, then a weighted k-means++
+// over the candidates, weighted by how many points they are closest to.
+template<typename T>
+void kmeans_parallel_init(const T* data, int64_t n, int64_t dim, int64_t k, float* centroids,
+                          int64_t seed = 1234, int rounds = 5, double oversampling = 2.0) {
+    const double l = oversampling * k;
+    std::vector<float> cand;
+    std::vector<double> mind(n, std::numeric_limits<double>::max());
+    std::vector<uint32_t> nearest(n, 0);
+
+    auto add_candidate = [&](int64_t i) {
+        for (int64_t d = 0; d < dim; d++) cand.push_back((float)data[i * dim + d]);
+    };
+    // fold centroids [from, to) of cand into the nearest-candidate distances
+    auto update = [&](int64_t from, int64_t to) {
+        double phi = 0;
+#pragma omp parallel for reduction(+:phi)
+        for (int64_t i = 0; i < n; i++) {
+            const T* x = data + i * dim;
+            for (int64_t c = from; c < to; c++) {
+                double d = L2sqr<const T, const float, float>(x, cand.data() + c * dim, dim);
+                if (d < mind[i]) {
+                    mind[i] = d;
+                    nearest[i] = c;
+                }
+            }
+            phi += mind[i];
+        }
+        return phi;
+    };
+
+    add_candidate(std::min<int64_t>(n - 1, (int64_t)(hash_uniform(seed, 0, 0) * n)));
+    double phi = update(0, 1);
+    for (int r = 0; r < rounds && phi > 0; r++) {
+        int64_t from = cand.size() / dim;
+        std::vector<int64_t> picked;
+#pragma omp parallel
+        {
+            std::vector<int64_t> local;
+#pragma omp for nowait
+            for (int64_t i = 0; i < n; i++) {
+                if (hash_uniform(seed, r + 1, i) < l * mind[i] / phi) local.push_back(i);
+            }
+#pragma omp critical
+            picked.insert(picked.end(), local.begin(), local.end());
+        }
+        std::sort(picked.begin(), picked.end());
+        for (auto i : picked) add_candidate(i);
+        phi = update(from, cand.size() / dim);
+    }
+
+    int64_t ncand = cand.size() / dim;
+    if (ncand <= k) {
+        // too few candidates, top up with random points
+        memcpy(centroids, cand.data(), ncand * dim * sizeof(float));
+        for (int64_t c = ncand; c < k; c++) {
+            int64_t i = std::min<int64_t>(n - 1, (int64_t)(hash_uniform(seed, rounds + 1, c) * n));
+            for (int64_t d = 0; d < dim; d++) centroids[c * dim + d] = (float)data[i * dim + d];
+        }
+        return;
+    }
+    std::vector<double> w(ncand, 0);
+    for (int64_t i = 0; i < n; i++) w[nearest[i]] += 1;
+    kmeans_pp_init<float>(cand.data(), ncand, dim, k, centroids, seed, w.data());
+}
+
+template<typename T>
+void kmeans_init(const T* data, int64_t n, int64_t dim, int64_t k, float* centroids,
+                 KmeansInit init, int64_t seed) {
+    switch (init) {
+        case KmeansInit::KMEANS_PP:
+            kmeans_pp_init<T>(data, n, dim, k, centroids, seed);
+            break;
+        case KmeansInit::KMEANS_PARALLEL:
+            kmeans_parallel_init<T>(data, n, dim, k, centroids, seed);
+            break;
+        case KmeansInit::GIVEN:
+            break;
+        default: {
+            std::unique_ptr<T[]> sample(new T[k * dim]);
+            random_sampling_k2<T>(data, n, dim, k, sample.get(), seed);
+            for (int64_t i = 0; i < k * dim; i++) centroids[i] = (float)sample[i];
+        }
+    }
+}
+
+// data: n * dim, centroids: k * dim output, assign: n output (may be null).
+// stops after niter iterations or when the objective improves by less than tol.
+template<typename T>
+KmeansStats kmeans(const T* data, int64_t n, int64_t dim, int64_t k,
+                   float* centroids, uint32_t* assign = nullptr,
+                   int niter = 10, double tol = 1e-4, int64_t seed = 1234,
+                   KmeansInit init = KmeansInit::RANDOM) {
+    KmeansStats stats;
+    assert(n >= k);
+    kmeans_init<T>(data, n, dim, k, centroids, init, seed);
+
+    std::unique_ptr<uint32_t[]> own_assign;
+    if (assign == nullptr) {
+        own_assign.reset(new uint32_t[n]);
+        assign = own_assign.get();
+    }
+    std::unique_ptr<float[]> dis(new float[n]);
+
+    double prev = std::numeric_limits<double>::max();
+    for (int it = 0; it < niter; it++) {
+        knn_1<CMax<float, uint32_t>, T, float>(
+            data, centroids, n, k, dim, 1, dis.get(), assign, L2sqr<const T, const float, float>);
+        stats.dis_cnt += n * k;
+        stats.iterations = it + 1;
+        stats.objective = 0;
+        for (int64_t i = 0; i < n; i++) stats.objective += dis[i];
+        update_centroids<T>(data, n, dim, k, assign, centroids);
+        if (prev - stats.objective <= tol * prev) break;
+        prev = stats.objective;
+    }
+    return stats;
+}
+
+// per-thread scratch of kmeans_bounded. Vectors are only resized, so once a
+// thread has run its largest sub-problem (at most K2_MAX_POINTS_PER_CENTROID
+// points per centroid) the O(n) buffers are not allocated again. What still
+// allocates per call is O(k): the k-means that groups the yinyang centroids
+// and the k-means++ / k-means|| seeding (KmeansInit other than RANDOM).
+struct KmeansBoundsWorkspace {
+    std::vector<float> upper;         // n, upper bound of the distance to the assigned centroid
+    std::vector<float> lower;         // n * ngroups, lower bound of the distance to the other centroids of a group
+    std::vector<uint32_t> assign;     // n
+    std::vector<float> old_centroids; // k * dim
+    std::vector<float> drift;         // k, how far each centroid moved in the last update
+    std::vector<float> group_drift;   // ngroups
+    std::vector<float> half_sep;      // k, half the distance to the closest other centroid
+    std::vector<uint32_t> group;      // k, group id of every centroid
+    std::vector<uint32_t> group_off;  // ngroups + 1, CSR members of each group
+    std::vector<uint32_t> group_mem;  // k
+    std::vector<float> grp_min1, grp_min2;
+    std::vector<uint32_t> grp_arg1;
+    std::vector<char> grp_done;
+    std::vector<double> sum;          // k * dim
+    std::vector<int64_t> cnt;         // k
+    std::vector<char> train_buf;      // sampled training points
+    std::vector<char> seed_buf;       // initial centroids
+    std::vector<float> group_centroids; // ngroups * dim, centers of the groups
+    std::vector<uint32_t> group_pos;  // ngroups, fill position of each group
+    std::vector<float> assign_dis;    // n, distance of every point to its final centroid
+
+    void prepare(int64_t n, int64_t k, int64_t dim, int64_t ngroups) {
+        upper.resize(n);
+        lower.resize(n * ngroups);
+        assign.resize(n);
+        old_centroids.resize(k * dim);
+        drift.resize(k);
+        group_drift.resize(ngroups);
+        half_sep.resize(k);
+        group.resize(k);
+        group_off.resize(ngroups + 1);
+        group_mem.resize(k);
+        group_centroids.resize(ngroups * dim);
+        group_pos.resize(ngroups);
+        grp_min1.resize(ngroups);
+        grp_min2.resize(ngroups);
+        grp_arg1.resize(ngroups);
+        grp_done.resize(ngroups);
+        sum.resize(k * dim);
+        cnt.resize(k);
+    }
+
+    static KmeansBoundsWorkspace& local() {
+        thread_local KmeansBoundsWorkspace ws;
+        return ws;
+    }
+};
+
+// move the centroids to the mean of their points and record the drift
+template<typename T>
+void bounded_update(const T* data, int64_t n, int64_t dim, int64_t k,
+                    float* centroids, KmeansBoundsWorkspace& ws) {
+    memcpy(ws.old_centroids.data(), centroids, k * dim * sizeof(float));
+    update_centroids<T>(data, n, dim, k, ws.assign.data(), centroids, ws.sum.data(), ws.cnt.data());
+    for (int64_t c = 0; c < k; c++) {
+        ws.drift[c] = std::sqrt(L2sqr<const float, const float, float>(
+            ws.old_centroids.data() + c * dim, centroids + c * dim, dim));
+    }
+}
+
+template<typename T>
+void hamerly_iterations(const T* data, int64_t n, int64_t dim, int64_t k, float* centroids,
+                        int niter, KmeansBoundsWorkspace& ws, KmeansStats& stats) {
+    auto dist = [&](int64_t i, int64_t c) {
+        return std::sqrt(L2sqr<const T, const float, float>(data + i * dim, centroids + c * dim, dim));
+    };
+    auto full_scan = [&](int64_t i) {
+        float d1 = std::numeric_limits<float>::max(), d2 = d1;
+        uint32_t a = 0;
+        for (int64_t c = 0; c < k; c++) {
+            float d = dist(i, c);
+            if (d < d1) {
+                d2 = d1;
+                d1 = d;
+                a = c;
+            } else if (d < d2) {
+                d2 = d;
+            }
+        }
+        stats.dis_cnt += k;
+        ws.assign[i] = a;
+        ws.upper[i] = d1;
+        ws.lower[i] = d2;
+    };
+
+    for (int64_t i = 0; i < n; i++) full_scan(i);
+    for (int it = 0; it < niter; it++) {
+        bounded_update<T>(data, n, dim, k, centroids, ws);
+        int64_t max_id = std::max_element(ws.drift.begin(), ws.drift.begin() + k) - ws.drift.begin();
+        float max1 = ws.drift[max_id], max2 = 0;
+        for (int64_t c = 0; c < k; c++) {
+            if (c != max_id) max2 = std::max(max2, ws.drift[c]);
+        }
+        for (int64_t c = 0; c < k; c++) {
+            float s = std::numeric_limits<float>::max();
+            for (int64_t o = 0; o < k; o++) {
+                if (o == c) continue;
+                s = std::min(s, L2sqr<const float, const float, float>(centroids + c * dim, centroids + o * dim, dim));
+            }
+            ws.half_sep[c] = 0.5f * std::sqrt(s);
+        }
+
+        int64_t changed = 0;
+        for (int64_t i = 0; i < n; i++) {
+            uint32_t a = ws.assign[i];
+            ws.upper[i] += ws.drift[a];
+            ws.lower[i] -= a == max_id ? max2 : max1;
+            float m = std::max(ws.half_sep[a], ws.lower[i]);
+            if (ws.upper[i] <= m) continue;
+            ws.upper[i] = dist(i, a);
+            stats.dis_cnt++;
+            if (ws.upper[i] <= m) continue;
+            full_scan(i);
+            changed += ws.assign[i] != a;
+        }
+        stats.iterations = it + 1;
+        if (changed == 0) return;
+    }
+    bounded_update<T>(data, n, dim, k, centroids, ws);
+}
+
+template<typename T>
+void yinyang_iterations(const T* data, int64_t n, int64_t dim, int64_t k, float* centroids,
+                        int64_t ngroups, int niter, KmeansBoundsWorkspace& ws, KmeansStats& stats) {
+    // group the initial centroids with a few rounds of k-means on themselves
+    {
+        kmeans<float>(centroids, k, dim, ngroups, ws.group_centroids.data(), ws.group.data(), 5);
+        std::fill(ws.group_off.begin(), ws.group_off.begin() + ngroups + 1, 0);
+        for (int64_t c = 0; c < k; c++) ws.group_off[ws.group[c] + 1]++;
+        for (int64_t g = 0; g < ngroups; g++) ws.group_off[g + 1] += ws.group_off[g];
+        std::copy(ws.group_off.begin(), ws.group_off.begin() + ngroups, ws.group_pos.begin());
+        for (int64_t c = 0; c < k; c++) ws.group_mem[ws.group_pos[ws.group[c]]++] = c;
+    }
+
+    auto dist = [&](int64_t i, int64_t c) {
+        return std::sqrt(L2sqr<const T, const float, float>(data + i * dim, centroids + c * dim, dim));
+    };
+    auto scan_group = [&](int64_t i, int64_t g) {
+        float d1 = std::numeric_limits<float>::max(), d2 = d1;
+        uint32_t a = 0;
+        for (uint32_t m = ws.group_off[g]; m < ws.group_off[g + 1]; m++) {
+            uint32_t c = ws.group_mem[m];
+            float d = dist(i, c);
+            if (d < d1) {
+                d2 = d1;
+                d1 = d;
+                a = c;
+            } else if (d < d2) {
+                d2 = d;
+            }
+        }
+        stats.dis_cnt += ws.group_off[g + 1] - ws.group_off[g];
+        ws.grp_min1[g] = d1;
+        ws.grp_min2[g] = d2;
+        ws.grp_arg1[g] = a;
+        ws.grp_done[g] = 1;
+    };
+
+    for (int64_t i = 0; i < n; i++) {
+        float best = std::numeric_limits<float>::max();
+        uint32_t a = 0;
+        for (int64_t g = 0; g < ngroups; g++) {
+            scan_group(i, g);
+            if (ws.grp_min1[g] < best) {
+                best = ws.grp_min1[g];
+                a = ws.grp_arg1[g];
+            }
+        }
+        ws.assign[i] = a;
+        ws.upper[i] = best;
+        float* l = ws.lower.data() + i * ngroups;
+        for (int64_t g = 0; g < ngroups; g++) {
+            l[g] = g == ws.group[a] ? ws.grp_min2[g] : ws.grp_min1[g];
+        }
+    }
+
+    for (int it = 0; it < niter; it++) {
+        bounded_update<T>(data, n, dim, k, centroids, ws);
+        std::fill(ws.group_drift.begin(), ws.group_drift.begin() + ngroups, 0);
+        for (int64_t c = 0; c < k; c++) {
+            ws.group_drift[ws.group[c]] = std::max(ws.group_drift[ws.group[c]], ws.drift[c]);
+        }
+
+        int64_t changed = 0;
+        for (int64_t i = 0; i < n; i++) {
+            const uint32_t old_a = ws.assign[i];
+            float* l = ws.lower.data() + i * ngroups;
+            ws.upper[i] += ws.drift[old_a];
+            float glb = std::numeric_limits<float>::max();
+            for (int64_t g = 0; g < ngroups; g++) {
+                l[g] -= ws.group_drift[g];
+                glb = std::min(glb, l[g]);
+            }
+            if (ws.upper[i] <= glb) continue;
+            ws.upper[i] = dist(i, old_a);
+            stats.dis_cnt++;
+            if (ws.upper[i] <= glb) continue;
+
+            const float old_u = ws.upper[i];
+            float best = old_u;
+            uint32_t a = old_a;
+            std::fill(ws.grp_done.begin(), ws.grp_done.begin() + ngroups, 0);
+            for (int64_t g = 0; g < ngroups; g++) {
+                if (l[g] >= best) continue;
+                scan_group(i, g);
+                if (ws.grp_min1[g] < best) {
+                    best = ws.grp_min1[g];
+                    a = ws.grp_arg1[g];
+                }
+            }
+            for (int64_t g = 0; g < ngroups; g++) {
+                if (ws.grp_done[g]) {
+                    l[g] = (g == ws.group[a] && ws.grp_arg1[g] == a) ? ws.grp_min2[g] : ws.grp_min1[g];
+                } else if (g == ws.group[old_a] && a != old_a) {
+                    l[g] = std::min(l[g], old_u);
+                }
+            }
+            ws.assign[i] = a;
+            ws.upper[i] = best;
+            changed += a != old_a;
+        }
+        stats.iterations = it + 1;
+        if (changed == 0) return;
+    }
+    bounded_update<T>(data, n, dim, k, centroids, ws);
+}
+
+// k-means for the K2 sub-problems. At most k * K2_MAX_POINTS_PER_CENTROID
+// points are used for training, the bounds live in the calling thread's
+// workspace, so clusters can be trained in parallel with one call per thread.
+// assign (n, may be null) receives the nearest centroid of every point.
+template<typename T>
+KmeansStats kmeans_bounded(const T* data, int64_t n, int64_t dim, int64_t k,
+                           float* centroids, uint32_t* assign = nullptr,
+                           int niter = 10, int64_t seed = 1234,
+                           KmeansInit init = KmeansInit::RANDOM) {
+    KmeansStats stats;
+    assert(n >= k);
+    auto& ws = KmeansBoundsWorkspace::local();
+
+    const int64_t n_train = std::min<int64_t>(n, k * K2_MAX_POINTS_PER_CENTROID);
+    const T* train = data;
+    if (n_train < n) {
+        ws.train_buf.resize(n_train * dim * sizeof(T));
+        random_sampling_k2<T>(data, n, dim, n_train, (T*)ws.train_buf.data(), seed);
+        train = (const T*)ws.train_buf.data();
+    }
+    if (init == KmeansInit::RANDOM) {
+        ws.seed_buf.resize(k * dim * sizeof(T));
+        const T* seeds = (const T*)ws.seed_buf.data();
+        random_sampling_k2<T>(train, n_train, dim, k, (T*)ws.seed_buf.data(), seed);
+        for (int64_t i = 0; i < k * dim; i++) centroids[i] = (float)seeds[i];
+    } else {
+        kmeans_init<T>(train, n_train, dim, k, centroids, init, seed);
+    }
+
+    const int64_t ngroups = k < YINYANG_MIN_K ? 1 : std::max<int64_t>(1, k / 10);
+    ws.prepare(n_train, k, dim, ngroups);
+    if (ngroups == 1) {
+        hamerly_iterations<T>(train, n_train, dim, k, centroids, niter, ws, stats);
+    } else {
+        yinyang_iterations<T>(train, n_train, dim, k, centroids, ngroups, niter, ws, stats);
+    }
+
+    for (int64_t i = 0; i < n_train; i++) {
+        stats.objective += L2sqr<const T, const float, float>(
+            train + i * dim, centroids + (int64_t)ws.assign[i] * dim, dim);
+    }
+    if (assign != nullptr) {
+        ws.assign_dis.resize(n);
+        knn_1<CMax<float, uint32_t>, T, float>(
+            data, centroids, n, k, dim, 1, ws.assign_dis.data(), assign, L2sqr<const T, const float, float>);
+    }
+    return stats;
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Online locality of a query stream over the centroids it probes.
+//
+// A sliding window of the last `window` queries keeps a reference count per
+// centroid, so every arriving query costs O(nprobe): its probes are counted
+// in, the probes of the query leaving the window are counted out, and the
+// working set (centroids with a non-zero count, and their bytes) follows
+// the counts.
+//
+// Every reference also records its reuse gap, the number of queries since
+// the centroid was last probed. From the gaps the working-set model gives,
+// for any window T at once, the hit ratio of a cache holding the last T
+// queries' clusters and its mean size in clusters and bytes:
+//   hit(T)  = P(gap <= T), first references miss
+//   size(T) = sum_{x < T} (references per query whose next use is > x away)
+// The last use of a cluster counts up to the end of the stream, which makes
+// size(T) the exact mean working set over the stream. Together they give
+// the smallest cache reaching a target hit ratio.
+//
+// Popularity drift is the total variation distance between the probe
+// distributions of consecutive epochs.
+
+struct LocalityPoint {
+    int64_t window;
+    double hit_ratio;
+    double ws_clusters;
+    double ws_bytes;
+};
+
+struct DriftPoint {
+    int64_t query;
+    int64_t ws_clusters;
+    uint64_t ws_bytes;
+    double drift;
+};
+
+class SlidingWindowLocality {
+ public:
+    // cluster_bytes may be empty, byte sizes are then reported as 0;
+    // gaps beyond max_gap only count as misses
+    SlidingWindowLocality(int64_t window, uint32_t number_centroids,
+                          std::vector<uint64_t> cluster_bytes = {},
+                          int64_t epoch = 1000, int64_t max_gap = 1 << 16)
+        : window_(window), epoch_(epoch), max_gap_(max_gap),
+          cluster_bytes_(std::move(cluster_bytes)),
+          ref_cnt_(number_centroids, 0), last_seen_(number_centroids, -1),
+          epoch_cnt_(number_centroids, 0), prev_epoch_cnt_(number_centroids, 0),
+          gap_cnt_(max_gap + 1, 0), gap_bytes_(max_gap + 1, 0) {
+        cluster_bytes_.resize(number_centroids, 0);
+    }
+
+    void push(const uint32_t* probes, int nprobe) {
+        if (ring_.empty()) ring_.assign(window_ * nprobe, 0);
+        nprobe_ = nprobe;
+        const int64_t slot = (queries_ % window_) * nprobe;
+        if (queries_ >= window_) {
+            for (int j = 0; j < nprobe; j++) {
+                uint32_t c = ring_[slot + j];
+                if (--ref_cnt_[c] == 0) {
+                    ws_clusters_--;
+                    ws_bytes_ -= cluster_bytes_[c];
+                }
+            }
+        }
+        for (int j = 0; j < nprobe; j++) {
+            uint32_t c = probes[j];
+            ring_[slot + j] = c;
+            if (ref_cnt_[c]++ == 0) {
+                ws_clusters_++;
+                ws_bytes_ += cluster_bytes_[c];
+            }
+            if (last_seen_[c] < 0) {
+                cold_cnt_++;
+            } else {
+                int64_t gap = std::min(queries_ - last_seen_[c], max_gap_);
+                gap_cnt_[gap]++;
+                gap_bytes_[gap] += cluster_bytes_[c];
+            }
+            last_seen_[c] = queries_;
+            epoch_cnt_[c]++;
+        }
+        references_ += nprobe;
+        queries_++;
+        if (queries_ % epoch_ == 0) close_epoch();
+    }
+
+    int64_t ws_clusters() const { return ws_clusters_; }
+    uint64_t ws_bytes() const { return ws_bytes_; }
+
+    // working-set curve for windows 1, 2, 4, ... below max_gap
+    std::vector<LocalityPoint> curve() const {
+        std::vector<LocalityPoint> points;
+        if (queries_ == 0) return points;
+        const double per_query = 1.0 / queries_;
+        // forward gaps: every reuse gap closes the previous use, the last use
+        // of each cluster stays open until the end of the stream
+        std::vector<uint64_t> fwd_cnt(gap_cnt_), fwd_bytes(gap_bytes_);
+        for (size_t c = 0; c < last_seen_.size(); c++) {
+            if (last_seen_[c] < 0) continue;
+            int64_t gap = std::min(queries_ - last_seen_[c], max_gap_);
+            fwd_cnt[gap]++;
+            fwd_bytes[gap] += cluster_bytes_[c];
+        }
+        // uses and bytes whose next use is more than x queries away
+        double above = references_, above_bytes = 0;
+        for (auto b : fwd_bytes) above_bytes += b;
+        double ws = 0, ws_bytes = 0, hits = 0;
+        for (int64_t x = 0, next = 1; x + 1 < max_gap_; x++) {
+            ws += above * per_query;
+            ws_bytes += above_bytes * per_query;
+            above -= fwd_cnt[x + 1];
+            above_bytes -= fwd_bytes[x + 1];
+            hits += gap_cnt_[x + 1];
+            if (x + 1 == next) {
+                points.push_back({x + 1, hits / references_, ws, ws_bytes});
+                next *= 2;
+            }
+        }
+        return points;
+    }
+
+    // smallest window whose hit ratio reaches target, window -1 if none does
+    LocalityPoint min_cache_for(double target) const {
+        for (auto& p : curve()) {
+            if (p.hit_ratio >= target) return p;
+        }
+        return {-1, 0, 0, 0};
+    }
+
+    const std::vector<DriftPoint>& drift() const { return drift_; }
+
+    void print() const {
+        std::cout << "sliding window of " << window_ << " queries over " << queries_
+                  << " queries: working set " << ws_clusters_ << " clusters, " << ws_bytes_ << " bytes" << std::endl;
+        for (double target : {0.5, 0.8, 0.9, 0.95, 0.99}) {
+            auto p = min_cache_for(target);
+            std::cout << "hit ratio " << target << ": ";
+            if (p.window < 0) {
+                std::cout << "not reached" << std::endl;
+            } else {
+                std::cout << "window " << p.window << " queries, " << p.ws_clusters << " clusters, "
+                          << p.ws_bytes << " bytes" << std::endl;
+            }
+        }
+    }
+
+    void write(const std::string& curve_file, const std::string& drift_file) const {
+        std::ofstream cf(curve_file);
+        cf << "window\thit_ratio\tws_clusters\tws_bytes\n";
+        for (auto& p : curve()) cf << p.window << "\t" << p.hit_ratio << "\t" << p.ws_clusters << "\t" << p.ws_bytes << "\n";
+        std::ofstream df(drift_file);
+        df << "query\tws_clusters\tws_bytes\tdrift\n";
+        for (auto& d : drift_) df << d.query << "\t" << d.ws_clusters << "\t" << d.ws_bytes << "\t" << d.drift << "\n";
+        std::cout << "write locality curve to " << curve_file << ", drift to " << drift_file << std::endl;
+    }
+
+ private:
+    void close_epoch() {
+        double tv = 0;
+        const double n = (double)epoch_ * nprobe_;
+        for (size_t c = 0; c < epoch_cnt_.size(); c++) {
+            tv += std::abs((double)epoch_cnt_[c] - prev_epoch_cnt_[c]) / n;
+        }
+        // the first epoch has nothing to drift from
+        drift_.push_back({queries_, ws_clusters_, ws_bytes_, queries_ > epoch_ ? tv / 2 : 0});
+        prev_epoch_cnt_.swap(epoch_cnt_);
+        std::fill(epoch_cnt_.begin(), epoch_cnt_.end(), 0);
+    }
+
+    int64_t window_;
+    int64_t epoch_;
+    int64_t max_gap_;
+    int nprobe_ = 0;
+    std::vector<uint64_t> cluster_bytes_;
+
+    int64_t queries_ = 0;
+    int64_t references_ = 0;
+    int64_t cold_cnt_ = 0;
+    // probes of the queries in the window, window * nprobe ring
+    std::vector<uint32_t> ring_;
+    std::vector<int32_t> ref_cnt_;
+    std::vector<int64_t> last_seen_;
+    int64_t ws_clusters_ = 0;
+    uint64_t ws_bytes_ = 0;
+
+    std::vector<uint32_t> epoch_cnt_, prev_epoch_cnt_;
+    // reuse gaps, gap_cnt_[max_gap] holds the gaps of max_gap and more
+    std::vector<uint64_t> gap_cnt_, gap_bytes_;
+    std::vector<DriftPoint> drift_;
+};
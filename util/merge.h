@@ -1,9 +1,12 @@
 #pragma once
 
+#include "arena.h"
 #include "heap.h"
+#include "result_set.h"
 
 // Id Type: C::TI
 // Distance type: C::T
+// the work buffers come from the arena of each thread
 
 template<class C>
 void merge(typename C::T* dis1, typename C::TI *id1,
@@ -15,8 +18,9 @@ void merge(typename C::T* dis1, typename C::TI *id1,
 
 #pragma omp parallel
 {
-    DIS_T* work_dis = new DIS_T[topk];
-    ID_T* work_id = new ID_T[topk];
+    ArenaScope scratch;
+    DIS_T* work_dis = scratch.alloc<DIS_T>(topk);
+    ID_T* work_id = scratch.alloc<ID_T>(topk);
 #pragma omp for
     for (int64_t q_i = 0; q_i < nq; q_i++) {
         auto d1 = dis1 + q_i * topk;
@@ -41,8 +45,13 @@ void merge(typename C::T* dis1, typename C::TI *id1,
         memcpy(d1, work_dis, topk * sizeof(DIS_T));
         memcpy(i1, work_id, topk * sizeof(ID_T));
     }
+}
+}
 
-    delete[] work_dis;
-    delete[] work_id;
+// merge the rows of b, ids shifted by data2_base, into a; both nq x topk
+template<class C>
+void merge(ResultSet<typename C::T, typename C::TI>& a,
+           ResultSet<typename C::T, typename C::TI>& b, int64_t data2_base) {
+    assert(a.nq == b.nq && a.k == b.k);
+    merge<C>(a.dis.data(), a.ids.data(), b.dis.data(), b.ids.data(), a.nq, a.k, data2_base);
 }
-}
\ No newline at end of file
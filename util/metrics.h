@@ -0,0 +1,233 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Named counters and latency histograms shared by the search paths, the
+// IO readers and the /proc based IO counters. Updates go to a per-thread
+// shard (cache-line padded relaxed atomics) and are only summed when the
+// registry is dumped, as JSON or as Prometheus text.
+//
+// Look a metric up once and keep the reference, the lookup takes a lock:
+//   static Counter& dis_cnt = MetricsRegistry::instance().counter(METRIC_DISTANCE_COMPUTATIONS);
+
+constexpr const char* METRIC_BYTES_READ = "bytes_read";
+constexpr const char* METRIC_READ_IOPS = "read_ios";
+constexpr const char* METRIC_PAGE_HITS = "page_hits";
+constexpr const char* METRIC_DISTANCE_COMPUTATIONS = "distance_computations";
+constexpr const char* METRIC_HEAP_OPERATIONS = "heap_operations";
+constexpr const char* METRIC_QUERY_LATENCY_NS = "query_latency_ns";
+
+constexpr static int METRIC_SHARDS = 16;
+
+inline int metric_shard() {
+    static std::atomic<int> next{0};
+    thread_local int shard = next.fetch_add(1) % METRIC_SHARDS;
+    return shard;
+}
+
+class Counter {
+ public:
+    void add(uint64_t v = 1) {
+        shards_[metric_shard()].v.fetch_add(v, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const {
+        uint64_t sum = 0;
+        for (const auto& s : shards_) sum += s.v.load(std::memory_order_relaxed);
+        return sum;
+    }
+
+    void reset() {
+        for (auto& s : shards_) s.v = 0;
+    }
+
+ private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> v{0};
+    };
+    Shard shards_[METRIC_SHARDS];
+};
+
+// HDR-style log-linear histogram: values below 16 are exact, above that
+// every power of two is split into 16 buckets (relative error < 6.25%).
+class Histogram {
+ public:
+    static constexpr int SUB_BITS = 4;
+    static constexpr int SUB = 1 << SUB_BITS;
+    static constexpr int BUCKETS = (64 - SUB_BITS + 1) * SUB;
+
+    static int bucket_of(uint64_t v) {
+        if (v < SUB) return (int)v;
+        int msb = 63 - __builtin_clzll(v);
+        return (msb - SUB_BITS + 1) * SUB + (int)((v >> (msb - SUB_BITS)) & (SUB - 1));
+    }
+
+    // smallest value that falls into bucket b
+    static uint64_t bucket_low(int b) {
+        if (b < SUB) return b;
+        int msb = b / SUB + SUB_BITS - 1;
+        return (uint64_t)(SUB + b % SUB) << (msb - SUB_BITS);
+    }
+
+    void record(uint64_t v) {
+        auto& s = shards_[metric_shard()];
+        s.buckets[bucket_of(v)].fetch_add(1, std::memory_order_relaxed);
+        s.sum.fetch_add(v, std::memory_order_relaxed);
+    }
+
+    // merged view of all shards
+    struct Snapshot {
+        uint64_t buckets[BUCKETS] = {0};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+
+        uint64_t percentile(double p) const {
+            if (count == 0) return 0;
+            uint64_t rank = (uint64_t)(p * (count - 1)) + 1, acc = 0;
+            for (int b = 0; b < BUCKETS; b++) {
+                acc += buckets[b];
+                if (acc >= rank) return bucket_low(b);
+            }
+            return bucket_low(BUCKETS - 1);
+        }
+    };
+
+    Snapshot snapshot() const {
+        Snapshot snap;
+        for (const auto& s : shards_) {
+            for (int b = 0; b < BUCKETS; b++) {
+                uint64_t c = s.buckets[b].load(std::memory_order_relaxed);
+                snap.buckets[b] += c;
+                snap.count += c;
+            }
+            snap.sum += s.sum.load(std::memory_order_relaxed);
+        }
+        return snap;
+    }
+
+    void reset() {
+        for (auto& s : shards_) {
+            for (auto& b : s.buckets) b = 0;
+            s.sum = 0;
+        }
+    }
+
+ private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> buckets[BUCKETS];
+        std::atomic<uint64_t> sum{0};
+        Shard() {
+            for (auto& b : buckets) b.store(0, std::memory_order_relaxed);
+        }
+    };
+    Shard shards_[METRIC_SHARDS];
+};
+
+// records the lifetime of the scope in nanoseconds
+class ScopedLatency {
+ public:
+    explicit ScopedLatency(Histogram& h) : h_(h), start_(std::chrono::steady_clock::now()) {}
+    ~ScopedLatency() {
+        h_.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_).count());
+    }
+
+ private:
+    Histogram& h_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+class MetricsRegistry {
+ public:
+    static MetricsRegistry& instance() {
+        static MetricsRegistry registry;
+        return registry;
+    }
+
+    Counter& counter(const std::string& name) {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto& c = counters_[name];
+        if (!c) c.reset(new Counter());
+        return *c;
+    }
+
+    Histogram& histogram(const std::string& name) {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto& h = histograms_[name];
+        if (!h) h.reset(new Histogram());
+        return *h;
+    }
+
+    void reset() {
+        std::lock_guard<std::mutex> lk(mu_);
+        for (auto& c : counters_) c.second->reset();
+        for (auto& h : histograms_) h.second->reset();
+    }
+
+    void dump_json(std::ostream& os) {
+        std::lock_guard<std::mutex> lk(mu_);
+        os << "{\n  \"counters\": {";
+        bool first = true;
+        for (auto& c : counters_) {
+            os << (first ? "\n" : ",\n") << "    \"" << c.first << "\": " << c.second->value();
+            first = false;
+        }
+        os << "\n  },\n  \"histograms\": {";
+        first = true;
+        for (auto& h : histograms_) {
+            auto snap = h.second->snapshot();
+            os << (first ? "\n" : ",\n") << "    \"" << h.first << "\": {"
+               << "\"count\": " << snap.count << ", \"sum\": " << snap.sum
+               << ", \"p50\": " << snap.percentile(0.5) << ", \"p90\": " << snap.percentile(0.9)
+               << ", \"p99\": " << snap.percentile(0.99) << ", \"p999\": " << snap.percentile(0.999)
+               << ", \"max\": " << snap.percentile(1.0) << "}";
+            first = false;
+        }
+        os << "\n  }\n}" << std::endl;
+    }
+
+    void dump_prometheus(std::ostream& os) {
+        std::lock_guard<std::mutex> lk(mu_);
+        for (auto& c : counters_) {
+            os << "# TYPE " << c.first << " counter\n" << c.first << " " << c.second->value() << "\n";
+        }
+        for (auto& h : histograms_) {
+            auto snap = h.second->snapshot();
+            os << "# TYPE " << h.first << " histogram\n";
+            uint64_t acc = 0;
+            for (int b = 0; b < Histogram::BUCKETS; b++) {
+                if (snap.buckets[b] == 0) continue;
+                acc += snap.buckets[b];
+                os << h.first << "_bucket{le=\"" << Histogram::bucket_low(b + 1) - 1 << "\"} " << acc << "\n";
+            }
+            os << h.first << "_bucket{le=\"+Inf\"} " << snap.count << "\n";
+            os << h.first << "_sum " << snap.sum << "\n";
+            os << h.first << "_count " << snap.count << "\n";
+        }
+        os.flush();
+    }
+
+    // JSON when the file name ends with .json, Prometheus text otherwise
+    void dump_to_file(const std::string& file_name) {
+        std::ofstream os(file_name);
+        if (file_name.size() >= 5 && file_name.compare(file_name.size() - 5, 5, ".json") == 0) {
+            dump_json(os);
+        } else {
+            dump_prometheus(os);
+        }
+        std::cout << "write metrics to " << file_name << std::endl;
+    }
+
+ private:
+    std::mutex mu_;
+    std::map<std::string, std::unique_ptr<Counter>> counters_;
+    std::map<std::string, std::unique_ptr<Histogram>> histograms_;
+};
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#include <vector>
+
+#include "constants.h"
+#include "io_perf.h"
+#include "metrics.h"
+#include "utils.h"
+
+// Cluster files striped over several directories, one per SSD. Placement is
+// cluster-size aware: every cluster carries an expected load (popularity *
+// bytes), clusters are placed heaviest first on the device with the least
+// load so far, then the most popular clusters are copied to the next least
+// loaded devices until the replica byte budget is spent, their load split
+// over the copies. Reads are routed to the replica whose device has the
+// fewest outstanding IOs, ties (e.g. sequential reads, where nothing is
+// outstanding) go to the device with the fewest bytes routed so far (TwoStageSearch::set_layout for the refine reads).
+//
+// layout file (GLOBAL + LAYOUT + BIN): (K, 1 + MAX_REPLICAS) uint32 rows,
+// the replica count followed by the device ids, primary first.
+
+constexpr static int MAX_REPLICAS = 4;
+
+// block device of the filesystem holding path, "" if it can not be found
+inline std::string block_device_of(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return "";
+    std::ifstream uevent("/sys/dev/block/" + std::to_string(major(st.st_dev)) + ":" +
+                         std::to_string(minor(st.st_dev)) + "/uevent");
+    std::string line;
+    while (std::getline(uevent, line)) {
+        if (line.compare(0, 8, "DEVNAME=") == 0) return line.substr(8);
+    }
+    return "";
+}
+
+inline bool copy_file(const std::string& from, const std::string& to) {
+    std::ifstream src(from, std::ios::binary);
+    if (!src.is_open()) {
+        std::cerr << "can not open " << from << std::endl;
+        return false;
+    }
+    std::ofstream dst(to, std::ios::binary);
+    dst << src.rdbuf();
+    if (!dst) {
+        std::cerr << "can not write " << to << std::endl;
+        return false;
+    }
+    return true;
+}
+
+class DeviceLayout {
+ public:
+    DeviceLayout(std::vector<std::string> dirs, std::vector<std::string> device_names = {})
+        : dirs_(std::move(dirs)), device_names_(std::move(device_names)),
+          outstanding_(new std::atomic<int64_t>[dirs_.size()]),
+          routed_bytes_(new std::atomic<uint64_t>[dirs_.size()]),
+          routed_reads_(new std::atomic<uint64_t>[dirs_.size()]) {
+        assert(!dirs_.empty());
+        device_names_.resize(dirs_.size());
+        auto& registry = MetricsRegistry::instance();
+        for (size_t d = 0; d < dirs_.size(); d++) {
+            if (device_names_[d].empty()) device_names_[d] = block_device_of(dirs_[d]);
+            outstanding_[d] = 0;
+            routed_bytes_[d] = 0;
+            routed_reads_[d] = 0;
+            reads_.push_back(&registry.counter("device_" + std::to_string(d) + "_reads"));
+            bytes_.push_back(&registry.counter("device_" + std::to_string(d) + "_bytes_read"));
+        }
+    }
+
+    int num_devices() const { return dirs_.size(); }
+    const std::string& dir(int d) const { return dirs_[d]; }
+    const std::vector<int>& replicas(uint32_t cid) const { return replicas_[cid]; }
+
+    // popularity: probes per cluster (centroids_count.txt), bytes: cluster sizes;
+    // replica_budget is the extra bytes allowed for copies, as a fraction of the total
+    void plan(const std::vector<uint64_t>& popularity, const std::vector<uint64_t>& bytes,
+              double replica_budget = 0.25, int max_replicas = 2) {
+        const size_t K = popularity.size();
+        const int ndev = dirs_.size();
+        max_replicas = std::min({max_replicas, MAX_REPLICAS, ndev});
+        std::vector<double> load(K);
+        for (size_t c = 0; c < K; c++) load[c] = (double)(popularity[c] + 1) * std::max<uint64_t>(bytes[c], 1);
+
+        std::vector<uint32_t> order(K);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return load[a] > load[b]; });
+
+        device_load_.assign(ndev, 0);
+        device_bytes_.assign(ndev, 0);
+        replicas_.assign(K, {});
+        for (auto c : order) {
+            int d = std::min_element(device_load_.begin(), device_load_.end()) - device_load_.begin();
+            replicas_[c].push_back(d);
+            device_load_[d] += load[c];
+            device_bytes_[d] += bytes[c];
+        }
+
+        // replicate by popularity, the most probed clusters first
+        std::vector<uint32_t> by_popularity(K);
+        std::iota(by_popularity.begin(), by_popularity.end(), 0);
+        std::stable_sort(by_popularity.begin(), by_popularity.end(),
+                         [&](uint32_t a, uint32_t b) { return popularity[a] > popularity[b]; });
+        uint64_t total = std::accumulate(bytes.begin(), bytes.end(), (uint64_t)0);
+        uint64_t budget = (uint64_t)(replica_budget * total);
+        for (auto c : by_popularity) {
+            while ((int)replicas_[c].size() < max_replicas && bytes[c] <= budget) {
+                int best = -1;
+                for (int d = 0; d < ndev; d++) {
+                    if (std::find(replicas_[c].begin(), replicas_[c].end(), d) != replicas_[c].end()) continue;
+                    if (best < 0 || device_load_[d] < device_load_[best]) best = d;
+                }
+                // move the load share of the new copy off the current replicas
+                double share = load[c] / replicas_[c].size() - load[c] / (replicas_[c].size() + 1);
+                for (int r : replicas_[c]) device_load_[r] -= share;
+                replicas_[c].push_back(best);
+                device_load_[best] += load[c] / replicas_[c].size();
+                device_bytes_[best] += bytes[c];
+                budget -= bytes[c];
+            }
+            if (budget == 0) break;
+        }
+    }
+
+    // copy the cluster files of index_path to every replica directory,
+    // false when a file could not be copied
+    bool apply(const std::string& index_path) const {
+        int64_t failed = 0;
+        for (uint32_t c = 0; c < replicas_.size(); c++) {
+            for (int d : replicas_[c]) {
+                for (const char* type : {RAWDATA, GLOBAL_IDS, META}) {
+                    if (!copy_file(index_path + CLUSTER + std::to_string(c) + type + BIN, cluster_file(c, d, type))) {
+                        failed++;
+                    }
+                }
+            }
+        }
+        std::cout << "copy " << replicas_.size() << " clusters to " << dirs_.size() << " devices, "
+                  << failed << " files failed" << std::endl;
+        return failed == 0;
+    }
+
+    void save(const std::string& file_name) const {
+        std::vector<uint32_t> rows(replicas_.size() * (1 + MAX_REPLICAS), 0);
+        for (size_t c = 0; c < replicas_.size(); c++) {
+            rows[c * (1 + MAX_REPLICAS)] = replicas_[c].size();
+            for (size_t r = 0; r < replicas_[c].size(); r++) rows[c * (1 + MAX_REPLICAS) + 1 + r] = replicas_[c][r];
+        }
+        write_bin_file<uint32_t>(file_name, rows.data(), replicas_.size(), 1 + MAX_REPLICAS);
+    }
+
+    // false when the layout does not cover number_clusters clusters on
+    // these directories
+    bool load(const std::string& file_name, uint32_t number_clusters) {
+        if (access(file_name.c_str(), F_OK) != 0) {
+            std::cerr << "missing " << file_name << ", run layout_clusters first" << std::endl;
+            return false;
+        }
+        uint32_t K, dim;
+        uint32_t* rows = nullptr;
+        read_bin_file<uint32_t>(file_name, rows, K, dim);
+        std::unique_ptr<uint32_t[]> guard(rows);
+        bool valid = K == number_clusters && dim == 1 + MAX_REPLICAS;
+        for (uint32_t c = 0; valid && c < K; c++) {
+            valid = rows[c * dim] >= 1 && rows[c * dim] <= MAX_REPLICAS;
+            for (uint32_t r = 0; valid && r < rows[c * dim]; r++) valid = rows[c * dim + 1 + r] < dirs_.size();
+        }
+        if (!valid) {
+            std::cerr << file_name << " is not a layout of " << number_clusters << " clusters over "
+                      << dirs_.size() << " devices" << std::endl;
+            return false;
+        }
+        replicas_.assign(K, {});
+        for (uint32_t c = 0; c < K; c++) {
+            for (uint32_t r = 0; r < rows[c * dim]; r++) replicas_[c].push_back(rows[c * dim + 1 + r]);
+        }
+        std::cout << "read device layout from " << file_name << ", " << K << " clusters" << std::endl;
+        return true;
+    }
+
+    // An in-flight read of one cluster on the least loaded replica, the
+    // device's outstanding count drops when it goes out of scope.
+    class RoutedRead {
+     public:
+        RoutedRead(DeviceLayout& layout, int device) : layout_(layout), device_(device) {}
+        RoutedRead(const RoutedRead&) = delete;
+        ~RoutedRead() { layout_.outstanding_[device_].fetch_sub(1, std::memory_order_relaxed); }
+        int device() const { return device_; }
+
+     private:
+        DeviceLayout& layout_;
+        int device_;
+    };
+
+    RoutedRead route(uint32_t cid, uint64_t bytes = 0) {
+        const auto& rs = replicas_[cid];
+        int best = rs[0];
+        int64_t best_cnt = outstanding_[best].load(std::memory_order_relaxed);
+        uint64_t best_bytes = routed_bytes_[best].load(std::memory_order_relaxed);
+        for (size_t r = 1; r < rs.size(); r++) {
+            int64_t cnt = outstanding_[rs[r]].load(std::memory_order_relaxed);
+            uint64_t routed = routed_bytes_[rs[r]].load(std::memory_order_relaxed);
+            if (cnt < best_cnt || (cnt == best_cnt && routed < best_bytes)) {
+                best = rs[r];
+                best_cnt = cnt;
+                best_bytes = routed;
+            }
+        }
+        outstanding_[best].fetch_add(1, std::memory_order_relaxed);
+        routed_bytes_[best].fetch_add(bytes, std::memory_order_relaxed);
+        routed_reads_[best].fetch_add(1, std::memory_order_relaxed);
+        if (best != rs[0]) copy_reads_.fetch_add(1, std::memory_order_relaxed);
+        reads_[best]->add();
+        bytes_[best]->add(bytes);
+        return RoutedRead(*this, best);
+    }
+
+    // reads and bytes route() sent to every device since construction
+    void print_routed() const {
+        for (size_t d = 0; d < dirs_.size(); d++) {
+            std::cout << "device " << d << " " << dirs_[d] << ": " << routed_reads_[d].load() << " reads, "
+                      << routed_bytes_[d].load() << " bytes routed" << std::endl;
+        }
+        std::cout << copy_reads_.load() << " reads served by a replica other than the primary" << std::endl;
+    }
+
+    std::string cluster_file(uint32_t cid, int device, const char* file_type) const {
+        return dirs_[device] + CLUSTER + std::to_string(cid) + file_type + BIN;
+    }
+
+    // one diskstat counter per distinct known device, they publish and print
+    // per-device reads and utilization when destroyed
+    std::vector<std::unique_ptr<DiskStat_Read_Counter>> disk_counters() const {
+        std::vector<std::unique_ptr<DiskStat_Read_Counter>> counters;
+        std::vector<std::string> seen;
+        for (auto& name : device_names_) {
+            if (name.empty() || std::find(seen.begin(), seen.end(), name) != seen.end()) continue;
+            if (!DiskStat::has_device(name)) continue;
+            seen.push_back(name);
+            counters.emplace_back(new DiskStat_Read_Counter(name));
+        }
+        return counters;
+    }
+
+    void print() const {
+        std::vector<int64_t> copies(dirs_.size(), 0);
+        for (auto& rs : replicas_) {
+            for (int d : rs) copies[d]++;
+        }
+        for (size_t d = 0; d < dirs_.size(); d++) {
+            std::cout << "device " << d << " " << dirs_[d] << " (" << device_names_[d] << "): "
+                      << copies[d] << " clusters" << std::endl;
+        }
+        // planned loads are only known after plan()
+        if (device_load_.empty()) return;
+        double max_load = *std::max_element(device_load_.begin(), device_load_.end());
+        double total_load = std::accumulate(device_load_.begin(), device_load_.end(), 0.0);
+        for (size_t d = 0; d < dirs_.size(); d++) {
+            std::cout << "device " << d << ": " << device_bytes_[d] << " bytes, load share "
+                      << device_load_[d] / total_load << std::endl;
+        }
+        std::cout << "max / avg device load: " << max_load * dirs_.size() / total_load << std::endl;
+    }
+
+ private:
+    std::vector<std::string> dirs_;
+    std::vector<std::string> device_names_;
+    std::unique_ptr<std::atomic<int64_t>[]> outstanding_;
+    std::unique_ptr<std::atomic<uint64_t>[]> routed_bytes_;
+    std::unique_ptr<std::atomic<uint64_t>[]> routed_reads_;
+    std::atomic<uint64_t> copy_reads_{0};
+    std::vector<Counter*> reads_;
+    std::vector<Counter*> bytes_;
+    std::vector<std::vector<int>> replicas_;
+    std::vector<double> device_load_;
+    std::vector<uint64_t> device_bytes_;
+};
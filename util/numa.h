@@ -0,0 +1,251 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "arena.h"
+#include "flat.h"
+#include "system.h"
+#include "work_stealing.h"
+
+// NUMA-aware execution without libnuma. The topology comes from sysfs
+// (node cpulists, per-cpu L3). Memory is placed by first touch: a buffer is
+// allocated and filled by a thread pinned to the node that will read it, so
+// its pages land on that node under the default policy. NumaExecutor keeps
+// one pinned pool per node alive across calls.
+//
+// numa_knn partitions the queries over the nodes in proportion to their
+// cpus; every node scans its slice against its own replica of the base, so
+// no thread reads memory of another socket in the scan.
+
+struct NumaNode {
+    int id;
+    std::vector<int> cpus;
+    // L3 of the node's first cpu, one socket per node
+    int64_t l3_size;
+};
+
+// "0-3,8,10-11" -> {0, 1, 2, 3, 8, 10, 11}
+inline std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    for (std::string item; std::getline(ss, item, ',');) {
+        if (item.empty() || item == "\n") continue;
+        int from = 0, to = 0;
+        int got = sscanf(item.c_str(), "%d-%d", &from, &to);
+        if (got < 1) continue;
+        if (got == 1) to = from;
+        for (int c = from; c <= to; c++) cpus.push_back(c);
+    }
+    return cpus;
+}
+
+class NumaTopology {
+ public:
+    // detected once, a single node holding every online cpu when sysfs has no nodes
+    static const NumaTopology& instance() {
+        static NumaTopology topology = detect();
+        return topology;
+    }
+
+    static NumaTopology detect() {
+        NumaTopology topo;
+        for (int id = 0; id < 1024; id++) {
+            std::ifstream in("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+            if (!in.is_open()) continue;
+            std::string list;
+            std::getline(in, list);
+            auto cpus = parse_cpu_list(list);
+            // memory-only nodes run no threads
+            if (cpus.empty()) continue;
+            topo.nodes_.push_back({id, cpus, get_L3_Size(cpus[0])});
+        }
+        if (topo.nodes_.empty()) {
+            std::vector<int> cpus(std::max<long>(1, sysconf(_SC_NPROCESSORS_ONLN)));
+            for (size_t c = 0; c < cpus.size(); c++) cpus[c] = c;
+            topo.nodes_.push_back({0, cpus, get_L3_Size(0)});
+        }
+        return topo;
+    }
+
+    // a topology of the given nodes, e.g. to split one socket for testing
+    explicit NumaTopology(std::vector<NumaNode> nodes = {}) : nodes_(std::move(nodes)) {}
+
+    int num_nodes() const { return nodes_.size(); }
+    const NumaNode& node(int n) const { return nodes_[n]; }
+
+    int num_cpus() const {
+        int n = 0;
+        for (auto& node : nodes_) n += node.cpus.size();
+        return n;
+    }
+
+    // index of the node holding cpu, -1 if none does
+    int node_of_cpu(int cpu) const {
+        for (size_t n = 0; n < nodes_.size(); n++) {
+            auto& cpus = nodes_[n].cpus;
+            if (std::find(cpus.begin(), cpus.end(), cpu) != cpus.end()) return n;
+        }
+        return -1;
+    }
+
+    // [begin, end) of the items of node n when n items are split by cpus
+    std::pair<int64_t, int64_t> partition(int n, int64_t items) const {
+        int64_t before = 0;
+        for (int i = 0; i < n; i++) before += nodes_[i].cpus.size();
+        const int64_t total = num_cpus();
+        return {items * before / total, items * (before + (int64_t)nodes_[n].cpus.size()) / total};
+    }
+
+    void print() const {
+        for (auto& node : nodes_) {
+            std::cout << "numa node " << node.id << ": " << node.cpus.size() << " cpus, L3 "
+                      << node.l3_size / 1024 << "K" << std::endl;
+        }
+    }
+
+ private:
+    std::vector<NumaNode> nodes_;
+};
+
+// Persistent per-node workers. Every node owns a WorkStealingPool with one
+// thread per cpu of the node, worker t pinned to cpu t of the node, and a
+// driver thread that runs the node's share of a job as worker 0 of that
+// pool. The threads are created once, a job only wakes the drivers, and a
+// driver's arena stays on its node across jobs.
+class NumaExecutor {
+ public:
+    using Job = std::function<void(int)>; // (node index)
+
+    explicit NumaExecutor(const NumaTopology& topo = NumaTopology::instance()) : topo_(topo) {
+        for (int n = 0; n < topo_.num_nodes(); n++) {
+            auto& cpus = topo_.node(n).cpus;
+            pools_.emplace_back(new WorkStealingPool(cpus.size(), cpus));
+        }
+        for (int n = 0; n < topo_.num_nodes(); n++) {
+            drivers_.emplace_back(&NumaExecutor::driver_loop, this, n);
+        }
+    }
+
+    ~NumaExecutor() {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto& d : drivers_) d.join();
+    }
+
+    NumaExecutor(const NumaExecutor&) = delete;
+    NumaExecutor& operator=(const NumaExecutor&) = delete;
+
+    // the executor of the detected topology
+    static NumaExecutor& global() {
+        static NumaExecutor executor;
+        return executor;
+    }
+
+    const NumaTopology& topology() const { return topo_; }
+    int num_nodes() const { return topo_.num_nodes(); }
+    // the pool of node n, to be used from the node's driver only
+    WorkStealingPool& pool(int n) { return *pools_[n]; }
+
+    // run f(n) for every node n on the node's driver, in parallel
+    void run(const Job& f) {
+        std::lock_guard<std::mutex> run_lk(run_mu_);
+        std::unique_lock<std::mutex> lk(mu_);
+        job_ = &f;
+        remaining_ = topo_.num_nodes();
+        epoch_++;
+        cv_.notify_all();
+        done_cv_.wait(lk, [&] { return remaining_ == 0; });
+        job_ = nullptr;
+    }
+
+ private:
+    void driver_loop(int n) {
+        pin_thread_to_cpus({topo_.node(n).cpus[0]});
+        uint64_t seen = 0;
+        while (true) {
+            const Job* f;
+            {
+                std::unique_lock<std::mutex> lk(mu_);
+                cv_.wait(lk, [&] { return stop_ || epoch_ != seen; });
+                if (stop_) return;
+                seen = epoch_;
+                f = job_;
+            }
+            (*f)(n);
+            std::lock_guard<std::mutex> lk(mu_);
+            if (--remaining_ == 0) done_cv_.notify_one();
+        }
+    }
+
+    NumaTopology topo_;
+    std::vector<std::unique_ptr<WorkStealingPool>> pools_;
+    std::vector<std::thread> drivers_;
+
+    std::mutex run_mu_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::condition_variable done_cv_;
+    const Job* job_ = nullptr;
+    int remaining_ = 0;
+    uint64_t epoch_ = 0;
+    bool stop_ = false;
+};
+
+// one copy of a buffer per node, each written by a thread of its node
+template<typename T>
+class NumaReplicated {
+ public:
+    NumaReplicated(const T* data, size_t n, NumaExecutor& executor = NumaExecutor::global())
+        : n_(n), copies_(executor.num_nodes()) {
+        executor.run([&](int node) {
+            copies_[node].reset(new T[n]);
+            memcpy(copies_[node].get(), data, n * sizeof(T));
+        });
+    }
+
+    const T* get(int node) const { return copies_[node].get(); }
+    size_t size() const { return n_; }
+
+ private:
+    size_t n_;
+    std::vector<std::unique_ptr<T[]>> copies_;
+};
+
+// knn of x against y with the queries split over the nodes, every node
+// copies its query slice into its driver's arena and scans its replica of y
+// on its own pool; value / labels as in knn
+template<class C, typename T1, typename T2>
+void numa_knn(NumaExecutor& executor,
+              const T1* x, const NumaReplicated<T2>& y,
+              int64_t nx, int64_t ny, int64_t dim, int64_t k,
+              typename C::T* value, typename C::TI* labels,
+              Computer<T1, T2, typename C::T> computer,
+              KnnVariant variant = KnnVariant::BASE_SCAN) {
+    const NumaTopology& topo = executor.topology();
+    executor.run([&](int node) {
+        auto range = topo.partition(node, nx);
+        const int64_t nq = range.second - range.first;
+        if (nq == 0) return;
+        ArenaScope scratch;
+        T1* local = scratch.alloc<T1>(nq * dim);
+        memcpy(local, x + range.first * dim, nq * dim * sizeof(T1));
+        knn<C, T1, T2>(variant, local, y.get(node), nq, ny, dim, k,
+                       value + range.first * k, labels + range.first * k, computer, &executor.pool(node));
+    });
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// A hardware event counted with perf_event_open for the calling thread and
+// every thread it creates after the counter is opened (their counts are
+// summed into read()). Opening fails without permission, e.g. with
+// perf_event_paranoid > 2 or in a container; valid() is then false and the
+// counter reads 0.
+
+class PerfCounter {
+ public:
+    PerfCounter(uint32_t type, uint64_t config) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    // PERF_TYPE_HW_CACHE event, e.g. (PERF_COUNT_HW_CACHE_NODE, READ, MISS)
+    static PerfCounter hw_cache(uint64_t cache, uint64_t op, uint64_t result) {
+        return PerfCounter(PERF_TYPE_HW_CACHE, cache | (op << 8) | (result << 16));
+    }
+
+    // data TLB load misses, the page walks a scan over a large matrix causes
+    static PerfCounter dtlb_load_misses() {
+        return hw_cache(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS);
+    }
+
+    ~PerfCounter() {
+        if (fd_ >= 0) close(fd_);
+    }
+    PerfCounter(PerfCounter&& other) : fd_(other.fd_) { other.fd_ = -1; }
+    PerfCounter(const PerfCounter&) = delete;
+
+    bool valid() const { return fd_ >= 0; }
+
+    void start() {
+        if (fd_ < 0) return;
+        ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    // stop counting and return the count since start()
+    uint64_t stop() {
+        if (fd_ < 0) return 0;
+        ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t count = 0;
+        if (read(fd_, &count, sizeof(count)) != sizeof(count)) return 0;
+        return count;
+    }
+
+ private:
+    int fd_;
+};
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <iostream>
+#include <limits>
+
+#include "distance.h"
+#include "heap.h"
+#include "work_stealing.h"
+
+// Scalar quantized centroids for an integer-only coarse search.
+// All dimensions share one mapping from [vmin, vmin + levels * scale] onto
+// the code range, so the L2 in code space is the true L2 divided by scale^2
+// up to rounding, and its ranking is unchanged. The range covers the
+// centroids and the value range of the queries given to train(), so a
+// query is rounded to codes but never clamped; for uint8 queries and
+// centroids of uint8 data the scale is 1 and the query codes are the query.
+// The scan runs on the integer L2sqr kernels (code x code) and picks
+// rerank_factor * k candidates, which are re-ranked with the float
+// distance against the original centroids.
+
+template<typename CODE_T>
+struct sq_code_traits;
+
+template<>
+struct sq_code_traits<uint8_t> {
+    using dist_t = uint32_t;
+    static constexpr int lo = 0;
+    static constexpr int hi = 255;
+};
+
+template<>
+struct sq_code_traits<int8_t> {
+    using dist_t = int;
+    static constexpr int lo = -128;
+    static constexpr int hi = 127;
+};
+
+template<typename CODE_T>
+struct QuantizedCentroids {
+    int64_t n = 0;
+    int64_t dim = 0;
+    float vmin = 0;
+    float scale = 1;
+    std::vector<CODE_T> codes;
+
+    using DIST_T = typename sq_code_traits<CODE_T>::dist_t;
+
+    // [query_min, query_max]: the values queries can take, e.g. 0, 255 for
+    // uint8; the code range is widened to hold them
+    void train(const float* centroids, int64_t n_, int64_t dim_,
+               float query_min = std::numeric_limits<float>::max(),
+               float query_max = std::numeric_limits<float>::lowest()) {
+        n = n_;
+        dim = dim_;
+        float lo_v = query_min;
+        float hi_v = query_max;
+        for (int64_t i = 0; i < n * dim; i++) {
+            lo_v = std::min(lo_v, centroids[i]);
+            hi_v = std::max(hi_v, centroids[i]);
+        }
+        constexpr float levels = sq_code_traits<CODE_T>::hi - sq_code_traits<CODE_T>::lo;
+        vmin = lo_v;
+        scale = hi_v > lo_v ? (hi_v - lo_v) / levels : 1.0f;
+        codes.resize(n * dim);
+#pragma omp parallel for
+        for (int64_t i = 0; i < n; i++) {
+            encode(centroids + i * dim, codes.data() + i * dim);
+        }
+    }
+
+    // centroids and queries alike; values inside the trained range only
+    // round, the clamp catches rounding at the range ends
+    template<typename T>
+    void encode(const T* x, CODE_T* code) const {
+        constexpr int lo = sq_code_traits<CODE_T>::lo;
+        constexpr int hi = sq_code_traits<CODE_T>::hi;
+        const float inv = 1.0f / scale;
+        for (int64_t d = 0; d < dim; d++) {
+            int v = (int)std::lround(((float)x[d] - vmin) * inv) + lo;
+            code[d] = (CODE_T)std::min(hi, std::max(lo, v));
+        }
+    }
+
+    uint64_t memory_size() const {
+        return codes.size() * sizeof(CODE_T) + 2 * sizeof(float);
+    }
+};
+
+// coarse search on quantized centroids, results are sorted like knn_1.
+// centroids is the float matrix the codes were trained on, only the
+// rerank candidates are read from it.
+template<class C, typename T1, typename CODE_T>
+void knn_1_quantized(const T1* x,
+                     const QuantizedCentroids<CODE_T>& qc,
+                     const float* centroids,
+                     int64_t nx,
+                     int64_t k,
+                     typename C::T* value,
+                     typename C::TI* labels,
+                     int64_t rerank_factor = 2,
+                     WorkStealingPool* pool = nullptr)
+{
+    using CODE_DIS_T = typename QuantizedCentroids<CODE_T>::DIST_T;
+    using CQ = CMax<CODE_DIS_T, typename C::TI>;
+    const int64_t dim = qc.dim;
+    const int64_t ny = qc.n;
+    const int64_t nr = std::min(ny, std::max(k, rerank_factor * k));
+
+    std::cout << "do knn_1_quantized with nx = " << nx << ", ny = " << ny
+              << ", k = " << k << ", rerank = " << nr << std::endl;
+
+    auto search_one = [&](int64_t i) {
+        thread_local std::vector<CODE_T> xcode;
+        thread_local std::vector<CODE_DIS_T> cand_dis;
+        thread_local std::vector<typename C::TI> cand_ids;
+        xcode.resize(dim);
+        cand_dis.resize(nr);
+        cand_ids.resize(nr);
+
+        const T1* x_i = x + i * dim;
+        qc.encode(x_i, xcode.data());
+
+        heap_heapify<CQ>(nr, cand_dis.data(), cand_ids.data());
+        const CODE_T* y_j = qc.codes.data();
+        for (int64_t j = 0; j < ny; j++) {
+            CODE_DIS_T disij = L2sqr<const CODE_T, const CODE_T, CODE_DIS_T>(xcode.data(), y_j, dim);
+            if (CQ::cmp(cand_dis[0], disij)) {
+                heap_swap_top<CQ>(nr, cand_dis.data(), cand_ids.data(), disij, j);
+            }
+            y_j += dim;
+        }
+
+        // float re-rank of the integer candidates
+        auto* __restrict val_ = value + i * k;
+        auto* __restrict ids_ = labels + i * k;
+        heap_heapify<C>(k, val_, ids_);
+        for (int64_t r = 0; r < nr; r++) {
+            auto cid = cand_ids[r];
+            if (cid == (typename C::TI)-1) continue;
+            auto disij = L2sqr<const T1, const float, typename C::T>(x_i, centroids + (int64_t)cid * dim, dim);
+            if (C::cmp(val_[0], disij)) {
+                heap_swap_top<C>(k, val_, ids_, disij, cid);
+            }
+        }
+        heap_reorder<C>(k, val_, ids_);
+    };
+
+    if (pool != nullptr) {
+        pool->parallel_for(nx, [&](int64_t i, int) { search_one(i); });
+        return;
+    }
+#pragma omp parallel for
+    for (int64_t i = 0; i < nx; i++) {
+        search_one(i);
+    }
+}
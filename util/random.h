@@ -2,12 +2,124 @@
 
 #include <cstdint>
 #include <algorithm>
+#include <atomic>
 #include <random>
 
+// xoshiro256** (Blackman & Vigna). jump() advances the state by 2^128
+// draws, so rng_stream(seed, i) gives non-overlapping streams: give every
+// thread or every data chunk its own stream and parallel sampling is
+// reproducible for a fixed seed, whatever the thread count.
+class Xoshiro256 {
+ public:
+    using result_type = uint64_t;
+
+    explicit Xoshiro256(uint64_t seed = 1234) {
+        // splitmix64 expands the seed into a non-zero state
+        for (auto& w : s_) {
+            seed += 0x9e3779b97f4a7c15ULL;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            w = z ^ (z >> 31);
+        }
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return UINT64_MAX; }
+
+    result_type operator()() {
+        const uint64_t result = rotl(s_[1] * 5, 7) * 9;
+        const uint64_t t = s_[1] << 17;
+        s_[2] ^= s_[0];
+        s_[3] ^= s_[1];
+        s_[1] ^= s_[2];
+        s_[0] ^= s_[3];
+        s_[2] ^= t;
+        s_[3] = rotl(s_[3], 45);
+        return result;
+    }
+
+    void jump() {
+        static const uint64_t JUMP[] = {0x180ec6d33cfd0aba, 0xd5a61266f0c9392c,
+                                        0xa9582618e03fc9aa, 0x39abdc4529b1661c};
+        uint64_t t[4] = {0, 0, 0, 0};
+        for (auto j : JUMP) {
+            for (int b = 0; b < 64; b++) {
+                if (j & (1ULL << b)) {
+                    for (int w = 0; w < 4; w++) t[w] ^= s_[w];
+                }
+                (*this)();
+            }
+        }
+        for (int w = 0; w < 4; w++) s_[w] = t[w];
+    }
+
+    // uniform in [0, 1)
+    double next_double() { return ((*this)() >> 11) * (1.0 / 9007199254740992.0); }
+    float next_float() { return ((*this)() >> 40) * (1.0f / 16777216.0f); }
+
+    // uniform in [0, bound), Lemire's multiply-shift with rejection
+    uint64_t next_below(uint64_t bound) {
+        __uint128_t m = (__uint128_t)(*this)() * bound;
+        uint64_t low = (uint64_t)m;
+        if (low < bound) {
+            const uint64_t threshold = -bound % bound;
+            while (low < threshold) {
+                m = (__uint128_t)(*this)() * bound;
+                low = (uint64_t)m;
+            }
+        }
+        return (uint64_t)(m >> 64);
+    }
+
+ private:
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+    uint64_t s_[4];
+};
+
+// the stream-th independent generator of seed
+inline Xoshiro256 rng_stream(uint64_t seed, int64_t stream) {
+    Xoshiro256 rng(seed);
+    for (int64_t i = 0; i < stream; i++) rng.jump();
+    return rng;
+}
+
+inline std::atomic<uint64_t>& global_rng_seed() {
+    static std::atomic<uint64_t> seed{1234};
+    return seed;
+}
+
+inline void set_rng_seed(uint64_t seed) { global_rng_seed() = seed; }
+
+// per-thread generator, threads take consecutive streams of the global seed
+// in the order they first call it. Use rng_stream() where the sequence must
+// not depend on thread scheduling.
+inline Xoshiro256& thread_rng() {
+    static std::atomic<int64_t> next_stream{0};
+    thread_local Xoshiro256 rng = rng_stream(global_rng_seed().load(), next_stream.fetch_add(1));
+    return rng;
+}
+
 // perm[0...k-1] is the results
 // but assume `perm` has allocated n spaces
 
-void rand_perm (int64_t *perm, int64_t n, int64_t k, int64_t seed);
-float rand_float();
-int rand_int();
+inline void rand_perm (int64_t *perm, int64_t n, int64_t k, int64_t seed) {
+    Xoshiro256 rng(seed);
+    for (int64_t i = 0; i < n; i++) {
+        perm[i] = i;
+    }
+    // partial Fisher-Yates, only the first k slots are shuffled
+    for (int64_t i = 0; i < k && i + 1 < n; i++) {
+        int64_t j = i + rng.next_below(n - i);
+        std::swap(perm[i], perm[j]);
+    }
+}
+
+inline float rand_float() {
+    return thread_rng().next_float();
+}
 
+inline int rand_int() {
+    return (int)(thread_rng()() >> 33);
+}
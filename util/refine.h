@@ -0,0 +1,390 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "constants.h"
+#include "arena.h"
+#include "distance.h"
+#include "heap.h"
+#include "multi_device.h"
+#include "residual_codec.h"
+#include "statistics.h"
+#include "utils.h"
+#include "work_stealing.h"
+
+// Two-stage search. The residual codes of every cluster (residual_codec.h)
+// stay in memory; stage one scans the codes of the probed clusters and
+// keeps the refine_r best candidates per query, labelled with
+// gen_refine_id(cid, offset, query). Stage two sorts the candidates of the
+// whole batch, which orders them by (cid, offset), so every full-precision
+// vector and global id is fetched once however many queries want it, and
+// reads are planned per cluster into coalesced page runs (RefinePlan). The
+// exact L2sqr then picks the final topk per query.
+//
+// gen_refine_id keeps 8 bits of cid and 24 bits of query id: at most 256
+// clusters, batches of at most 16M queries, checked by TwoStageSearch::fits.
+
+// Page-run planner for the refine reads of one cluster file. The distinct
+// rows wanted, in ascending order, are mapped to the pages they cover;
+// pages needed by consecutive rows are merged into segments, and segments
+// at most gap_pages apart into one run. A run is one preadv: the segments
+// land in the plan buffer, the gap pages in between go to a scratch page
+// and are dropped, so a small gap costs bandwidth but no extra IO.
+// The buffer comes from the arena of the thread calling execute(), and
+// plans are pooled, so a warm re-rank allocates nothing.
+class RefinePlan {
+ public:
+    // segments per run, well below IOV_MAX with the gap iovecs
+    constexpr static size_t MAX_RUN_SEGMENTS = 256;
+
+    RefinePlan() = default;
+    RefinePlan(uint64_t row_bytes, uint64_t gap_pages, uint64_t header_bytes = 2 * sizeof(uint32_t)) {
+        reset(row_bytes, gap_pages, header_bytes);
+    }
+
+    void reset(uint64_t row_bytes, uint64_t gap_pages, uint64_t header_bytes = 2 * sizeof(uint32_t)) {
+        row_bytes_ = row_bytes;
+        gap_pages_ = gap_pages;
+        header_bytes_ = header_bytes;
+    }
+
+    // rows ascending and distinct, returns the page hits: rows all of whose
+    // pages an earlier row of the plan already needs
+    int64_t build(const uint32_t* rows, size_t nrows) {
+        runs_.clear();
+        segments_.clear();
+        row_pos_.resize(nrows);
+        total_pages_ = 0;
+        int64_t hits = 0;
+        for (size_t i = 0; i < nrows; i++) {
+            const uint64_t off = header_bytes_ + rows[i] * row_bytes_;
+            const uint64_t p0 = off / PAGESIZE, p1 = (off + row_bytes_ - 1) / PAGESIZE + 1;
+            Run* run = runs_.empty() ? nullptr : &runs_.back();
+            if (run != nullptr && p0 <= segments_.back().second) {
+                // starts on a page already needed
+                auto& seg = segments_.back();
+                if (p1 <= seg.second) hits++;
+                run->pages += std::max(seg.second, p1) - seg.second;
+                seg.second = std::max(seg.second, p1);
+            } else if (run != nullptr && p0 <= segments_.back().second + gap_pages_ &&
+                       segments_.size() - run->seg_begin < MAX_RUN_SEGMENTS) {
+                segments_.emplace_back(p0, p1);
+                run->pages += p1 - p0;
+            } else {
+                if (run != nullptr) total_pages_ += run->pages;
+                runs_.push_back({segments_.size(), 0, total_pages_ * PAGESIZE, 0});
+                segments_.emplace_back(p0, p1);
+                runs_.back().pages = p1 - p0;
+            }
+            run = &runs_.back();
+            run->need_end = off + row_bytes_;
+            // the row's byte position in the plan buffer, segments are packed
+            const auto& seg = segments_.back();
+            row_pos_[i] = run->buf_off + (run->pages - (seg.second - seg.first)) * PAGESIZE +
+                          off - seg.first * PAGESIZE;
+        }
+        if (!runs_.empty()) total_pages_ += runs_.back().pages;
+        return hits;
+    }
+
+    // one preadv per run, the runs in parallel. A partial read is resumed
+    // from where it stopped; false when the file can not be opened, a read
+    // fails or the file ends before a wanted row
+    bool execute(const std::string& file_name) {
+        int fd = open(file_name.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "can not open " << file_name << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        uint64_t max_gap = 1;
+        for (size_t s = 1; s < segments_.size(); s++) {
+            if (segments_[s].first > segments_[s - 1].second) {
+                max_gap = std::max(max_gap, segments_[s].first - segments_[s - 1].second);
+            }
+        }
+        Arena& arena = Arena::local();
+        buf_ = arena.alloc<char>(total_pages_ * PAGESIZE);
+        char* scratch = arena.alloc<char>(max_gap * PAGESIZE);
+        int64_t failed_runs = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:failed_runs)
+        for (size_t r = 0; r < runs_.size(); r++) {
+            const Run& run = runs_[r];
+            const size_t seg_end = r + 1 < runs_.size() ? runs_[r + 1].seg_begin : segments_.size();
+            iovec iov[2 * MAX_RUN_SEGMENTS];
+            int niov = 0;
+            char* dst = buf_ + run.buf_off;
+            for (size_t s = run.seg_begin; s < seg_end; s++) {
+                if (s > run.seg_begin && segments_[s].first > segments_[s - 1].second) {
+                    // the gap pages are read and dropped, all runs share the scratch
+                    iov[niov++] = {scratch, (segments_[s].first - segments_[s - 1].second) * PAGESIZE};
+                }
+                uint64_t len = (segments_[s].second - segments_[s].first) * PAGESIZE;
+                iov[niov++] = {dst, len};
+                dst += len;
+            }
+            // the last page of the file may be short, so EOF is fine once
+            // the wanted rows are in
+            const uint64_t start = segments_[run.seg_begin].first * PAGESIZE;
+            uint64_t done = 0;
+            iovec* cur = iov;
+            while (niov > 0) {
+                ssize_t got = preadv(fd, cur, niov, start + done);
+                if (got < 0 && errno == EINTR) continue;
+                if (got <= 0) break;
+                done += got;
+                // drop the filled iovecs, trim a partly filled one
+                while (niov > 0 && (size_t)got >= cur->iov_len) {
+                    got -= cur->iov_len;
+                    cur++;
+                    niov--;
+                }
+                if (niov > 0) {
+                    cur->iov_base = (char*)cur->iov_base + got;
+                    cur->iov_len -= got;
+                }
+            }
+            if (start + done < run.need_end) failed_runs++;
+        }
+        close(fd);
+        if (failed_runs > 0) {
+            std::cerr << "short read of " << file_name << ": " << failed_runs << " of " << runs_.size()
+                      << " runs end before their rows" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    const char* row(size_t i) const { return buf_ + row_pos_[i]; }
+
+    int64_t num_runs() const { return runs_.size(); }
+
+    // pages transferred, gap pages included
+    int64_t pages_read() const {
+        int64_t pages = 0;
+        for (size_t r = 0; r < runs_.size(); r++) {
+            const size_t last = r + 1 < runs_.size() ? runs_[r + 1].seg_begin - 1 : segments_.size() - 1;
+            pages += segments_[last].second - segments_[runs_[r].seg_begin].first;
+        }
+        return pages;
+    }
+
+ private:
+    struct Run {
+        // first segment of the run, the run ends where the next one starts
+        size_t seg_begin;
+        // needed pages of all segments
+        uint64_t pages;
+        // where the run lands in the plan buffer
+        uint64_t buf_off;
+        // file offset past the last wanted row, a read may stop at EOF after it
+        uint64_t need_end;
+    };
+
+    uint64_t row_bytes_ = 0;
+    uint64_t gap_pages_ = 0;
+    uint64_t header_bytes_ = 0;
+    std::vector<Run> runs_;
+    // needed pages [first, second), ascending
+    std::vector<std::pair<uint64_t, uint64_t>> segments_;
+    std::vector<uint64_t> row_pos_;
+    uint64_t total_pages_ = 0;
+    char* buf_ = nullptr;
+};
+
+template<typename T>
+class TwoStageSearch {
+ public:
+    // limits of the gen_refine_id packing
+    static constexpr uint32_t MAX_CLUSTERS = 1u << 8;
+    static constexpr int64_t MAX_QUERIES = 1 << 24;
+
+    // the cid and query id fields must hold every cluster and query, a
+    // larger index would alias in the candidate keys; the caller checks
+    // this before building the search
+    static bool fits(uint32_t number_centroids, int64_t nq) {
+        if (number_centroids > MAX_CLUSTERS || nq > MAX_QUERIES) {
+            std::cerr << "two stage search supports at most " << MAX_CLUSTERS << " clusters and "
+                      << MAX_QUERIES << " queries, got " << number_centroids << " and " << nq << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // load the residual codes of all clusters of index_path into memory
+    // gap_pages: unneeded pages read to merge two page runs of a cluster into one IO
+    TwoStageSearch(const std::string& index_path, const float* centroids, uint32_t number_centroids, uint32_t dim,
+                   uint64_t gap_pages = 1)
+        : index_path_(index_path), centroids_(centroids), dim_(dim), gap_pages_(gap_pages),
+          clusters_(number_centroids) {
+        assert(number_centroids <= MAX_CLUSTERS);
+        for (uint32_t c = 0; c < number_centroids; c++) {
+            read_residual_cluster(index_path_, c, clusters_[c]);
+            assert(clusters_[c].dim == dim);
+            code_bytes_ += clusters_[c].codes.size();
+        }
+        std::cout << "load residual codes of " << number_centroids << " clusters, "
+                  << code_bytes_ << " bytes" << std::endl;
+    }
+
+    uint64_t code_bytes() const { return code_bytes_; }
+
+    // read the full-precision clusters from the replicas of layout instead
+    // of index_path, every cluster read goes to its least busy device
+    void set_layout(DeviceLayout* layout) { layout_ = layout; }
+
+    // idx: (nq, stride) coarse search result, the first nprobe columns are
+    // scanned; dis / ids: (nq, topk) exact distances and global ids, ascending.
+    // pool, when given, schedules the per-query compressed scan, whose cost
+    // follows the sizes of the probed clusters. false when a cluster file
+    // could not be read, dis / ids are then incomplete
+    bool search(const T* query, int64_t nq, const uint32_t* idx, int64_t stride, int64_t nprobe,
+                int64_t topk, int64_t refine_r, float* dis, uint32_t* ids, refine_stat& stat,
+                WorkStealingPool* pool = nullptr) const {
+        assert(nq <= MAX_QUERIES);
+        refine_r = std::max(refine_r, topk);
+        auto t0 = std::chrono::steady_clock::now();
+        ArenaScope scratch;
+        uint64_t* candidates = scratch.alloc<uint64_t>(nq * refine_r);
+        compressed_scan(query, nq, idx, stride, nprobe, refine_r, candidates, pool);
+        auto t1 = std::chrono::steady_clock::now();
+        if (!rerank(query, nq, topk, candidates, nq * refine_r, dis, ids, stat)) return false;
+        auto t2 = std::chrono::steady_clock::now();
+        std::cout << "two-stage search of " << nq << " queries: compressed scan "
+                  << std::chrono::duration<double>(t1 - t0).count() << " s, re-rank "
+                  << std::chrono::duration<double>(t2 - t1).count() << " s" << std::endl;
+        return true;
+    }
+
+ private:
+    void compressed_scan(const T* query, int64_t nq, const uint32_t* idx, int64_t stride, int64_t nprobe,
+                         int64_t refine_r, uint64_t* candidates, WorkStealingPool* pool) const {
+        using C = CMax<float, uint64_t>;
+        auto scan_one = [&](int64_t q) {
+            ArenaScope scratch;
+            float* heap_dis = scratch.alloc<float>(refine_r);
+            uint64_t* heap_ids = candidates + q * refine_r;
+            heap_heapify<C>(refine_r, heap_dis, heap_ids);
+            const T* xq = query + q * dim_;
+            for (int64_t j = 0; j < nprobe; j++) {
+                const uint32_t cid = idx[q * stride + j];
+                const ResidualCluster& rc = clusters_[cid];
+                ResidualScanner scanner(xq, centroids_ + (uint64_t)cid * dim_, rc);
+                for (int64_t i = 0; i < rc.n; i++) {
+                    float d = scanner.distance(i);
+                    if (C::cmp(heap_dis[0], d)) {
+                        heap_swap_top<C>(refine_r, heap_dis, heap_ids, d, gen_refine_id(cid, i, q));
+                    }
+                }
+            }
+        };
+
+        if (pool != nullptr) {
+            pool->parallel_for(nq, [&](int64_t q, int) { scan_one(q); });
+            return;
+        }
+#pragma omp parallel for schedule(dynamic)
+        for (int64_t q = 0; q < nq; q++) {
+            scan_one(q);
+        }
+    }
+
+    bool rerank(const T* query, int64_t nq, int64_t topk, uint64_t* candidates, size_t ncandidates,
+                float* dis, uint32_t* ids, refine_stat& stat) const {
+        using C = CMax<float, uint32_t>;
+        for (int64_t q = 0; q < nq; q++) heap_heapify<C>(topk, dis + q * topk, ids + q * topk);
+        ArenaScope scratch;
+        float* qf = scratch.alloc<float>((uint64_t)nq * dim_);
+        for (uint64_t j = 0; j < (uint64_t)nq * dim_; j++) qf[j] = (float)query[j];
+
+        // unfilled heap slots keep the -1 label and sort last
+        std::sort(candidates, candidates + ncandidates);
+        const size_t end = std::lower_bound(candidates, candidates + ncandidates,
+                                            std::numeric_limits<uint64_t>::max()) - candidates;
+        uint32_t* rows = scratch.alloc<uint32_t>(end);
+        size_t* row_begin = scratch.alloc<size_t>(end + 1);
+        for (size_t b = 0; b < end;) {
+            uint32_t cid, offset, q;
+            parse_refine_id(candidates[b], cid, offset, q);
+            // the candidates of cluster cid, each distinct offset once
+            size_t nrows = 0;
+            size_t e = b;
+            for (; e < end && (candidates[e] >> 56) == cid; e++) {
+                if (e == b || (candidates[e] >> 24) != (candidates[e - 1] >> 24)) {
+                    rows[nrows] = (candidates[e] >> 24) & 0xffffffff;
+                    row_begin[nrows++] = e;
+                }
+            }
+            row_begin[nrows] = e;
+
+            ArenaScope io_buffers;
+            auto vectors = plans_.acquire(), gids = plans_.acquire();
+            vectors->reset(dim_ * sizeof(T), gap_pages_);
+            gids->reset(sizeof(uint32_t), gap_pages_);
+            stat.vector_page_hit_cnt += vectors->build(rows, nrows);
+            stat.id_page_hit_cnt += gids->build(rows, nrows);
+            bool read_ok;
+            if (layout_ != nullptr) {
+                auto read = layout_->route(cid, (vectors->pages_read() + gids->pages_read()) * PAGESIZE);
+                read_ok = vectors->execute(layout_->cluster_file(cid, read.device(), RAWDATA)) &&
+                          gids->execute(layout_->cluster_file(cid, read.device(), GLOBAL_IDS));
+            } else {
+                read_ok = vectors->execute(cluster_file(cid, RAWDATA)) &&
+                          gids->execute(cluster_file(cid, GLOBAL_IDS));
+            }
+            if (!read_ok) return false;
+            stat.vector_load_cnt += vectors->num_runs();
+            stat.id_load_cnt += gids->num_runs();
+            stat.read_page_cnt += vectors->pages_read() + gids->pages_read();
+            stat.different_offset_cnt += nrows;
+
+            for (size_t r = 0; r < nrows; r++) {
+                const T* vec = (const T*)vectors->row(r);
+                const uint32_t gid = *(const uint32_t*)gids->row(r);
+                for (size_t i = row_begin[r]; i < row_begin[r + 1]; i++) {
+                    const uint64_t qid = candidates[i] & 0x00ffffff;
+                    float exact = L2sqr<const T, const float, float>(vec, qf + qid * dim_, dim_);
+                    if (C::cmp(dis[qid * topk], exact)) {
+                        heap_swap_top<C>(topk, dis + qid * topk, ids + qid * topk, exact, gid);
+                    }
+                }
+            }
+            b = e;
+        }
+        for (int64_t q = 0; q < nq; q++) heap_reorder<C>(topk, dis + q * topk, ids + q * topk);
+        stat.publish();
+        return true;
+    }
+
+    std::string cluster_file(uint32_t cid, const char* file_type) const {
+        return index_path_ + CLUSTER + std::to_string(cid) + file_type + BIN;
+    }
+
+    std::string index_path_;
+    const float* centroids_;
+    uint32_t dim_;
+    uint64_t gap_pages_;
+    std::vector<ResidualCluster> clusters_;
+    uint64_t code_bytes_ = 0;
+    DeviceLayout* layout_ = nullptr;
+    mutable ObjectPool<RefinePlan> plans_;
+};
+
+inline void print_refine_stat(const refine_stat& stat) {
+    std::cout << "refine: " << stat.different_offset_cnt << " distinct vectors, "
+              << stat.vector_load_cnt << " vector reads, " << stat.vector_page_hit_cnt << " page hits, "
+              << stat.id_load_cnt << " id reads, " << stat.id_page_hit_cnt << " page hits, "
+              << stat.read_page_cnt << " pages read" << std::endl;
+}
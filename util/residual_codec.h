@@ -0,0 +1,251 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <immintrin.h>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "arena.h"
+#include "constants.h"
+#include "defines.h"
+#include "distance.h"
+#include "heap.h"
+#include "utils.h"
+
+// Residual-encoded cluster storage. A cluster keeps x - centroid instead
+// of x, quantized with
+//   INT8  one scale per cluster, code = round(res / scale), 1 byte per dim
+//   SQ4   per cluster and dimension vmin / step, 16 levels, 2 dims per byte
+// Residuals are much narrower than the vectors, so the codes lose little;
+// SQ4 halves a uint8 cluster, INT8 and SQ4 shrink a float cluster 4x / 8x.
+//
+// The scan never decodes a vector: the query residual q - centroid is
+// computed once per probed cluster and the AVX2 kernels below take the
+// distance straight from the codes.
+//
+// files per cluster:
+//   CLUSTER + cid + RESIDUAL_CODES + BIN   uint8, (n, code_size)
+//   CLUSTER + cid + RESIDUAL_PARAMS + BIN  float, (1, 2 + 2 * dim):
+//                                          codec, scale, vmin[dim], step[dim]
+
+struct ResidualCluster {
+    ResidualCodec codec = ResidualCodec::None;
+    int64_t n = 0;
+    int64_t dim = 0;
+    float scale = 1;
+    std::vector<float> vmin;
+    std::vector<float> step;
+    std::vector<uint8_t> codes;
+
+    static int64_t code_size(ResidualCodec codec, int64_t dim) {
+        return codec == ResidualCodec::SQ4 ? (dim + 1) / 2 : dim;
+    }
+    int64_t code_size() const { return code_size(codec, dim); }
+    const uint8_t* code(int64_t i) const { return codes.data() + i * code_size(); }
+};
+
+template<typename T>
+void encode_residual(const T* data, int64_t n, int64_t dim, const float* centroid,
+                     ResidualCodec codec, ResidualCluster& rc) {
+    rc.codec = codec;
+    rc.n = n;
+    rc.dim = dim;
+    rc.codes.assign(n * rc.code_size(), 0);
+    std::vector<float> res(n * dim);
+    for (int64_t i = 0; i < n; i++) {
+        compute_residual<const T, const float, float>(data + i * dim, centroid, res.data() + i * dim, dim);
+    }
+
+    if (codec == ResidualCodec::INT8) {
+        float amax = 0;
+        for (auto r : res) amax = std::max(amax, std::fabs(r));
+        rc.scale = amax > 0 ? amax / 127 : 1;
+        for (int64_t j = 0; j < n * dim; j++) {
+            int v = (int)std::lround(res[j] / rc.scale);
+            rc.codes[j] = (uint8_t)(int8_t)std::min(127, std::max(-127, v));
+        }
+        return;
+    }
+
+    rc.vmin.assign(dim, std::numeric_limits<float>::max());
+    rc.step.assign(dim, 0);
+    std::vector<float> vmax(dim, std::numeric_limits<float>::lowest());
+    for (int64_t i = 0; i < n; i++) {
+        for (int64_t d = 0; d < dim; d++) {
+            rc.vmin[d] = std::min(rc.vmin[d], res[i * dim + d]);
+            vmax[d] = std::max(vmax[d], res[i * dim + d]);
+        }
+    }
+    for (int64_t d = 0; d < dim; d++) {
+        rc.step[d] = vmax[d] > rc.vmin[d] ? (vmax[d] - rc.vmin[d]) / 15 : 1;
+    }
+    // dim 2i goes to the low nibble of byte i, dim 2i + 1 to the high one
+    for (int64_t i = 0; i < n; i++) {
+        uint8_t* code = rc.codes.data() + i * rc.code_size();
+        for (int64_t d = 0; d < dim; d++) {
+            int v = (int)std::lround((res[i * dim + d] - rc.vmin[d]) / rc.step[d]);
+            code[d / 2] |= (uint8_t)(std::min(15, std::max(0, v)) << (4 * (d & 1)));
+        }
+    }
+}
+
+inline float hsum256(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_hadd_ps(s, s);
+    s = _mm_hadd_ps(s, s);
+    return _mm_cvtss_f32(s);
+}
+
+// || q - code || ^ 2 with q already divided by the cluster scale
+inline float l2sqr_int8_code(const float* q, const uint8_t* code, int64_t dim) {
+    const int8_t* c = (const int8_t*)code;
+    __m256 acc = _mm256_setzero_ps();
+    int64_t d = 0;
+    for (; d + 8 <= dim; d += 8) {
+        __m128i c8 = _mm_loadl_epi64((const __m128i*)(c + d));
+        __m256 cf = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(c8));
+        __m256 t = _mm256_sub_ps(_mm256_loadu_ps(q + d), cf);
+        acc = _mm256_fmadd_ps(t, t, acc);
+    }
+    float dis = hsum256(acc);
+    for (; d < dim; d++) {
+        float t = q[d] - c[d];
+        dis += t * t;
+    }
+    return dis;
+}
+
+// sum_d (a[d] + step[d] * code[d]) ^ 2 with a = vmin - q, 2 dims per code byte
+inline float l2sqr_sq4_code(const float* a, const float* step, const uint8_t* code, int64_t dim) {
+    const __m128i low_mask = _mm_set1_epi8(0x0f);
+    __m256 acc = _mm256_setzero_ps();
+    int64_t d = 0;
+    for (; d + 8 <= dim; d += 8) {
+        uint32_t packed;
+        memcpy(&packed, code + d / 2, sizeof(packed));
+        __m128i b = _mm_cvtsi32_si128(packed);
+        __m128i lo = _mm_and_si128(b, low_mask);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(b, 4), low_mask);
+        __m256 cf = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_unpacklo_epi8(lo, hi)));
+        __m256 t = _mm256_fmadd_ps(_mm256_loadu_ps(step + d), cf, _mm256_loadu_ps(a + d));
+        acc = _mm256_fmadd_ps(t, t, acc);
+    }
+    float dis = hsum256(acc);
+    for (; d < dim; d++) {
+        float t = a[d] + step[d] * ((code[d / 2] >> (4 * (d & 1))) & 0x0f);
+        dis += t * t;
+    }
+    return dis;
+}
+
+// Per-query view of one cluster: the query residual is prepared once and
+// every code of the cluster is then one kernel call. The residual lives in
+// the calling thread's arena until the scanner goes out of scope, so a
+// scanner per probed cluster costs no heap allocation.
+class ResidualScanner {
+ public:
+    template<typename T>
+    ResidualScanner(const T* query, const float* centroid, const ResidualCluster& rc)
+        : rc_(rc), q_(scratch_.alloc<float>(rc.dim)) {
+        compute_residual<const T, const float, float>(query, centroid, q_, rc.dim);
+        if (rc.codec == ResidualCodec::INT8) {
+            for (int64_t d = 0; d < rc.dim; d++) q_[d] /= rc.scale;
+            factor_ = rc.scale * rc.scale;
+        } else {
+            for (int64_t d = 0; d < rc.dim; d++) q_[d] = rc.vmin[d] - q_[d];
+        }
+    }
+
+    float distance(int64_t i) const {
+        if (rc_.codec == ResidualCodec::INT8) return factor_ * l2sqr_int8_code(q_, rc_.code(i), rc_.dim);
+        return l2sqr_sq4_code(q_, rc_.step.data(), rc_.code(i), rc_.dim);
+    }
+
+ private:
+    const ResidualCluster& rc_;
+    // declared before q_, which it backs
+    ArenaScope scratch_;
+    float* q_;
+    float factor_ = 1;
+};
+
+// push the cluster into a max-heap of size k (C = CMax<float, ...>),
+// ids[i] is the label of code i
+template<class C, typename T>
+void residual_scan(const T* query, const float* centroid, const ResidualCluster& rc,
+                   const typename C::TI* ids, int64_t k,
+                   typename C::T* heap_dis, typename C::TI* heap_ids) {
+    ResidualScanner scanner(query, centroid, rc);
+    for (int64_t i = 0; i < rc.n; i++) {
+        float dis = scanner.distance(i);
+        if (C::cmp(heap_dis[0], dis)) {
+            heap_swap_top<C>(k, heap_dis, heap_ids, dis, ids[i]);
+        }
+    }
+}
+
+inline std::string residual_file(const std::string& index_path, uint32_t cid, const char* file_type) {
+    return index_path + CLUSTER + std::to_string(cid) + file_type + BIN;
+}
+
+inline void write_residual_cluster(const std::string& index_path, uint32_t cid, const ResidualCluster& rc) {
+    std::vector<float> params(2 + 2 * rc.dim, 0);
+    params[0] = (float)(int)rc.codec;
+    params[1] = rc.scale;
+    std::copy(rc.vmin.begin(), rc.vmin.end(), params.begin() + 2);
+    std::copy(rc.step.begin(), rc.step.end(), params.begin() + 2 + rc.dim);
+    write_bin_file<float>(residual_file(index_path, cid, RESIDUAL_PARAMS), params.data(), 1, params.size());
+    write_bin_file<uint8_t>(residual_file(index_path, cid, RESIDUAL_CODES),
+                            const_cast<uint8_t*>(rc.codes.data()), rc.n, rc.code_size());
+}
+
+inline void read_residual_cluster(const std::string& index_path, uint32_t cid, ResidualCluster& rc) {
+    uint32_t np, nparams, n, code_size;
+    float* params = nullptr;
+    read_bin_file<float>(residual_file(index_path, cid, RESIDUAL_PARAMS), params, np, nparams);
+    std::unique_ptr<float[]> guard(params);
+    rc.codec = (ResidualCodec)(int)params[0];
+    rc.scale = params[1];
+    rc.dim = (nparams - 2) / 2;
+    if (rc.codec == ResidualCodec::SQ4) {
+        rc.vmin.assign(params + 2, params + 2 + rc.dim);
+        rc.step.assign(params + 2 + rc.dim, params + 2 + 2 * rc.dim);
+    }
+    get_bin_metadata(residual_file(index_path, cid, RESIDUAL_CODES), n, code_size);
+    assert((int64_t)code_size == rc.code_size());
+    rc.n = n;
+    rc.codes.resize((uint64_t)n * code_size);
+    uint8_t* codes = rc.codes.data();
+    read_bin_file<uint8_t>(residual_file(index_path, cid, RESIDUAL_CODES), codes, n, code_size);
+}
+
+// encode every raw cluster of index_path against its centroid, returns the
+// (raw, encoded) bytes
+template<typename T>
+std::pair<uint64_t, uint64_t> encode_index_residual(const std::string& index_path, const float* centroids,
+                                                    uint32_t K, uint32_t dim, ResidualCodec codec) {
+    uint64_t raw_bytes = 0, code_bytes = 0;
+    for (uint32_t c = 0; c < K; c++) {
+        uint32_t n, d;
+        T* data = nullptr;
+        read_bin_file<T>(residual_file(index_path, c, RAWDATA), data, n, d);
+        std::unique_ptr<T[]> guard(data);
+        assert(d == dim);
+        ResidualCluster rc;
+        encode_residual<T>(data, n, dim, centroids + (uint64_t)c * dim, codec, rc);
+        write_residual_cluster(index_path, c, rc);
+        raw_bytes += (uint64_t)n * dim * sizeof(T);
+        code_bytes += rc.codes.size();
+    }
+    std::cout << "residual encode " << K << " clusters: " << raw_bytes << " raw bytes -> "
+              << code_bytes << " code bytes" << std::endl;
+    return {raw_bytes, code_bytes};
+}
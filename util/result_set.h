@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "heap.h"
+
+// Search results of nq queries, k neighbors each, as two flat nq * k
+// arrays: distances and ids are each contiguous, a row is k consecutive
+// entries of both, so knn / merge write a row with plain pointers and the
+// comp files are one bulk read or write per array.
+//
+// comp format (also the big-ann ground truth):
+//   uint32 nq, uint32 k, FILE_IDT ids[nq * k], FILE_DISTT dis[nq * k]
+// sift format: per query uint32 k followed by k (IDT, DISTT) pairs
+
+template<typename DISTT, typename IDT>
+struct ResultSet {
+    int64_t nq = 0;
+    int64_t k = 0;
+    std::vector<DISTT> dis;
+    std::vector<IDT> ids;
+
+    struct Row {
+        DISTT* dis;
+        IDT* ids;
+        int64_t k;
+    };
+    struct ConstRow {
+        const DISTT* dis;
+        const IDT* ids;
+        int64_t k;
+    };
+
+    ResultSet() = default;
+    ResultSet(int64_t nq, int64_t k) { resize(nq, k); }
+
+    void resize(int64_t nq_, int64_t k_) {
+        nq = nq_;
+        k = k_;
+        dis.resize(nq * k);
+        ids.resize(nq * k);
+    }
+
+    Row row(int64_t q) { return {dis.data() + q * k, ids.data() + q * k, k}; }
+    ConstRow row(int64_t q) const { return {dis.data() + q * k, ids.data() + q * k, k}; }
+
+    // every row an empty heap of comparator C
+    template<class C>
+    void heapify() {
+        for (int64_t q = 0; q < nq; q++) heap_heapify<C>(k, dis.data() + q * k, ids.data() + q * k);
+    }
+};
+
+namespace result_set_detail {
+
+// read n FILE_T into out, converting to T; one bulk read either way
+template<typename FILE_T, typename T>
+inline void read_array(std::ifstream& in, T* out, size_t n) {
+    if (std::is_same<FILE_T, T>::value) {
+        in.read((char*)out, n * sizeof(T));
+        return;
+    }
+    std::vector<FILE_T> buf(n);
+    in.read((char*)buf.data(), n * sizeof(FILE_T));
+    for (size_t i = 0; i < n; i++) out[i] = static_cast<T>(buf[i]);
+}
+
+template<typename FILE_T, typename T>
+inline void write_array(std::ofstream& out, const T* data, size_t n) {
+    if (std::is_same<FILE_T, T>::value) {
+        out.write((const char*)data, n * sizeof(T));
+        return;
+    }
+    std::vector<FILE_T> buf(data, data + n);
+    out.write((const char*)buf.data(), n * sizeof(FILE_T));
+}
+
+}  // namespace result_set_detail
+
+template<typename FILE_DISTT, typename FILE_IDT, typename DISTT, typename IDT>
+void read_comp(ResultSet<DISTT, IDT>& rs, const std::string& file_name) {
+    std::ifstream in(file_name, std::ios::binary);
+    uint32_t header[2] = {0, 0};
+    in.read((char*)header, sizeof(header));
+    rs.resize(header[0], header[1]);
+    result_set_detail::read_array<FILE_IDT>(in, rs.ids.data(), rs.ids.size());
+    result_set_detail::read_array<FILE_DISTT>(in, rs.dis.data(), rs.dis.size());
+}
+
+template<typename FILE_DISTT, typename FILE_IDT, typename DISTT, typename IDT>
+void write_comp(const ResultSet<DISTT, IDT>& rs, const std::string& file_name) {
+    std::ofstream out(file_name, std::ios::binary);
+    uint32_t header[2] = {(uint32_t)rs.nq, (uint32_t)rs.k};
+    out.write((char*)header, sizeof(header));
+    result_set_detail::write_array<FILE_IDT>(out, rs.ids.data(), rs.ids.size());
+    result_set_detail::write_array<FILE_DISTT>(out, rs.dis.data(), rs.dis.size());
+    std::cout << "write comp file to " << file_name << ", nq = " << rs.nq << ", k = " << rs.k << std::endl;
+}
+
+// the first nq queries of a sift result, every query must have the same k;
+// the file is read in one go and split into the two arrays
+template<typename DISTT, typename IDT>
+void read_sift(ResultSet<DISTT, IDT>& rs, const std::string& file_name, uint32_t nq = 100) {
+    std::ifstream in(file_name, std::ios::binary | std::ios::ate);
+    const uint64_t fsize = in.tellg();
+    in.seekg(0);
+    uint32_t k = 0;
+    in.read((char*)&k, sizeof(k));
+    in.seekg(0);
+    const uint64_t row_bytes = sizeof(uint32_t) + (uint64_t)k * (sizeof(IDT) + sizeof(DISTT));
+    nq = std::min<uint64_t>(nq, fsize / row_bytes);
+    std::vector<char> buf(nq * row_bytes);
+    in.read(buf.data(), buf.size());
+    rs.resize(nq, k);
+    const char* p = buf.data();
+    for (uint32_t q = 0; q < nq; q++) {
+        assert(*(const uint32_t*)p == k);
+        p += sizeof(uint32_t);
+        for (uint32_t j = 0; j < k; j++) {
+            memcpy(&rs.ids[q * k + j], p, sizeof(IDT));
+            memcpy(&rs.dis[q * k + j], p + sizeof(IDT), sizeof(DISTT));
+            p += sizeof(IDT) + sizeof(DISTT);
+        }
+    }
+}
+
+template<typename DISTT, typename IDT>
+void print_vec_id_dis(const ResultSet<DISTT, IDT>& rs, const std::string& msg) {
+    std::cout << "<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<" << std::endl;
+    std::cout << msg << std::endl;
+    for (int64_t q = 0; q < rs.nq; q++) {
+        auto r = rs.row(q);
+        for (int64_t j = 0; j < r.k; j++) {
+            std::cout << "(" << r.ids[j] << ", " << r.dis[j] << ") ";
+        }
+        std::cout << std::endl;
+    }
+    std::cout << "<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<" << std::endl;
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Exact LRU reuse distances of a cluster probe stream, Mattson's stack
+// algorithm on a Fenwick tree. Every cluster keeps a weight (its bytes) at
+// the position of its last access; the stack distance of an access is the
+// weight between the previous access of the same cluster and now, plus its
+// own weight, i.e. the bytes of the distinct clusters touched since. An LRU
+// cache of C bytes hits exactly the accesses with distance <= C, so one
+// pass gives the whole miss-ratio curve.
+//
+// Positions are renumbered when the tree is full: only the M live clusters
+// keep a position, so the tree holds 2M slots and an access is O(log M)
+// amortized, whatever the stream length.
+
+class FenwickTree {
+ public:
+    void reset(size_t n) { t_.assign(n + 1, 0); }
+
+    void add(size_t i, int64_t v) {
+        for (i++; i < t_.size(); i += i & -i) t_[i] += v;
+    }
+
+    // sum of [0, i)
+    int64_t prefix(size_t i) const {
+        int64_t s = 0;
+        for (; i > 0; i -= i & -i) s += t_[i];
+        return s;
+    }
+
+ private:
+    std::vector<int64_t> t_;
+};
+
+struct MissRatioPoint {
+    uint64_t cache_size;
+    double miss_ratio;
+    // missed bytes over accessed bytes
+    double byte_miss_ratio;
+};
+
+class ReuseDistanceAnalyzer {
+ public:
+    // weights[c] is the size of cluster c, 1 per cluster counts the cache in clusters
+    explicit ReuseDistanceAnalyzer(std::vector<uint64_t> weights)
+        : weights_(std::move(weights)), last_pos_(weights_.size(), -1) {
+        capacity_ = std::max<size_t>(2 * weights_.size(), 1024);
+        tree_.reset(capacity_);
+    }
+
+    void access(uint32_t c) {
+        const uint64_t w = weights_[c];
+        accesses_++;
+        accessed_bytes_ += w;
+        if (last_pos_[c] < 0) {
+            cold_++;
+            cold_bytes_ += w;
+        } else {
+            uint64_t dist = tree_.prefix(now_) - tree_.prefix(last_pos_[c] + 1) + w;
+            auto& h = hist_[dist];
+            h.first++;
+            h.second += w;
+            tree_.add(last_pos_[c], -(int64_t)w);
+            last_pos_[c] = -1;
+        }
+        if (now_ == (int64_t)capacity_) compact();
+        tree_.add(now_, w);
+        last_pos_[c] = now_++;
+    }
+
+    // (nq, stride) coarse search result, the first nprobe columns in query order
+    void access_probes(const uint32_t* idx, int64_t nq, int64_t stride, int64_t nprobe) {
+        for (int64_t q = 0; q < nq; q++) {
+            for (int64_t j = 0; j < nprobe; j++) access(idx[q * stride + j]);
+        }
+    }
+
+    // one point per distinct distance, cache sizes ascending; the curve
+    // starts at cache size 0 where everything misses
+    std::vector<MissRatioPoint> miss_ratio_curve() const {
+        std::vector<std::pair<uint64_t, std::pair<uint64_t, uint64_t>>> dists(hist_.begin(), hist_.end());
+        std::sort(dists.begin(), dists.end());
+        std::vector<MissRatioPoint> curve;
+        if (accesses_ == 0) return curve;
+        uint64_t misses = accesses_, missed_bytes = accessed_bytes_;
+        curve.push_back({0, 1.0, 1.0});
+        for (auto& d : dists) {
+            misses -= d.second.first;
+            missed_bytes -= d.second.second;
+            curve.push_back({d.first, (double)misses / accesses_,
+                             accessed_bytes_ ? (double)missed_bytes / accessed_bytes_ : 0});
+        }
+        return curve;
+    }
+
+    // smallest cache reaching the target miss ratio, 0 if none does
+    uint64_t cache_size_for(double miss_ratio) const {
+        for (auto& p : miss_ratio_curve()) {
+            if (p.miss_ratio <= miss_ratio) return p.cache_size;
+        }
+        return 0;
+    }
+
+    void print() const {
+        std::cout << "reuse distance: " << accesses_ << " accesses, " << cold_ << " cold, "
+                  << hist_.size() << " distinct distances" << std::endl;
+        for (double target : {0.5, 0.2, 0.1, 0.05, 0.01}) {
+            uint64_t size = cache_size_for(target);
+            std::cout << "miss ratio " << target << ": ";
+            if (size == 0) {
+                std::cout << "not reached, cold misses are " << (double)cold_ / accesses_ << std::endl;
+            } else {
+                std::cout << "cache size " << size << std::endl;
+            }
+        }
+    }
+
+    void write(const std::string& file_name) const {
+        std::ofstream os(file_name);
+        os << "cache_size\tmiss_ratio\tbyte_miss_ratio\n";
+        for (auto& p : miss_ratio_curve()) {
+            os << p.cache_size << "\t" << p.miss_ratio << "\t" << p.byte_miss_ratio << "\n";
+        }
+        std::cout << "write miss ratio curve to " << file_name << std::endl;
+    }
+
+ private:
+    // renumber the live clusters 0..L-1 in access order and rebuild the tree
+    void compact() {
+        std::vector<std::pair<int64_t, uint32_t>> live;
+        for (uint32_t c = 0; c < last_pos_.size(); c++) {
+            if (last_pos_[c] >= 0) live.emplace_back(last_pos_[c], c);
+        }
+        std::sort(live.begin(), live.end());
+        tree_.reset(capacity_);
+        for (size_t i = 0; i < live.size(); i++) {
+            last_pos_[live[i].second] = i;
+            tree_.add(i, weights_[live[i].second]);
+        }
+        now_ = live.size();
+    }
+
+    std::vector<uint64_t> weights_;
+    std::vector<int64_t> last_pos_;
+    size_t capacity_;
+    FenwickTree tree_;
+    int64_t now_ = 0;
+
+    uint64_t accesses_ = 0;
+    uint64_t accessed_bytes_ = 0;
+    uint64_t cold_ = 0;
+    uint64_t cold_bytes_ = 0;
+    // distance -> (accesses, bytes)
+    std::unordered_map<uint64_t, std::pair<uint64_t, uint64_t>> hist_;
+};
+
+// cluster sizes from the metas, rows * row_bytes each; 1 per cluster without metas
+inline std::vector<uint64_t> cluster_weights(const std::vector<std::vector<uint32_t>>& metas,
+                                             uint32_t number_centroids, uint64_t row_bytes) {
+    std::vector<uint64_t> weights(number_centroids, metas.empty() ? 1 : 0);
+    for (size_t c = 0; c < metas.size() && c < number_centroids; c++) {
+        for (auto rows : metas[c]) weights[c] += (uint64_t)rows * row_bytes;
+    }
+    return weights;
+}
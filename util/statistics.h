@@ -3,6 +3,7 @@
 #include <algorithm>
 #include <math.h>
 #include "util/distance.h"
+#include "util/metrics.h"
 
 struct refine_stat {
     int64_t vector_load_cnt;
@@ -10,7 +11,21 @@ struct refine_stat {
     int64_t vector_page_hit_cnt;
     int64_t id_page_hit_cnt;
     int64_t different_offset_cnt;
-    refine_stat():vector_page_hit_cnt(0), vector_load_cnt(0), id_page_hit_cnt(0), id_load_cnt(0), different_offset_cnt(0) {}
+    // pages transferred by the coalesced reads, gap pages included
+    int64_t read_page_cnt;
+    refine_stat():vector_load_cnt(0), id_load_cnt(0), vector_page_hit_cnt(0), id_page_hit_cnt(0), different_offset_cnt(0), read_page_cnt(0) {}
+
+    // add this refine round to the registry counters
+    void publish() const {
+        auto& registry = MetricsRegistry::instance();
+        registry.counter("refine_vector_load").add(vector_load_cnt);
+        registry.counter("refine_id_load").add(id_load_cnt);
+        registry.counter("refine_vector_page_hit").add(vector_page_hit_cnt);
+        registry.counter("refine_id_page_hit").add(id_page_hit_cnt);
+        registry.counter("refine_different_offset").add(different_offset_cnt);
+        registry.counter("refine_read_pages").add(read_page_cnt);
+        registry.counter(METRIC_PAGE_HITS).add(vector_page_hit_cnt + id_page_hit_cnt);
+    }
 };
 
 template<typename T>
@@ -1,22 +1,87 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
+#include <string>
+#include <vector>
 
-inline int64_t get_L3_Size() {
-    static int64_t l3_size = -1;
-    constexpr int64_t KB = 1024;
-    if (l3_size == -1) {
-        l3_size = 12 * KB * KB; // 12M
-
-        FILE* file = fopen("/sys/devices/system/cpu/cpu0/cache/index3/size","r");
-        int32_t result = 0;
-        if (file){
-            if (1 == fscanf(file, "%dK", &result)) {
-                l3_size = result * KB;
-            }
-            fclose(file);
+// size in bytes of the level `level` cache seen by cpu, -1 if sysfs does not
+// tell; the cache index of a level differs between machines, so every
+// index is checked
+inline int64_t get_cache_size(int cpu, int level) {
+    const std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cache/index";
+    for (int index = 0;; index++) {
+        FILE* file = fopen((dir + std::to_string(index) + "/level").c_str(), "r");
+        if (!file) return -1;
+        int l = 0;
+        bool match = fscanf(file, "%d", &l) == 1 && l == level;
+        fclose(file);
+        if (!match) continue;
+
+        file = fopen((dir + std::to_string(index) + "/size").c_str(), "r");
+        if (!file) return -1;
+        int64_t size = -1;
+        long long value = 0;
+        char unit = 0;
+        int got = fscanf(file, "%lld%c", &value, &unit);
+        if (got >= 1) {
+            size = value;
+            if (got == 2 && unit == 'K') size <<= 10;
+            if (got == 2 && unit == 'M') size <<= 20;
+            if (got == 2 && unit == 'G') size <<= 30;
         }
+        fclose(file);
+        return size;
+    }
+}
+
+// L3 of the socket of cpu, 12M when unknown
+inline int64_t get_L3_Size(int cpu) {
+    constexpr int64_t KB = 1024;
+    constexpr int MAX_CPUS = 4096;
+    static std::atomic<int64_t> l3_size[MAX_CPUS];
+    if (cpu < 0 || cpu >= MAX_CPUS) cpu = 0;
+    int64_t size = l3_size[cpu].load(std::memory_order_relaxed);
+    if (size == 0) {
+        size = get_cache_size(cpu, 3);
+        if (size <= 0) size = 12 * KB * KB; // 12M
+        l3_size[cpu].store(size, std::memory_order_relaxed);
     }
-    return l3_size;
-}
\ No newline at end of file
+    return size;
+}
+
+// L3 of the socket the calling thread runs on
+inline int64_t get_L3_Size() {
+    return get_L3_Size(sched_getcpu());
+}
+
+// L1 data cache and L2 of a core, read once from cpu 0 (every core is
+// assumed alike); 32K / 1M when unknown. Level 1 is matched by its first
+// cache index, which is the data cache on x86.
+inline int64_t get_L1_Size() {
+    static const int64_t size = [] {
+        int64_t s = get_cache_size(0, 1);
+        return s > 0 ? s : 32 * 1024;
+    }();
+    return size;
+}
+
+inline int64_t get_L2_Size() {
+    static const int64_t size = [] {
+        int64_t s = get_cache_size(0, 2);
+        return s > 0 ? s : 1024 * 1024;
+    }();
+    return size;
+}
+
+// restrict the calling thread to cpus, new threads it creates inherit the mask
+inline bool pin_thread_to_cpus(const std::vector<int>& cpus) {
+    if (cpus.empty()) return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
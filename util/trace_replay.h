@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include "constants.h"
+#include "io_trace.h"
+#include "metrics.h"
+
+// Offline replay of an io trace against a simulated SSD and page cache, so
+// cache, placement and batching policies can be compared without touching
+// the device. Every query issues the reads of its missed blocks at its
+// arrival time; a read waits for a free queue slot and for the IOPS and
+// bandwidth budget, then takes latency + bytes / bandwidth. The query
+// finishes with its last read, hits cost nothing.
+
+struct DeviceModel {
+    double iops = 500000;
+    double latency_us = 80;
+    int queue_depth = 32;
+    double bandwidth_mbps = 3000;
+};
+
+struct ReplayConfig {
+    DeviceModel device;
+    uint64_t cache_bytes = GIGABYTE;
+    // arrivals every 1 / qps seconds, 0 keeps the trace timestamps
+    double qps = 0;
+    // size of the blocks traced with bytes = 0
+    uint32_t block_bytes = PAGESIZE;
+};
+
+struct ReplayStats {
+    int64_t queries = 0;
+    int64_t reads = 0;
+    int64_t hits = 0;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_hit = 0;
+    double makespan_us = 0;
+    Histogram latency_ns;
+
+    double hit_ratio() const { return reads + hits ? (double)hits / (reads + hits) : 0; }
+    double byte_hit_ratio() const {
+        return bytes_read + bytes_hit ? (double)bytes_hit / (bytes_read + bytes_hit) : 0;
+    }
+
+    void print() const {
+        auto snap = latency_ns.snapshot();
+        std::cout << "replay " << queries << " queries, " << reads + hits << " block accesses" << std::endl;
+        std::cout << "hit ratio: " << hit_ratio() << ", byte hit ratio: " << byte_hit_ratio() << std::endl;
+        std::cout << "device reads: " << reads << ", bytes read: " << bytes_read
+                  << ", makespan: " << makespan_us / 1000 << " ms" << std::endl;
+        std::cout << "projected latency us: avg " << (snap.count ? snap.sum / 1000.0 / snap.count : 0)
+                  << ", p50 " << snap.percentile(0.5) / 1000.0
+                  << ", p99 " << snap.percentile(0.99) / 1000.0
+                  << ", max " << snap.percentile(1.0) / 1000.0 << std::endl;
+    }
+};
+
+// LRU over whole blocks, sized in pages
+class BlockLRUCache {
+ public:
+    explicit BlockLRUCache(uint64_t capacity_bytes) : capacity_(capacity_bytes) {}
+
+    // true on a hit, a miss inserts the block and evicts from the cold end
+    bool access(uint64_t key, uint64_t bytes) {
+        auto it = map_.find(key);
+        if (it != map_.end()) {
+            lru_.splice(lru_.begin(), lru_, it->second);
+            return true;
+        }
+        if (bytes > capacity_) return false;
+        while (used_ + bytes > capacity_) {
+            used_ -= lru_.back().second;
+            map_.erase(lru_.back().first);
+            lru_.pop_back();
+        }
+        lru_.emplace_front(key, bytes);
+        map_[key] = lru_.begin();
+        used_ += bytes;
+        return false;
+    }
+
+ private:
+    uint64_t capacity_;
+    uint64_t used_ = 0;
+    std::list<std::pair<uint64_t, uint64_t>> lru_;
+    std::unordered_map<uint64_t, std::list<std::pair<uint64_t, uint64_t>>::iterator> map_;
+};
+
+inline void replay_trace(const std::vector<IOTraceRecord>& records,
+                         const ReplayConfig& config, ReplayStats& stats) {
+    const DeviceModel& dev = config.device;
+    const double us_per_io = dev.iops > 0 ? 1e6 / dev.iops : 0;
+    const double bytes_per_us = dev.bandwidth_mbps * MEGABYTE / 1e6;
+
+    BlockLRUCache cache(config.cache_bytes);
+    // completion times of the in-flight reads, one per queue slot
+    std::priority_queue<double, std::vector<double>, std::greater<double>> slots;
+    for (int i = 0; i < dev.queue_depth; i++) slots.push(0);
+    double next_issue = 0;
+
+    size_t i = 0;
+    while (i < records.size()) {
+        const uint32_t qid = records[i].query_id;
+        double arrival = config.qps > 0 ? stats.queries * 1e6 / config.qps
+                                        : records[i].timestamp_ns / 1000.0;
+        double finish = arrival;
+        for (; i < records.size() && records[i].query_id == qid; i++) {
+            const auto& r = records[i];
+            uint64_t bytes = r.bytes ? r.bytes : config.block_bytes;
+            bytes = (bytes + PAGESIZE - 1) / PAGESIZE * PAGESIZE;
+            uint64_t key = ((uint64_t)r.cluster_id << 32) | (r.block_id & 0xffffff);
+            if (cache.access(key, bytes)) {
+                stats.hits++;
+                stats.bytes_hit += bytes;
+                continue;
+            }
+            double start = std::max({arrival, slots.top(), next_issue});
+            slots.pop();
+            double transfer = bytes_per_us > 0 ? bytes / bytes_per_us : 0;
+            double done = start + dev.latency_us + transfer;
+            slots.push(done);
+            // the IOPS budget and the bandwidth are shared by all the slots
+            next_issue = start + std::max(us_per_io, transfer);
+            finish = std::max(finish, done);
+            stats.reads++;
+            stats.bytes_read += bytes;
+        }
+        stats.latency_ns.record((uint64_t)((finish - arrival) * 1000));
+        stats.makespan_us = std::max(stats.makespan_us, finish);
+        stats.queries++;
+    }
+}
@@ -10,9 +10,12 @@
 #include <algorithm>
 #include <sys/stat.h>
 
+#include "arena.h"
 #include "file_handler.h" 
 #include "distance.h"
 #include "defines.h"
+#include "random.h"
+#include "result_set.h"
 
 
 template <typename T1, typename T2, typename R>
@@ -53,7 +56,8 @@ inline void load_meta_impl(const std::string& index_path,
                const int K1) {
     for (int i = 0; i < K1; i ++) {
         std::ifstream reader(index_path + CLUSTER + std::to_string(i) + META + BIN, std::ios::binary);
-        uint32_t nmeta, dmeta;
+        // a cluster without a meta file has no blocks
+        uint32_t nmeta = 0, dmeta = 1;
         reader.read((char*)&nmeta, sizeof(uint32_t));
         reader.read((char*)&dmeta, sizeof(uint32_t));
         assert(1 == dmeta);
@@ -95,6 +99,22 @@ inline void read_bin_file(const std::string& file_name, T*& data, uint32_t& n,
               << n << ", dim = " << dim << std::endl;
 }
 
+// the same into a HugeArray mapped with mode
+template<typename T>
+inline void read_bin_file(const std::string& file_name, HugeArray<T>& data, uint32_t& n,
+                          uint32_t& dim, HugePageMode mode) {
+    std::ifstream reader(file_name, std::ios::binary);
+
+    reader.read((char*)&n, sizeof(uint32_t));
+    reader.read((char*)&dim, sizeof(uint32_t));
+    data = HugeArray<T>((uint64_t)n * dim, mode);
+    reader.read((char*)data.data(), sizeof(T) * (uint64_t)n * dim);
+
+    reader.close();
+    std::cout << "read binary file from " << file_name << " done in ... seconds, n = "
+              << n << ", dim = " << dim << ", pages: " << hugepage_mode_name(data.backing()) << std::endl;
+}
+
 template<typename T>
 void reservoir_sampling(const std::string& data_file, const size_t sample_num, T* sample_data) {
     assert(sample_data != nullptr);
@@ -139,8 +159,9 @@ void reservoir_sampling_residual(
     std::random_device rd;
     std::mt19937 generator((unsigned)(rd()));
     uint32_t cluster_size, cluster_dim, global_cnt = 0;
-    std::vector<T> cluster_data;
-    std::vector<uint32_t> ivf_cen_offsets(sample_num);
+    ArenaScope scratch;
+    uint32_t* ivf_cen_offsets = scratch.alloc<uint32_t>(sample_num);
+    std::fill(ivf_cen_offsets, ivf_cen_offsets + sample_num, 0);
 
     uint32_t i = 0; // default choose
 
@@ -152,11 +173,11 @@ void reservoir_sampling_residual(
     assert(cluster_dim == dim);
 
     // read vectors in each cluster
-    const uint64_t total_size = cluster_size * cluster_dim;
-    cluster_data.resize(total_size);
-    data_reader.read((char*)(cluster_data.data()), total_size * sizeof(T));
+    const uint64_t total_size = (uint64_t)cluster_size * cluster_dim;
+    T* cluster_data = scratch.alloc<T>(total_size);
+    data_reader.read((char*)cluster_data, total_size * sizeof(T));
 
-    const T* vec = cluster_data.data();
+    const T* vec = cluster_data;
     for (size_t j = 0; j < metas[i].size(); ++j) {
         for (uint32_t k = 0; k < metas[i][j]; ++k) {
             // deal with the situation when one bucket is not enough
@@ -195,11 +216,8 @@ void random_sampling_k2(
         T* sample_data,
         int64_t seed = 1234
 ) {
-    std::vector<int> perm(data_size);
-    for (int64_t i = 0; i < data_size; i++) {
-        perm[i] = i;
-    }
-    std::shuffle(perm.begin(), perm.end(), std::default_random_engine(seed));
+    std::vector<int64_t> perm(data_size);
+    rand_perm(perm.data(), data_size, sample_size, seed);
     for (int64_t i = 0; i < sample_size; i++) {
         memcpy(sample_data + i * dim, data + perm[i] * dim,  dim * sizeof(T));
     }
@@ -266,6 +284,15 @@ inline MetricType get_metric_type_by_name(const std::string& mt_name) {
     return MetricType::None;
 }
 
+inline HugePageMode get_hugepage_mode_by_name(const std::string& s) {
+    if (s == "thp") {
+        return HugePageMode::THP;
+    } else if (s == "hugetlb") {
+        return HugePageMode::HUGETLB;
+    }
+    return HugePageMode::None;
+}
+
 inline QuantizerType get_quantizer_type_by_name(const std::string& s) {
     if (s == "PQ") {
         return QuantizerType::PQ;
@@ -275,65 +302,6 @@ inline QuantizerType get_quantizer_type_by_name(const std::string& s) {
     return QuantizerType::None;
 }
 
-template<typename DISTT, typename IDT>
-void print_vec_id_dis(std::vector<std::vector<std::pair<IDT, DISTT>>>& v, const std::string msg) {
-    std::cout << "<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<" << std::endl;
-    std::cout << msg << std::endl;
-    for (auto i = 0; i < v.size(); i ++) {
-        for (auto j = 0; j < v[i].size(); j ++) {
-            std::cout << "(" << v[i][j].first << ", " << v[i][j].second << ") ";
-        }
-        std::cout << std::endl;
-    }
-    std::cout << "<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<" << std::endl;
-}
-
-template<typename DISTT, typename IDT>
-void read_sift(std::vector<std::vector<std::pair<IDT, DISTT>>>& v, const std::string& gt_file, uint32_t& nq, uint32_t& topk) {
-    nq = 100; // default value 
-
-    std::ifstream gin(gt_file, std::ios::binary);
-    uint32_t sz;
-    v.resize(nq);
-    for (auto i = 0; i < nq; i ++) {
-        gin.read((char*)&sz, sizeof(sz));
-        v[i].resize(sz);
-        for (auto j = 0; j < sz; j ++) {
-            gin.read((char*)&v[i][j].first, sizeof(IDT));
-            gin.read((char*)&v[i][j].second, sizeof(DISTT));
-        }
-    }
-    topk = sz;
-    gin.close();
-}
-
-template<typename FILE_DISTT, typename FILE_IDT, typename DISTT, typename IDT>
-void read_comp(std::vector<std::vector<std::pair<IDT, DISTT>>>& v, const std::string& gt_file, uint32_t& nq, uint32_t& topk) {
-    std::ifstream gin(gt_file, std::ios::binary);
-
-    gin.read((char*)&nq, sizeof(uint32_t));
-    gin.read((char*)&topk, sizeof(uint32_t));
-
-    v.resize(nq);
-    FILE_IDT t_id;
-    for (uint32_t i = 0; i < nq; ++i) {
-        v[i].resize(topk);
-        for (uint32_t j = 0; j < topk; ++j) {
-            gin.read((char*)&t_id, sizeof(FILE_IDT));
-            v[i][j].first = static_cast<IDT>(t_id);
-        }
-    }
-
-    FILE_DISTT t_dist;
-    for (uint32_t i = 0; i < nq; ++i) {
-        for (uint32_t j = 0; j < topk; ++j) {
-            gin.read((char*)&t_dist, sizeof(FILE_DISTT));
-            v[i][j].second = static_cast<DISTT>(t_dist);
-        }
-    }
-    gin.close();
-}
-
 // TODO: need a is_range_search argument from top-level
 template<typename FILE_IDT, typename IDT>
 void read_comp_range_search(
@@ -374,31 +342,31 @@ void recall(const std::string& groundtruth_file, const std::string& answer_file,
               << " cmp_id: " << cmp_id
               << std::endl;
 
-    uint32_t gt_nq, gt_topk, answer_nq, answer_topk;
-
-    std::vector<std::vector<std::pair<IDT, DISTT>>> groundtruth;
+    ResultSet<DISTT, IDT> groundtruth;
     if (use_comp_format) {
-        read_comp<float, uint32_t, DISTT, IDT>(groundtruth, groundtruth_file, gt_nq, gt_topk);
+        read_comp<float, uint32_t>(groundtruth, groundtruth_file);
     } else {
-        read_sift<DISTT, IDT>(groundtruth, groundtruth_file, gt_nq, gt_topk);
+        read_sift(groundtruth, groundtruth_file);
     }
 
-    // print_vec_id_dis<DISTT, IDT>(groundtruth, "show groundtruth:");
+    // print_vec_id_dis(groundtruth, "show groundtruth:");
 
-    std::vector<std::vector<std::pair<IDT, DISTT>>> resultset;
+    ResultSet<DISTT, IDT> resultset;
     if (use_comp_format) {
-        read_comp<DISTT, IDT, DISTT, IDT>(resultset, answer_file, answer_nq, answer_topk);
+        read_comp<DISTT, IDT>(resultset, answer_file);
     } else {
-        read_sift<DISTT, IDT>(resultset, answer_file, answer_nq, answer_topk);
+        read_sift(resultset, answer_file);
     }
 
+    const int64_t gt_nq = groundtruth.nq, gt_topk = groundtruth.k;
+    const int64_t answer_nq = resultset.nq, answer_topk = resultset.k;
     if (gt_nq != answer_nq || gt_topk < answer_topk) { // || gt_topk != answer_topk) {
         std::cerr << "Grountdtruth parammeters does not match. GT nq " << gt_nq
         << "(" << answer_nq << "), topk " << gt_topk << "(" << answer_topk << ")" << std::endl;
         return ;
     }
 
-    // print_vec_id_dis<DISTT, IDT>(resultset, "show resultset:");
+    // print_vec_id_dis(resultset, "show resultset:");
 
     int max_recall, min_recall;
     // recall statistics
@@ -414,13 +382,15 @@ void recall(const std::string& groundtruth_file, const std::string& answer_file,
               << answer_file << " is:" << std::endl;
     if (cmp_id) {
         for (auto i = 0; i < answer_nq; i ++) {
+            auto gt = groundtruth.row(i);
+            auto res = resultset.row(i);
             std::unordered_map<IDT, bool> hash;
             int cnti = 0;
             for (auto j = 0; j < answer_topk; j ++) {
-                hash[groundtruth[i][j].first] = true;
+                hash[gt.ids[j]] = true;
             }
             for (auto j = 0; j < answer_topk; j ++) {
-                if (hash.find(resultset[i][j].first) != hash.end())
+                if (hash.find(res.ids[j]) != hash.end())
                     cnti ++;
             }
             recalls[i] = cnti;
@@ -430,9 +400,11 @@ void recall(const std::string& groundtruth_file, const std::string& answer_file,
     } else {
         if (MetricType::L2 == metric_type) {
             for (auto i = 0; i < answer_nq; i ++) {
+                const DISTT* res = resultset.row(i).dis;
+                const DISTT kth = groundtruth.row(i).dis[answer_topk - 1];
                 int cnti = 0;
                 for (auto j = 0; j < answer_topk; j ++) {
-                    if (resultset[i][j].second <= groundtruth[i][answer_topk - 1].second)
+                    if (res[j] <= kth)
                         cnti ++;
                 }
                 recalls[i] = cnti;
@@ -442,9 +414,11 @@ void recall(const std::string& groundtruth_file, const std::string& answer_file,
             std::cout << "avg recall@" << answer_topk << " = " << ((double)(tot_cnt)) / answer_topk / answer_nq * 100 << "%." << std::endl;
         } else if (MetricType::IP == metric_type) {
             for (auto i = 0; i < answer_nq; i ++) {
+                const DISTT* res = resultset.row(i).dis;
+                const DISTT kth = groundtruth.row(i).dis[answer_topk - 1];
                 int cnti = 0;
                 for (auto j = 0; j < answer_topk; j ++) {
-                    if (resultset[i][j].second >= groundtruth[i][answer_topk - 1].second)
+                    if (res[j] >= kth)
                         cnti ++;
                 }
                 recalls[i] = cnti;
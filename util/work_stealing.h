@@ -0,0 +1,182 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <algorithm>
+
+#include "system.h"
+
+// A small work-stealing executor for query and cluster-scan loops.
+// Every worker owns a deque of index ranges. The owner pops from the back
+// and splits big ranges in half, idle workers steal from the front of the
+// other deques, so skewed per-task cost (e.g. cluster sizes) is rebalanced
+// at runtime instead of being fixed by a static schedule.
+// The calling thread joins the work as worker 0. Given cpus, worker t
+// pins itself to cpus[t % cpus.size()], e.g. the cpus of one NUMA node.
+
+class WorkStealingPool {
+ public:
+    using Task = std::function<void(int64_t, int)>; // (task index, worker id)
+
+    explicit WorkStealingPool(int nthreads = std::thread::hardware_concurrency(), std::vector<int> cpus = {})
+        : nthreads_(nthreads > 0 ? nthreads : 1), queues_(nthreads_), cpus_(std::move(cpus)) {
+        for (int t = 1; t < nthreads_; t++) {
+            workers_.emplace_back(&WorkStealingPool::worker_loop, this, t);
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto& w : workers_) {
+            w.join();
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    int num_threads() const { return nthreads_; }
+
+    static WorkStealingPool& global() {
+        static WorkStealingPool pool;
+        return pool;
+    }
+
+    // run f(i, worker_id) for i in [0, n), ranges are never split below grain.
+    // the worker id is in [0, num_threads()) and can index per-thread buffers.
+    void parallel_for(int64_t n, const Task& f, int64_t grain = 1) {
+        if (n <= 0) return;
+        if (grain < 1) grain = 1;
+        std::lock_guard<std::mutex> run_lk(run_mu_);
+
+        // seed the deques with a static partition, stealing fixes the skew
+        int64_t chunk = (n + nthreads_ - 1) / nthreads_;
+        for (int t = 0; t < nthreads_; t++) {
+            int64_t from = std::min(n, t * chunk), to = std::min(n, from + chunk);
+            if (from < to) {
+                queues_[t].q.push_back({from, to});
+            }
+        }
+
+        task_.store(&f, std::memory_order_relaxed);
+        grain_ = grain;
+        pending_.store(n, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            epoch_++;
+        }
+        cv_.notify_all();
+
+        run_tasks(0);
+        while (pending_.load(std::memory_order_acquire) > 0) {
+            std::this_thread::yield();
+        }
+        // wait for the workers to leave run_tasks before the task goes out of scope
+        while (active_.load(std::memory_order_acquire) > 0) {
+            std::this_thread::yield();
+        }
+        task_.store(nullptr, std::memory_order_relaxed);
+    }
+
+ private:
+    struct Range {
+        int64_t from;
+        int64_t to;
+    };
+
+    struct alignas(64) TaskQueue {
+        std::mutex mu;
+        std::deque<Range> q;
+    };
+
+    void worker_loop(int tid) {
+        if (!cpus_.empty()) pin_thread_to_cpus({cpus_[tid % cpus_.size()]});
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lk(mu_);
+                cv_.wait(lk, [&] { return stop_ || epoch_ != seen; });
+                if (stop_) return;
+                seen = epoch_;
+                active_.fetch_add(1, std::memory_order_acq_rel);
+            }
+            run_tasks(tid);
+            active_.fetch_sub(1, std::memory_order_acq_rel);
+        }
+    }
+
+    bool pop_local(int tid, Range& r) {
+        auto& tq = queues_[tid];
+        std::lock_guard<std::mutex> lk(tq.mu);
+        if (tq.q.empty()) return false;
+        r = tq.q.back();
+        tq.q.pop_back();
+        // keep the upper half stealable, work on the lower half
+        while (r.to - r.from > grain_) {
+            int64_t mid = r.from + (r.to - r.from) / 2;
+            tq.q.push_back({mid, r.to});
+            r.to = mid;
+        }
+        return true;
+    }
+
+    bool steal(int tid, Range& r) {
+        for (int i = 1; i < nthreads_; i++) {
+            auto& tq = queues_[(tid + i) % nthreads_];
+            std::lock_guard<std::mutex> lk(tq.mu);
+            if (!tq.q.empty()) {
+                r = tq.q.front();
+                tq.q.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run_tasks(int tid) {
+        Range r;
+        while (pending_.load(std::memory_order_acquire) > 0) {
+            if (!pop_local(tid, r)) {
+                if (!steal(tid, r)) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                // re-queue the stolen range locally so it is split like our own
+                std::lock_guard<std::mutex> lk(queues_[tid].mu);
+                queues_[tid].q.push_back(r);
+                continue;
+            }
+            const Task& f = *task_.load(std::memory_order_relaxed);
+            for (int64_t i = r.from; i < r.to; i++) {
+                f(i, tid);
+            }
+            pending_.fetch_sub(r.to - r.from, std::memory_order_acq_rel);
+        }
+    }
+
+    int nthreads_;
+    std::vector<TaskQueue> queues_;
+    std::vector<std::thread> workers_;
+    std::vector<int> cpus_;
+
+    std::mutex run_mu_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    uint64_t epoch_ = 0;
+    bool stop_ = false;
+
+    std::atomic<const Task*> task_{nullptr};
+    int64_t grain_ = 1;
+    std::atomic<int64_t> pending_{0};
+    std::atomic<int> active_{0};
+};